@@ -0,0 +1,205 @@
+// Times SceneNode::updateTransformTree() over a wide scene: serially and with JobSystem of 1..N workers.
+// Tree is a root with groups, each group has many children (updated as jobs) and those have a few children each.
+// Same for recording draws of the flattened scene, split into slices spread over workers the way the app does it
+// (see Renderer::recordSecondaries()). There's no GPU here, so each slice encodes commands of the same shape
+// CommandRecorder::drawSceneNodes() records (node's descriptor set, vertex and index buffer, pipeline, draw) into its own stream
+// and collects used buffer handles, which are then marked used in slice order (see CommandRecorder::mergeSecondaries()).
+//
+// Usage: kris_bench_jobs [max worker count]
+
+#include "kris/scene.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+	enum : uint32_t
+	{
+		GroupCount = 64U,
+		ChildrenPerGroup = 512U,
+		LeavesPerChild = 4U,
+
+		WarmupIterations = 4U,
+		Iterations = 64U,
+
+		// same as the app's and Renderer's
+		MinNodesPerSlice = 256U,
+		MaxRecordingThreads = 8U,
+		// nodes share buffers and pipelines of this many meshes
+		MeshCount = 1024U,
+	};
+
+	using clock_t = std::chrono::steady_clock;
+
+	kris::refctd<kris::SceneNode> createNode(float x, float y, float z)
+	{
+		auto node = nbl::core::make_smart_refctd_ptr<kris::SceneNode>();
+		node->getLocalTransform().setTranslation(nbl::core::vectorSIMDf(x, y, z, 0.f));
+		return node;
+	}
+
+	kris::refctd<kris::SceneNode> createTree(uint32_t& nodeCount)
+	{
+		auto root = createNode(0.f, 0.f, 0.f);
+		nodeCount = 1U;
+		for (uint32_t g = 0U; g < GroupCount; ++g)
+		{
+			auto group = createNode((float)g, 0.f, 0.f);
+			for (uint32_t c = 0U; c < ChildrenPerGroup; ++c)
+			{
+				auto child = createNode(0.f, (float)c, 0.f);
+				for (uint32_t l = 0U; l < LeavesPerChild; ++l)
+					child->addChild(createNode(0.f, 0.f, (float)l));
+				group->addChild(std::move(child));
+			}
+			root->addChild(std::move(group));
+		}
+		nodeCount += GroupCount * (1U + ChildrenPerGroup * (1U + LeavesPerChild));
+		return root;
+	}
+
+	// Stand-in of Renderer::recordSecondaries() with CommandRecorder::drawSceneNodes() per slice
+	class DrawRecorder
+	{
+	public:
+		explicit DrawRecorder(kris::SceneNode* root)
+		{
+			root->flatten(m_nodes);
+			for (uint32_t i = 0U; i < MeshCount; ++i)
+				m_meshes[i] = { 2U * i, 2U * i + 1U, 36U * (i + 1U) };
+			m_lastUsedFrames.resize(2U * MeshCount, 0ULL);
+		}
+
+		uint32_t getNodeCount() const { return (uint32_t)m_nodes.size(); }
+		uint32_t getSliceCount() const { return std::clamp((getNodeCount() + MinNodesPerSlice - 1U) / MinNodesPerSlice, 1U, (uint32_t)MaxRecordingThreads); }
+
+		// `jobs` may be null, slices are recorded serially then
+		void record(kris::JobSystem* jobs)
+		{
+			const uint32_t nodeCount = getNodeCount();
+			const uint32_t sliceCount = getSliceCount();
+			const uint32_t nodesPerSlice = (nodeCount + sliceCount - 1U) / sliceCount;
+			m_frame++;
+
+			auto recordSlices = [this, nodeCount, nodesPerSlice](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t s = begin; s < end; ++s)
+				{
+					const uint32_t first = std::min(s * nodesPerSlice, nodeCount);
+					const uint32_t last = std::min(first + nodesPerSlice, nodeCount);
+					recordSlice(m_slices[s], first, last);
+				}
+			};
+			if (jobs)
+				jobs->parallelFor(sliceCount, 1U, recordSlices);
+			else
+				recordSlices(0U, sliceCount);
+
+			for (uint32_t s = 0U; s < sliceCount; ++s)
+			{
+				for (uint32_t h : m_slices[s].usedHandles)
+					m_lastUsedFrames[h] = m_frame;
+			}
+		}
+
+	private:
+		enum ECmd : uint32_t
+		{
+			BindDescriptorSet,
+			BindVertexBuffer,
+			BindIndexBuffer,
+			BindPipeline,
+			DrawIndexed,
+		};
+		struct Cmd
+		{
+			ECmd type;
+			uint32_t arg;
+			const void* object;
+		};
+		struct MeshBindings
+		{
+			uint32_t vtxHandle;
+			uint32_t idxHandle;
+			uint32_t idxCount;
+		};
+		struct Slice
+		{
+			nbl::core::vector<Cmd> cmds;
+			nbl::core::vector<uint32_t> usedHandles;
+		};
+
+		void recordSlice(Slice& slice, uint32_t first, uint32_t last)
+		{
+			slice.cmds.clear();
+			slice.usedHandles.clear();
+			for (uint32_t i = first; i < last; ++i)
+			{
+				const kris::SceneNode* const node = m_nodes[i];
+				const MeshBindings& mesh = m_meshes[i % MeshCount];
+
+				slice.cmds.push_back({ BindDescriptorSet, node->m_uboOffset, node });
+				slice.usedHandles.push_back(mesh.vtxHandle);
+				slice.cmds.push_back({ BindVertexBuffer, mesh.vtxHandle, &mesh });
+				slice.usedHandles.push_back(mesh.idxHandle);
+				slice.cmds.push_back({ BindIndexBuffer, mesh.idxHandle, &mesh });
+				slice.cmds.push_back({ BindPipeline, 0U, &mesh });
+				slice.cmds.push_back({ DrawIndexed, mesh.idxCount, nullptr });
+			}
+		}
+
+		nbl::core::vector<kris::SceneNode*> m_nodes;
+		MeshBindings m_meshes[MeshCount];
+		Slice m_slices[MaxRecordingThreads];
+		nbl::core::vector<uint64_t> m_lastUsedFrames;
+		uint64_t m_frame = 0ULL;
+	};
+
+	// Best of Iterations, in milliseconds
+	template <typename Update>
+	double measure(Update&& update)
+	{
+		for (uint32_t i = 0U; i < WarmupIterations; ++i)
+			update();
+
+		double best = 1e30;
+		for (uint32_t i = 0U; i < Iterations; ++i)
+		{
+			const auto t0 = clock_t::now();
+			update();
+			best = std::min(best, std::chrono::duration<double, std::milli>(clock_t::now() - t0).count());
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t hwWorkers = std::max(std::thread::hardware_concurrency(), 1U);
+	const uint32_t maxWorkers = std::min<uint32_t>(argc > 1 ? (uint32_t)std::max(atoi(argv[1]), 1) : hwWorkers, kris::JobSystem::MaxWorkers);
+
+	uint32_t nodeCount = 0U;
+	kris::refctd<kris::SceneNode> root = createTree(nodeCount);
+	DrawRecorder recorder(root.get());
+	printf("%u nodes, draws recorded in %u slices, best of %u iterations\n", nodeCount, recorder.getSliceCount(), (uint32_t)Iterations);
+	printf("%-12s %-27s %s\n", "", "updateTransformTree", "draw recording");
+
+	const double serialMs = measure([&root] { root->updateTransformTree(); });
+	const double serialRecordMs = measure([&recorder] { recorder.record(nullptr); });
+	printf("%-12s %8.3f ms%16s %8.3f ms\n", "serial", serialMs, "", serialRecordMs);
+
+	// fresh job system per worker count, the calling thread can be worker 0 of just one at a time
+	for (uint32_t workers = 1U; workers <= maxWorkers; ++workers)
+	{
+		kris::JobSystem jobs;
+		jobs.init(workers);
+
+		const double ms = measure([&root, &jobs] { root->updateTransformTree(&jobs); });
+		const double recordMs = measure([&recorder, &jobs] { recorder.record(&jobs); });
+		printf("%2u workers   %8.3f ms  speedup %5.2fx %8.3f ms  speedup %5.2fx\n", workers, ms, serialMs / ms, recordMs, serialRecordMs / recordMs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+// Compares the two ways of keeping resources used by recorded draws alive until GPU is done with them, over the same stream of 100k draws:
+// reference per binding kept by the frame until it retires (as DeferredAllocDeletion did), and frame value stored into dense
+// handle table (as ResourceAllocator::markUsed() does). Only the tracking is timed (dropping references of the retired frame included),
+// draws bind a few random resources of a big set.
+// Recording is done in slices (like Renderer::recordSecondaries()), serially and over JobSystem of 1..N workers,
+// where references taken from several threads contend on resources' counters.
+//
+// Usage: kris_bench_record [max worker count]
+
+#include "kris/job_system.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace
+{
+	enum : uint32_t
+	{
+		DrawCount = 100000U,
+		BindingsPerDraw = 6U, // vertex and index buffer, node's and material's buffers, two textures
+		ResourceCount = 1U << 14,
+		SliceCount = 8U, // Renderer::MaxRecordingThreads
+		FramesInFlight = 3U,
+
+		WarmupFrames = 8U,
+		Frames = 64U,
+	};
+
+	using clock_t = std::chrono::steady_clock;
+
+	// Same layout as ResourceAllocator's handles and slots
+	struct Handle
+	{
+		uint32_t index;
+		uint32_t generation;
+	};
+	struct HandleSlot
+	{
+		void* allocation = nullptr;
+		uint32_t generation = 0U;
+		uint64_t lastUsedFrame = 0ULL;
+	};
+
+	class TrackedResource final : public nbl::core::IReferenceCounted
+	{
+	public:
+		explicit TrackedResource(Handle h) : handle(h) {}
+
+		Handle handle;
+
+	protected:
+		~TrackedResource() override = default;
+	};
+
+	struct Draw
+	{
+		TrackedResource* bindings[BindingsPerDraw];
+	};
+
+	// References taken by a frame's slices, dropped once the frame retires
+	struct RefcountedTracking
+	{
+		nbl::core::vector<kris::refctd<TrackedResource>> frames[FramesInFlight][SliceCount];
+
+		void beginFrame(uint64_t frame)
+		{
+			for (auto& slice : frames[frame % FramesInFlight])
+				slice.clear();
+		}
+		void record(uint64_t frame, uint32_t sliceIx, const Draw* draws, uint32_t count)
+		{
+			auto& refs = frames[frame % FramesInFlight][sliceIx];
+			for (uint32_t d = 0U; d < count; ++d)
+			{
+				for (TrackedResource* res : draws[d].bindings)
+					refs.emplace_back(res);
+			}
+		}
+	};
+
+	struct HandleTracking
+	{
+		nbl::core::vector<HandleSlot> slots;
+
+		void beginFrame(uint64_t) {}
+		void record(uint64_t frame, uint32_t, const Draw* draws, uint32_t count)
+		{
+			for (uint32_t d = 0U; d < count; ++d)
+			{
+				for (TrackedResource* res : draws[d].bindings)
+				{
+					HandleSlot& slot = slots[res->handle.index];
+					if (slot.generation == res->handle.generation)
+						slot.lastUsedFrame = frame;
+				}
+			}
+		}
+	};
+
+	// Best of Frames, in milliseconds. `jobs` may be null, slices are recorded serially then.
+	template <typename Tracking>
+	double measure(Tracking& tracking, const nbl::core::vector<Draw>& draws, kris::JobSystem* jobs)
+	{
+		const uint32_t drawsPerSlice = (DrawCount + SliceCount - 1U) / SliceCount;
+		auto recordSlices = [&](uint64_t frame, uint32_t begin, uint32_t end)
+		{
+			for (uint32_t s = begin; s < end; ++s)
+			{
+				const uint32_t first = std::min(s * drawsPerSlice, (uint32_t)DrawCount);
+				const uint32_t last = std::min(first + drawsPerSlice, (uint32_t)DrawCount);
+				tracking.record(frame, s, draws.data() + first, last - first);
+			}
+		};
+
+		double best = 1e30;
+		for (uint64_t frame = 1ULL; frame <= WarmupFrames + Frames; ++frame)
+		{
+			const auto t0 = clock_t::now();
+			tracking.beginFrame(frame);
+			if (jobs)
+				jobs->parallelFor(SliceCount, 1U, [&](uint32_t begin, uint32_t end) { recordSlices(frame, begin, end); });
+			else
+				recordSlices(frame, 0U, SliceCount);
+			const double ms = std::chrono::duration<double, std::milli>(clock_t::now() - t0).count();
+			if (frame > WarmupFrames)
+				best = std::min(best, ms);
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t hwWorkers = std::max(std::thread::hardware_concurrency(), 1U);
+	const uint32_t maxWorkers = std::min<uint32_t>(argc > 1 ? (uint32_t)std::max(atoi(argv[1]), 1) : hwWorkers, kris::JobSystem::MaxWorkers);
+
+	HandleTracking handleTracking;
+	nbl::core::vector<kris::refctd<TrackedResource>> resources;
+	for (uint32_t i = 0U; i < ResourceCount; ++i)
+	{
+		handleTracking.slots.emplace_back();
+		resources.push_back(nbl::core::make_smart_refctd_ptr<TrackedResource>(Handle{ i, 0U }));
+		handleTracking.slots.back().allocation = resources.back().get();
+	}
+
+	// same draw stream for both
+	std::mt19937 rng(42U);
+	std::uniform_int_distribution<uint32_t> pick(0U, ResourceCount - 1U);
+	nbl::core::vector<Draw> draws(DrawCount);
+	for (Draw& draw : draws)
+	{
+		for (TrackedResource*& res : draw.bindings)
+			res = resources[pick(rng)].get();
+	}
+
+	printf("%u draws with %u bindings each in %u slices, best of %u frames\n", (uint32_t)DrawCount, (uint32_t)BindingsPerDraw, (uint32_t)SliceCount, (uint32_t)Frames);
+	printf("%-12s %12s %12s %9s\n", "", "refcounted", "markUsed", "speedup");
+
+	auto report = [&draws, &handleTracking](const char* name, kris::JobSystem* jobs)
+	{
+		RefcountedTracking refcounted;
+		const double refMs = measure(refcounted, draws, jobs);
+		const double handleMs = measure(handleTracking, draws, jobs);
+		printf("%-12s %9.3f ms %9.3f ms %8.2fx\n", name, refMs, handleMs, refMs / handleMs);
+	};
+
+	report("serial", nullptr);
+	// fresh job system per worker count, the calling thread can be worker 0 of just one at a time
+	for (uint32_t workers = 1U; workers <= maxWorkers; ++workers)
+	{
+		kris::JobSystem jobs;
+		jobs.init(workers);
+
+		char name[16];
+		snprintf(name, sizeof(name), "%2u workers", workers);
+		report(name, &jobs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+// Compares copies into staging memory: plain memcpy, StagingWriter::streamCopy (non-temporal stores) on one thread and
+// StagingWriter::write (chunks split over JobSystem) with 1..N workers, and reports GB/s for several copy sizes.
+// Destination is ordinary cached memory here, while real staging memory is usually write-combined, where non-temporal
+// stores gain more. Numbers are best of several repetitions, every repetition copies into memory untouched since the last one.
+//
+// Usage: kris_bench_staging [max worker count]
+
+#include "kris/staging_writer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+	enum : uint32_t
+	{
+		MinSizeLog2 = 16U, // 64K
+		MaxSizeLog2 = 28U, // 256M
+		SizeLog2Step = 2U,
+
+		// copies of less than this many bytes are repeated within one timed sample
+		MinBytesPerSample = 1U << 26,
+		SampleCount = 7U,
+	};
+
+	using clock_t = std::chrono::steady_clock;
+
+	// Best of SampleCount samples, in GB/s. Consecutive copies go to different parts of `dst` (as big as MaxSizeLog2 * 2)
+	// so small copies don't just hit in cache.
+	template <typename Copy>
+	double measure(uint8_t* dst, size_t dstSize, const uint8_t* src, size_t size, Copy&& copy)
+	{
+		const uint32_t reps = (uint32_t)std::max<size_t>(MinBytesPerSample / size, 1ULL);
+		const size_t slots = dstSize / size;
+
+		double best = 0.0;
+		size_t slot = 0ULL;
+		for (uint32_t s = 0U; s < SampleCount; ++s)
+		{
+			const auto t0 = clock_t::now();
+			for (uint32_t r = 0U; r < reps; ++r)
+			{
+				copy(dst + slot * size, src, size);
+				slot = (slot + 1ULL) % slots;
+			}
+			const double sec = std::chrono::duration<double>(clock_t::now() - t0).count();
+			best = std::max(best, (double)size * reps / sec * 1e-9);
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const uint32_t hwWorkers = std::max(std::thread::hardware_concurrency(), 1U);
+	const uint32_t maxWorkers = std::min<uint32_t>(argc > 1 ? (uint32_t)std::max(atoi(argv[1]), 1) : hwWorkers, kris::JobSystem::MaxWorkers);
+
+	const size_t maxSize = 1ULL << MaxSizeLog2;
+	const size_t dstSize = maxSize * 2ULL;
+	uint8_t* src = reinterpret_cast<uint8_t*>(malloc(maxSize));
+	uint8_t* dst = reinterpret_cast<uint8_t*>(malloc(dstSize));
+	// commit all the pages up front, page faults would dominate first copies otherwise
+	for (size_t i = 0ULL; i < maxSize; ++i)
+		src[i] = (uint8_t)(i * 31U);
+	memset(dst, 1, dstSize); // non-zero, malloc + zeroing may become calloc which leaves pages uncommitted
+
+	// worker counts: 2, 4 .. and maxWorkers, single thread is the streamCopy() column
+	nbl::core::vector<uint32_t> workerCounts;
+	for (uint32_t w = 2U; w < maxWorkers; w *= 2U)
+		workerCounts.push_back(w);
+	if (maxWorkers > 1U)
+		workerCounts.push_back(maxWorkers);
+
+	nbl::core::vector<size_t> sizes;
+	for (uint32_t sizeLog2 = MinSizeLog2; sizeLog2 <= MaxSizeLog2; sizeLog2 += SizeLog2Step)
+		sizes.push_back(1ULL << sizeLog2);
+
+	// columns: memcpy, streamCopy, write() for each worker count
+	const size_t columnCount = 2ULL + workerCounts.size();
+	nbl::core::vector<double> gbs(sizes.size() * columnCount);
+	for (size_t i = 0ULL; i < sizes.size(); ++i)
+	{
+		gbs[i * columnCount] = measure(dst, dstSize, src, sizes[i], [](uint8_t* d, const uint8_t* s, size_t n) { memcpy(d, s, n); });
+		gbs[i * columnCount + 1ULL] = measure(dst, dstSize, src, sizes[i], [](uint8_t* d, const uint8_t* s, size_t n) { kris::StagingWriter::streamCopy(d, s, n); });
+	}
+	// fresh job system per worker count, the calling thread can be worker 0 of just one at a time
+	for (size_t w = 0ULL; w < workerCounts.size(); ++w)
+	{
+		kris::JobSystem jobs;
+		jobs.init(workerCounts[w]);
+		kris::StagingWriter writer(&jobs);
+		for (size_t i = 0ULL; i < sizes.size(); ++i)
+			gbs[i * columnCount + 2ULL + w] = measure(dst, dstSize, src, sizes[i], [&writer](uint8_t* d, const uint8_t* s, size_t n) { writer.write(d, s, n); });
+	}
+
+	printf("GB/s, best of %u, StagingWriter::write() goes parallel from %u MiB\n", (uint32_t)SampleCount, (uint32_t)kris::StagingWriter::ParallelThreshold >> 20);
+	printf("%10s %8s %8s", "size", "memcpy", "stream");
+	for (uint32_t w : workerCounts)
+		printf("  write/%-2u", w);
+	printf("\n");
+	for (size_t i = 0ULL; i < sizes.size(); ++i)
+	{
+		if (sizes[i] >= (1ULL << 20))
+			printf("%8zuMi", sizes[i] >> 20);
+		else
+			printf("%8zuKi", sizes[i] >> 10);
+		printf(" %8.2f %8.2f", gbs[i * columnCount], gbs[i * columnCount + 1ULL]);
+		for (size_t w = 0ULL; w < workerCounts.size(); ++w)
+			printf("  %8.2f", gbs[i * columnCount + 2ULL + w]);
+		printf("\n");
+	}
+
+	free(dst);
+	free(src);
+
+	return 0;
+}
@@ -0,0 +1,242 @@
+// Replays an allocation trace against MemPool's address allocator backends (TLSF and nbl::core::GeneralpurposeAddressAllocator)
+// and reports time per operation and fragmentation of free space.
+//
+// Usage: kris_bench_tlsf [trace file]
+// Without trace file a synthetic one is generated. Trace file is text, one operation per line:
+//   a <id> <size> <alignment>
+//   f <id>
+
+#include "kris/tlsf_allocator.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace
+{
+	enum : uint32_t
+	{
+		// MemPool's block size and alignment limit
+		BlockSize = 64U,
+		MaxAlignment = 1024U,
+		// MemHeap's largest shared pool (they grow from 16M up to this), and its largest placed (non-dedicated) allocation
+		PoolSize = 1U << 28,
+		MaxAllocSize = 1U << 23,
+
+		SyntheticOpCount = 1U << 20,
+		// synthetic trace keeps live allocations around this share of the pool
+		SyntheticOccupancyPercent = 75U,
+		// fragmentation is sampled this many times during replay
+		SampleCount = 64U,
+	};
+
+	struct Op
+	{
+		bool alloc;
+		uint32_t id;
+		uint32_t size;
+		uint32_t alignment;
+	};
+
+	// Sizes are log-uniform between 256B and MaxAllocSize (small resources dominate), alignments pow2 up to MaxAlignment.
+	// Frees hit random live allocations, so holes of all sizes keep appearing.
+	std::vector<Op> generateTrace(uint32_t opCount)
+	{
+		std::mt19937 rng(0xC0FFEEU);
+		std::uniform_real_distribution<double> logSize(8.0, 23.0);
+		std::uniform_int_distribution<uint32_t> alignLog2(6U, 10U);
+
+		std::vector<Op> ops;
+		ops.reserve(opCount);
+		std::vector<std::pair<uint32_t, uint32_t>> live; // id, size
+		uint64_t liveSize = 0ULL;
+		uint32_t nextId = 0U;
+
+		const uint64_t targetSize = (uint64_t)PoolSize * SyntheticOccupancyPercent / 100U;
+		while (ops.size() < opCount)
+		{
+			const bool alloc = live.empty() || ((liveSize < targetSize) == ((rng() & 3U) != 0U));
+			if (alloc)
+			{
+				const uint32_t size = std::min<uint32_t>((uint32_t)std::exp2(logSize(rng)), MaxAllocSize);
+				ops.push_back({ true, nextId, size, 1U << alignLog2(rng) });
+				live.push_back({ nextId, size });
+				liveSize += size;
+				++nextId;
+			}
+			else
+			{
+				const size_t ix = std::uniform_int_distribution<size_t>(0ULL, live.size() - 1ULL)(rng);
+				ops.push_back({ false, live[ix].first, 0U, 0U });
+				liveSize -= live[ix].second;
+				live[ix] = live.back();
+				live.pop_back();
+			}
+		}
+		return ops;
+	}
+
+	bool loadTrace(const char* path, std::vector<Op>& out)
+	{
+		FILE* f = fopen(path, "r");
+		if (!f)
+			return false;
+
+		char kind;
+		Op op = {};
+		while (fscanf(f, " %c %u", &kind, &op.id) == 2)
+		{
+			op.alloc = (kind == 'a');
+			if (op.alloc && fscanf(f, "%u %u", &op.size, &op.alignment) != 2)
+				break;
+			out.push_back(op);
+		}
+		fclose(f);
+		return true;
+	}
+
+	// Same interface for both backends
+	struct TLSFBackend
+	{
+		static constexpr const char* Name = "TLSF";
+
+		kris::TLSFAddressAllocator alctr = kris::TLSFAddressAllocator(PoolSize, BlockSize);
+
+		uint32_t alloc(uint32_t size, uint32_t alignment) { return alctr.alloc_addr(size, alignment); }
+		void free(uint32_t addr, uint32_t size) { alctr.free_addr(addr, size); }
+		uint32_t getFreeSize() const { return alctr.get_free_size(); }
+		static bool isValid(uint32_t addr) { return addr != kris::TLSFAddressAllocator::invalid_address; }
+	};
+	struct GPBackend
+	{
+		using alctr_t = nbl::core::GeneralpurposeAddressAllocator<uint32_t>;
+
+		static constexpr const char* Name = "GeneralPurpose";
+
+		GPBackend() :
+			scratch(malloc(alctr_t::reserved_size(MaxAlignment, PoolSize, BlockSize))),
+			alctr(scratch, 0U, 0U, MaxAlignment, PoolSize, BlockSize)
+		{
+		}
+		~GPBackend()
+		{
+			::free(scratch);
+		}
+
+		void* scratch;
+		alctr_t alctr;
+
+		uint32_t alloc(uint32_t size, uint32_t alignment) { return alctr.alloc_addr(size, alignment); }
+		void free(uint32_t addr, uint32_t size) { alctr.free_addr(addr, size); }
+		uint32_t getFreeSize() const { return alctr.get_free_size(); }
+		static bool isValid(uint32_t addr) { return addr != alctr_t::invalid_address; }
+	};
+
+	// Biggest block-aligned allocation which currently succeeds, found by probing (alloc + free right away)
+	template <typename Backend>
+	uint32_t probeLargestAlloc(Backend& b)
+	{
+		uint32_t lo = 0U;
+		uint32_t hi = b.getFreeSize() / BlockSize;
+		while (lo < hi)
+		{
+			const uint32_t mid = lo + (hi - lo + 1U) / 2U;
+			const uint32_t addr = b.alloc(mid * BlockSize, BlockSize);
+			if (Backend::isValid(addr))
+			{
+				b.free(addr, mid * BlockSize);
+				lo = mid;
+			}
+			else
+			{
+				hi = mid - 1U;
+			}
+		}
+		return lo * BlockSize;
+	}
+
+	template <typename Backend>
+	void replay(const std::vector<Op>& ops, uint32_t idCount)
+	{
+		using clock_t = std::chrono::steady_clock;
+
+		Backend b;
+		std::vector<std::pair<uint32_t, uint32_t>> addrs(idCount, { ~0U, 0U }); // id -> addr, size
+
+		uint64_t allocCount = 0ULL, freeCount = 0ULL, failedCount = 0ULL;
+		clock_t::duration allocTime = {}, freeTime = {};
+		double fragmentationSum = 0.0;
+		double fragmentationMax = 0.0;
+		uint32_t samples = 0U;
+
+		const size_t sampleEvery = std::max<size_t>(ops.size() / SampleCount, 1ULL);
+		for (size_t i = 0ULL; i < ops.size(); ++i)
+		{
+			const Op& op = ops[i];
+			if (op.alloc)
+			{
+				const auto t0 = clock_t::now();
+				const uint32_t addr = b.alloc(op.size, std::min<uint32_t>(op.alignment, MaxAlignment));
+				allocTime += clock_t::now() - t0;
+				++allocCount;
+
+				if (Backend::isValid(addr))
+					addrs[op.id] = { addr, op.size };
+				else
+					++failedCount;
+			}
+			else if (addrs[op.id].first != ~0U)
+			{
+				const auto t0 = clock_t::now();
+				b.free(addrs[op.id].first, addrs[op.id].second);
+				freeTime += clock_t::now() - t0;
+				++freeCount;
+
+				addrs[op.id].first = ~0U;
+			}
+
+			if ((i + 1ULL) % sampleEvery == 0ULL && b.getFreeSize())
+			{
+				const double fragmentation = 1.0 - (double)probeLargestAlloc(b) / (double)b.getFreeSize();
+				fragmentationSum += fragmentation;
+				fragmentationMax = std::max(fragmentationMax, fragmentation);
+				++samples;
+			}
+		}
+
+		const auto ns = [](clock_t::duration d, uint64_t n) { return n ? (double)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / (double)n : 0.0; };
+		printf("%-16s alloc %8.1f ns  free %8.1f ns  failed allocs %6llu / %llu  fragmentation avg %.3f max %.3f\n",
+			Backend::Name, ns(allocTime, allocCount), ns(freeTime, freeCount),
+			(unsigned long long)failedCount, (unsigned long long)allocCount,
+			samples ? fragmentationSum / samples : 0.0, fragmentationMax);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<Op> ops;
+	if (argc > 1)
+	{
+		if (!loadTrace(argv[1], ops))
+		{
+			printf("Failed to open trace %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		ops = generateTrace(SyntheticOpCount);
+	}
+
+	uint32_t idCount = 0U;
+	for (const Op& op : ops)
+		idCount = std::max(idCount, op.id + 1U);
+
+	printf("%zu ops, %u allocations, pool %u MiB\n", ops.size(), idCount, (uint32_t)PoolSize >> 20);
+	replay<TLSFBackend>(ops, idCount);
+	replay<GPBackend>(ops, idCount);
+
+	return 0;
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include "kris_common.h"
+#include "resource_allocator.h"
+#include "resource_utils.h"
+#include "cmd_recorder.h"
+
+namespace kris
+{
+	// Uploads recorded and submitted on a transfer queue independently of frame submission, so that big uploads don't delay rendering.
+	// Batches are tracked with own timeline semaphore, every submit yields a Ticket which can be polled.
+	// The uploader never waits for GPU: uploads not fitting into the staging ring are carried over into batches started by poll(),
+	// as the ring can't be reclaimed before the frame which batches wait for is submitted.
+	// Before first use on graphics queue, resources of a batch must be acquired (see acquire()): if queue families differ,
+	// it records ownership transfer barriers, it also gives semaphore wait which the frame submission must include.
+	// Resources already used on graphics queue must be released to transfer queue before being uploaded (see releaseToTransfer()),
+	// otherwise their contents the upload doesn't overwrite would be lost. Resources must not be used on graphics queue while being uploaded.
+	class AsyncUploader
+	{
+	public:
+		struct Ticket
+		{
+			uint64_t value = 0ULL;
+
+			bool isValid() const { return value != 0ULL; }
+		};
+
+		AsyncUploader() = default;
+
+		// `transferQueue` may as well be second queue of graphics family or even the graphics queue itself, then no ownership transfers are done.
+		// `frameTimeline` is Renderer's frame semaphore, batches wait on it for the last frame which used resources being overwritten.
+		void init(nbl::video::ILogicalDevice* device, ResourceAllocator* ra, nbl::video::IQueue* transferQueue, uint32_t gfxQueueFamilyIx, nbl::video::ISemaphore* frameTimeline,
+			JobSystem* jobs = nullptr)
+		{
+			m_device = device;
+			m_ra = ra;
+			m_queue = transferQueue;
+			m_gfxQueueFamilyIx = gfxQueueFamilyIx;
+			m_frameTimeline = frameTimeline;
+
+			m_timeline = device->createSemaphore(0ULL);
+			m_cmdPool = device->createCommandPool(transferQueue->getFamilyIndex(),
+				nbl::core::bitflag<nbl::video::IGPUCommandPool::CREATE_FLAGS>(nbl::video::IGPUCommandPool::CREATE_FLAGS::TRANSIENT_BIT));
+			m_utils = std::make_unique<ResourceUtils>(device, ra, m_timeline.get(), jobs);
+			m_utils->setBackPressure(ResourceUtils::EBackPressure::Defer);
+		}
+
+		bool needsOwnershipTransfer() const { return m_queue->getFamilyIndex() != m_gfxQueueFamilyIx; }
+
+		// Records release of `res` ownership to transfer queue into `cmdrec` (graphics queue, outside of render pass), the batch
+		// `res` is uploaded in next acquires it. Needed (if queue families differ) for every resource already used on graphics queue
+		// (ResourceAllocator::getLastUsedFrame() != 0). The batch waits for the frame `cmdrec` belongs to, so it can't be acquired in that frame.
+		void releaseToTransfer(CommandRecorder& cmdrec, Resource* res)
+		{
+			if (!needsOwnershipTransfer())
+				return;
+
+			if (res->isBuffer())
+				cmdrec.releaseOwnership(static_cast<BufferResource*>(res), m_queue->getFamilyIndex());
+			else
+				cmdrec.releaseOwnership(static_cast<ImageResource*>(res), m_queue->getFamilyIndex());
+			m_releasedResources.emplace_back(res);
+			res->asyncUploadPins++;
+		}
+
+		// Same semantics as ResourceUtils upload functions, except the data is on GPU only once the batch's ticket completes.
+		// `frameVal` is current value of Renderer's frame timeline.
+		void uploadBufferData(uint64_t frameVal, BufferResource* bufferResource, size_t offset, size_t size, const void* data)
+		{
+			beginBatchIfNeeded(frameVal);
+			addBatchResource(bufferResource);
+			m_utils->uploadBufferData(bufferResource, offset, size, data);
+		}
+		void uploadImageData(uint64_t frameVal, ImageResource* imageResource, nbl::asset::ICPUImage* srcimg)
+		{
+			beginBatchIfNeeded(frameVal);
+			addBatchResource(imageResource);
+			m_utils->uploadImageData(imageResource, srcimg);
+		}
+		void uploadImageData(uint64_t frameVal, ImageResource* imageResource, nbl::asset::E_FORMAT format,
+			uint32_t regionCount, const nbl::asset::IImage::SBufferCopy* regions, const void* data, refctd<nbl::core::IReferenceCounted>&& srcOwner)
+		{
+			beginBatchIfNeeded(frameVal);
+			addBatchResource(imageResource);
+			m_utils->uploadImageData(imageResource, format, regionCount, regions, data, std::move(srcOwner));
+		}
+
+		// Submits everything uploaded since the last submit. Uploads not fitting into the staging ring are carried over
+		// and completed by batches poll() starts, the ticket isn't submitted till then (see isSubmitted()).
+		Ticket submit()
+		{
+			if (!m_recording)
+				return { m_ticketCount };
+
+			const Ticket ticket = { ++m_ticketCount };
+			submitBatch(m_utils->getDeferredUploadCount() == 0U ? ticket.value : 0ULL);
+
+			return ticket;
+		}
+
+		// All of the ticket's uploads are recorded and submitted, it can be acquired
+		bool isSubmitted(Ticket ticket) const
+		{
+			return ticket.value <= m_submittedTicket;
+		}
+		bool isComplete(Ticket ticket) const
+		{
+			if (ticket.value <= m_retiredTicket)
+				return true;
+			const size_t ix = findBatch(ticket);
+			return ix < m_batches.size() && m_timeline->getCounterValue() >= m_batches[ix].value;
+		}
+
+		// Records acquire half of ownership transfers of ticket's resources into `cmdrec` (graphics queue, outside of render pass)
+		// and returns wait which frame submission must include (see Renderer::addFrameWait()). Ticket must be submitted.
+		nbl::video::IQueue::SSubmitInfo::SSemaphoreInfo acquire(CommandRecorder& cmdrec, Ticket ticket)
+		{
+			KRIS_ASSERT(ticket.isValid());
+			KRIS_ASSERT_MSG(isSubmitted(ticket), "Ticket's uploads are still carried over, see isSubmitted()!");
+
+			// batch is gone only if it's done and acquired already
+			const size_t ix = findBatch(ticket);
+			if (ix == m_batches.size())
+			{
+				return {
+					.semaphore = m_timeline.get(),
+					.value = m_retiredValue,
+					.stageMask = nbl::asset::PIPELINE_STAGE_FLAGS::ALL_COMMANDS_BITS
+				};
+			}
+
+			Batch& batch = m_batches[ix];
+			KRIS_ASSERT_MSG(batch.waitFrameVal < cmdrec.frameVal, "Batch waits for the frame which is supposed to acquire it!");
+			if (!batch.acquired)
+			{
+				const uint32_t srcQueueFamilyIx = m_queue->getFamilyIndex();
+				for (auto& res : batch.resources)
+				{
+					if (needsOwnershipTransfer())
+					{
+						if (res->isBuffer())
+							cmdrec.acquireOwnership(static_cast<BufferResource*>(res.get()), srcQueueFamilyIx);
+						else
+							cmdrec.acquireOwnership(static_cast<ImageResource*>(res.get()), srcQueueFamilyIx);
+					}
+					res->asyncUploadPins--;
+				}
+				cmdrec.flushBarriers();
+				batch.acquired = true;
+			}
+
+			return {
+				.semaphore = m_timeline.get(),
+				.value = batch.value,
+				.stageMask = nbl::asset::PIPELINE_STAGE_FLAGS::ALL_COMMANDS_BITS
+			};
+		}
+
+		// Releases command buffers and resource references of completed and acquired batches, call once per frame.
+		// Carried over uploads are continued once the last batch is done, the whole staging ring is free by then.
+		// `frameVal` is current value of Renderer's frame timeline.
+		void poll(uint64_t frameVal)
+		{
+			const uint64_t completed = m_timeline->getCounterValue();
+			while (!m_batches.empty() && m_batches.front().value <= completed && m_batches.front().acquired)
+			{
+				m_retiredTicket = std::max(m_retiredTicket, m_batches.front().ticket);
+				m_retiredValue = m_batches.front().value;
+				m_batches.pop_front();
+			}
+
+			if (!m_recording && m_utils->getDeferredUploadCount() != 0U && m_timelineVal <= completed)
+			{
+				beginBatch(frameVal);
+				submitBatch(m_utils->getDeferredUploadCount() == 0U ? m_ticketCount : 0ULL);
+			}
+		}
+
+	private:
+		struct Batch
+		{
+			uint64_t value;
+			uint64_t ticket; // last one whose uploads are all done by this batch, 0 if some are carried over
+			refctd<nbl::video::IGPUCommandBuffer> cmdbuf;
+			// kept alive until batch is done, since they're written by other timeline than the frame one
+			nbl::core::vector<refctd<Resource>> resources;
+			uint64_t waitFrameVal = 0ULL;
+			bool acquired = false;
+		};
+
+		// Index of the batch completing ticket's uploads, m_batches.size() if it's not submitted or already retired
+		size_t findBatch(Ticket ticket) const
+		{
+			size_t ix = 0ULL;
+			while (ix < m_batches.size() && m_batches[ix].ticket < ticket.value)
+				ix++;
+			return ix;
+		}
+
+		// Resources and frame wait of carried over uploads stay with the batches completing them
+		void beginBatchIfNeeded(uint64_t frameVal)
+		{
+			if (!m_recording)
+			{
+				if (m_utils->getDeferredUploadCount() == 0U)
+				{
+					m_batchResources.clear();
+					m_batchWaitFrameVal = 0ULL;
+				}
+				beginBatch(frameVal);
+			}
+		}
+		void beginBatch(uint64_t frameVal)
+		{
+			refctd<nbl::video::IGPUCommandBuffer> cmdbuf;
+			m_cmdPool->createCommandBuffers(nbl::video::IGPUCommandPool::BUFFER_LEVEL::PRIMARY, 1U, &cmdbuf);
+			cmdbuf->begin(nbl::video::IGPUCommandBuffer::USAGE::ONE_TIME_SUBMIT_BIT);
+
+			CommandRecorder cmdrec(0U, frameVal, EPass::NumPasses, std::move(cmdbuf));
+			cmdrec.ra = m_ra;
+			m_utils->beginTransferPass(std::move(cmdrec), m_timelineVal + 1ULL);
+
+			m_recording = true;
+		}
+
+		// Resources released by graphics queue are acquired before anything is copied into them
+		void addBatchResource(Resource* res)
+		{
+			for (auto& r : m_batchResources)
+			{
+				if (r.get() == res)
+					return;
+			}
+
+			// resource might be still accessed by frames in flight (or released by the current one),
+			// taken before the batch's own commands mark it used
+			m_batchWaitFrameVal = std::max(m_batchWaitFrameVal, m_ra->getLastUsedFrame(res->getHandle()));
+
+			if (needsOwnershipTransfer())
+			{
+				auto released = std::find_if(m_releasedResources.begin(), m_releasedResources.end(), [res](const refctd<Resource>& r) { return r.get() == res; });
+				if (released != m_releasedResources.end())
+				{
+					CommandRecorder& cmdrec = m_utils->getRecorder();
+					if (res->isBuffer())
+						cmdrec.acquireOwnership(static_cast<BufferResource*>(res), m_gfxQueueFamilyIx);
+					else
+						cmdrec.acquireOwnership(static_cast<ImageResource*>(res), m_gfxQueueFamilyIx);
+					// must not share barrier command with the copy's barrier
+					cmdrec.flushBarriers();
+
+					m_releasedResources.erase(released);
+				}
+				else
+				{
+					KRIS_ASSERT_MSG(m_ra->getLastUsedFrame(res->getHandle()) == 0ULL, "Resource used on graphics queue must be released to transfer queue first, see releaseToTransfer()!");
+					res->asyncUploadPins++;
+				}
+			}
+			else
+			{
+				res->asyncUploadPins++;
+			}
+
+			m_batchResources.emplace_back(res);
+		}
+
+		// Ownership is released only by the batch completing tickets, once all their uploads are recorded.
+		// `ticket` is the last one completed, 0 if uploads are carried over.
+		void submitBatch(uint64_t ticket)
+		{
+			const bool last = (ticket != 0ULL);
+			CommandRecorder& cmdrec = m_utils->getResult();
+
+			const uint64_t waitFrameVal = m_batchWaitFrameVal;
+			for (auto& res : m_batchResources)
+			{
+				if (last && needsOwnershipTransfer())
+				{
+					if (res->isBuffer())
+						cmdrec.releaseOwnership(static_cast<BufferResource*>(res.get()), m_gfxQueueFamilyIx);
+					else
+						cmdrec.releaseOwnership(static_cast<ImageResource*>(res.get()), m_gfxQueueFamilyIx);
+				}
+			}
+			cmdrec.flushBarriers();
+
+			CommandRecorder::Result result;
+			cmdrec.endAndObtainResult(result);
+
+			Batch& batch = m_batches.emplace_back();
+			batch.value = ++m_timelineVal;
+			batch.ticket = ticket;
+			batch.cmdbuf = std::move(result.cmdbuf);
+			batch.waitFrameVal = waitFrameVal;
+			if (last)
+				batch.resources = std::move(m_batchResources);
+			else
+				batch.resources = m_batchResources;
+			// intermediate batches are never acquired
+			batch.acquired = !last;
+
+			const nbl::video::IQueue::SSubmitInfo::SCommandBufferInfo cmdbufs[1] = { { .cmdbuf = batch.cmdbuf.get() } };
+			const nbl::video::IQueue::SSubmitInfo::SSemaphoreInfo waits[1] = { {
+				.semaphore = m_frameTimeline,
+				.value = waitFrameVal,
+				.stageMask = nbl::asset::PIPELINE_STAGE_FLAGS::ALL_COMMANDS_BITS
+			} };
+			const nbl::video::IQueue::SSubmitInfo::SSemaphoreInfo signals[1] = { {
+				.semaphore = m_timeline.get(),
+				.value = batch.value,
+				.stageMask = nbl::asset::PIPELINE_STAGE_FLAGS::ALL_COMMANDS_BITS
+			} };
+
+			nbl::video::IQueue::SSubmitInfo submitInfos[1] = {};
+			submitInfos[0].commandBuffers = cmdbufs;
+			if (waitFrameVal != 0ULL)
+				submitInfos[0].waitSemaphores = waits;
+			submitInfos[0].signalSemaphores = signals;
+			m_queue->submit(submitInfos);
+
+			m_recording = false;
+			if (last)
+				m_submittedTicket = ticket;
+		}
+
+		nbl::video::ILogicalDevice* m_device = nullptr;
+		ResourceAllocator* m_ra = nullptr;
+		nbl::video::IQueue* m_queue = nullptr;
+		uint32_t m_gfxQueueFamilyIx = 0U;
+		nbl::video::ISemaphore* m_frameTimeline = nullptr;
+
+		refctd<nbl::video::ISemaphore> m_timeline;
+		uint64_t m_timelineVal = 0ULL;
+		refctd<nbl::video::IGPUCommandPool> m_cmdPool;
+		std::unique_ptr<ResourceUtils> m_utils;
+
+		bool m_recording = false;
+		uint64_t m_ticketCount = 0ULL;
+		uint64_t m_submittedTicket = 0ULL;
+		// of batches already done and acquired
+		uint64_t m_retiredTicket = 0ULL;
+		uint64_t m_retiredValue = 0ULL;
+		nbl::core::vector<refctd<Resource>> m_batchResources;
+		uint64_t m_batchWaitFrameVal = 0ULL;
+		nbl::core::deque<Batch> m_batches;
+		// released by graphics queue, not yet acquired by transfer one
+		nbl::core::vector<refctd<Resource>> m_releasedResources;
+	};
+}
@@ -6,17 +6,12 @@ namespace kris
 {
 	void CommandRecorder::setupDrawSceneNode(nbl::video::ILogicalDevice* device, SceneNode* node)
 	{
+		// host writes are made visible by queue submission, no barrier needed
 		{
-			BufferResource* uboResource = static_cast<BufferResource*>(node->m_ds.m_resources[0].get());
-			auto* ubo = uboResource->getBuffer();
-
-			nbl::asset::SBufferRange<nbl::video::IGPUBuffer> rng;
-			rng.buffer = refctd<nbl::video::IGPUBuffer>(ubo);
-			rng.offset = 0;
-			rng.size = rng.buffer->getSize();
-			cmdbuf->updateBuffer(rng, &node->m_data);
-
-			pushBarrier(uboResource, nbl::asset::ACCESS_FLAGS::UNIFORM_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::VERTEX_SHADER_BIT);
+			KRIS_ASSERT(frameAlctr);
+			FrameAllocator::Allocation ubo = frameAlctr->push(node->m_data);
+			KRIS_ASSERT(ubo.isValid());
+			node->m_uboOffset = ubo.offset;
 		}
 
 		setupDrawMesh(device, node->m_mesh.get());
@@ -27,17 +22,27 @@ namespace kris
 
 	void CommandRecorder::drawSceneNode(nbl::video::ILogicalDevice* device, EPass pass, SceneNode* node)
 	{
-		auto* mesh = node->m_mesh.get();
-		// bind node ds
-
-		bindDescriptorSet(nbl::asset::EPBP_GRAPHICS, mesh->getPipeline(pass)->getLayout(), SceneNodeDescSetIndex, SceneNode::DescSetBndMask, &node->m_ds);
-
-		drawMesh(device, pass, mesh);
+		drawSceneNodes(device, pass, &node, 1U);
 
 		for (auto& child : node->m_children)
 			drawSceneNode(device, pass, child.get());
 	}
 
+	void CommandRecorder::drawSceneNodes(nbl::video::ILogicalDevice* device, EPass pass, SceneNode* const* nodes, uint32_t count)
+	{
+		for (uint32_t i = 0U; i < count; ++i)
+		{
+			SceneNode* const node = nodes[i];
+			auto* mesh = node->m_mesh.get();
+			// bind node ds
+			Renderer* rend = mesh->m_mtl->m_creatorRenderer;
+			bindDescriptorSet(nbl::asset::EPBP_GRAPHICS, mesh->m_setupPso[pass]->getLayout(), SceneNodeDescSetIndex, SceneNode::DescSetBndMask,
+				rend->getSceneNodeDescriptorSet(), 1U, &node->m_uboOffset);
+
+			drawMesh(device, pass, mesh);
+		}
+	}
+
 	void CommandRecorder::setupDrawMesh(nbl::video::ILogicalDevice* device, Mesh* mesh)
 	{
 		KRIS_ASSERT((mesh->getPassMask() & (1U << pass)) != 0U);
@@ -55,30 +60,37 @@ namespace kris
 		mesh->updateResourceMap(&rend->resourceMap);
 
 		setupMaterial(device, mesh->m_mtl.get());
+		// pipeline cache of the material isn't touched by draws, so that they can be recorded by secondaries
+		mesh->m_setupPso[pass] = refctd<nbl::video::IGPUGraphicsPipeline>(mesh->getPipeline(pass));
 
-		emitBarrierCmd();
+		emitSetupBarrierCmd();
 	}
 
 	void CommandRecorder::drawMesh(nbl::video::ILogicalDevice* device, EPass pass, Mesh* mesh)
 	{
 		KRIS_ASSERT((mesh->getPassMask() & (1U << pass)) != 0U);
+		KRIS_ASSERT(mesh->m_setupPso[pass]);
 
 		{
 			auto* vtxbuf = mesh->m_vtxBuf.get();
+			markUsed(vtxbuf);
 			nbl::asset::SBufferBinding<const nbl::video::IGPUBuffer> bnd;
 			bnd.buffer = kris::refctd<const nbl::video::IGPUBuffer>(vtxbuf->getBuffer());
-			bnd.offset = 0;
+			bnd.offset = vtxbuf->getOffset();
 			cmdbuf->bindVertexBuffers(0U, 1U, &bnd);
 		}
 		{
 			auto* idxbuf = mesh->m_idxBuf.get();
+			markUsed(idxbuf);
 			nbl::asset::SBufferBinding<const nbl::video::IGPUBuffer> bnd;
 			bnd.buffer = kris::refctd<const nbl::video::IGPUBuffer>(idxbuf->getBuffer());
-			bnd.offset = 0;
+			bnd.offset = idxbuf->getOffset();
 			cmdbuf->bindIndexBuffer(bnd, mesh->m_idxtype);
 		}
 
-		setGfxMaterial(device, pass, mesh->m_vtxinput, mesh->m_mtl.get());
+		nbl::video::IGPUGraphicsPipeline* const pso = mesh->m_setupPso[pass].get();
+		cmdbuf->bindGraphicsPipeline(pso);
+		setMaterialCommon(device, pso->getLayout(), mesh->m_mtl.get());
 
 		cmdbuf->drawIndexed(mesh->m_idxCount, 1, 0, 0, 0);
 	}
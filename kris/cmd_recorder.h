@@ -5,59 +5,52 @@
 #include "material.h"
 #include "mesh.h"
 #include "scene.h"
+#include "frame_allocator.h"
+#include "mip_generator.h"
 #include "passes/pass_common.h"
 
 namespace kris
 {
 	class DescriptorSet;
 
-	class DeferredAllocDeletion final
-	{
-		using resouce_ptr = refctd<Resource>;
-		nbl::core::vector<resouce_ptr> m_resources;
-
-	public:
-		DeferredAllocDeletion() = default;
-
-		DeferredAllocDeletion(const DeferredAllocDeletion&) = delete;
-		inline DeferredAllocDeletion(DeferredAllocDeletion&& other)
-		{
-			this->operator=(std::move(other));
-		}
-
-		DeferredAllocDeletion& operator=(const DeferredAllocDeletion&) = delete;
-		inline DeferredAllocDeletion& operator=(DeferredAllocDeletion&& other)
-		{
-			m_resources = std::move(other.m_resources);
-			return *this;
-		}
-
-		void addResource(resouce_ptr&& resource)
-		{
-			m_resources.emplace_back(std::move(resource));
-		}
-
-		inline void operator()()
-		{
-			m_resources.clear();
-		}
-	};
-
+	// Resource lifetimes are not tracked with references, every resource used in recorded commands is
+	// marked with frame's timeline value in ResourceAllocator's handle table instead (see ResourceAllocator::markUsed()).
 	struct CommandRecorder
 	{
 		struct Result
 		{
 			refctd<nbl::video::IGPUCommandBuffer> cmdbuf;
-			DeferredAllocDeletion resources;
+			nbl::core::vector<refctd<nbl::video::IGPUCommandBuffer>> secondaries; // executed by cmdbuf
 		};
 
 		uint32_t frameIx = 0U;
+		uint64_t frameVal = 0ULL; // value Renderer's frame timeline semaphore is signalled with once this frame is done
 		EPass pass = EPass::NumPasses;
 		refctd<nbl::video::IGPUCommandBuffer> cmdbuf;
+		FrameAllocator* frameAlctr = nullptr; // set by Renderer
+		ResourceAllocator* ra = nullptr; // set by Renderer
+		// Non-zero while recording RenderGraph pass: barriers of resources declared by the pass are emitted by the graph
+		// at the beginning of the pass, barriers pushed for them afterwards are skipped as long as the declaration covers them
+		uint64_t graphScope = 0ULL;
+		// Secondary recorder (see Renderer::recordSecondaries()) records draws of a slice of the pass's render pass, possibly on
+		// another thread. It never touches shared state: resources used are collected locally and merged into the primary
+		// recorder in slice order (see mergeSecondaries()), draws must be set up (setupDraw*()) by the primary beforehand.
+		bool secondary = false;
+
+		struct BarrierStats
+		{
+			uint32_t commands = 0U; // pipeline barrier commands recorded
+			uint32_t entries = 0U; // buffer and image barriers in them
+			// what recording each draw's barriers right away, without RenderGraph, would have added
+			uint32_t coveredByGraph = 0U; // barriers skipped since pass declaration synced the resource already
+			uint32_t gatheredCommands = 0U; // commands of draw setups folded into one by setup mode (see beginSetup())
+		};
+		BarrierStats barrierStats;
 
 		CommandRecorder() = default; // creating cmdrec in invalid state
-		explicit CommandRecorder(uint32_t _frameix, EPass _pass, refctd<nbl::video::IGPUCommandBuffer>&& cb) :
+		explicit CommandRecorder(uint32_t _frameix, uint64_t _frameval, EPass _pass, refctd<nbl::video::IGPUCommandBuffer>&& cb) :
 			frameIx(_frameix),
+			frameVal(_frameval),
 			pass(_pass),
 			cmdbuf(std::move(cb))
 		{
@@ -65,17 +58,69 @@ namespace kris
 			KRIS_ASSERT(cmdbuf->getState() == nbl::video::IGPUCommandBuffer::STATE::RECORDING);
 		}
 
-		void endAndObtainResources(Result& out_Result)
+		void endAndObtainResult(Result& out_Result)
 		{
+			KRIS_ASSERT(!secondary);
 			cmdbuf->end();
 			out_Result.cmdbuf = std::move(cmdbuf);
-			out_Result.resources = std::move(m_resources);
+			out_Result.secondaries = std::move(m_secondaryCmdbufs);
+		}
+
+		// Memory of the resource won't be freed before GPU is done with this frame, even if the resource dies earlier
+		void markUsed(Resource* resource)
+		{
+			markUsed(resource->getHandle());
+		}
+		void markUsed(ResourceHandle handle)
+		{
+			if (secondary)
+			{
+				m_usedHandles.push_back(handle);
+				return;
+			}
+			KRIS_ASSERT(ra);
+			ra->markUsed(handle, frameVal);
 		}
 
+		// Ends secondaries recorded for this pass and merges their resource usage in the order given, which is what makes
+		// the result independent of which thread finished first. Must be called before beginRenderPass() of the render pass
+		// they continue, their commands are recorded into it by executeSecondaries().
+		void mergeSecondaries(uint32_t count, CommandRecorder* const secondaries)
+		{
+			KRIS_ASSERT(!secondary);
+
+			for (uint32_t i = 0U; i < count; ++i)
+			{
+				CommandRecorder& sec = secondaries[i];
+				KRIS_ASSERT(sec.secondary && sec.frameVal == frameVal && sec.pass == pass);
+
+				for (const ResourceHandle h : sec.m_usedHandles)
+					markUsed(h);
+				sec.m_usedHandles.clear();
+
+				sec.cmdbuf->end();
+				m_secondaryCmdbufs.push_back(std::move(sec.cmdbuf));
+			}
+		}
+		// Within render pass begun with SECONDARY_COMMAND_BUFFERS contents
+		void executeSecondaries()
+		{
+			KRIS_ASSERT(m_executedSecondaries <= m_secondaryCmdbufs.size());
+
+			nbl::core::vector<nbl::video::IGPUCommandBuffer*> cmdbufs;
+			for (uint32_t i = m_executedSecondaries; i < m_secondaryCmdbufs.size(); ++i)
+				cmdbufs.push_back(m_secondaryCmdbufs[i].get());
+			m_executedSecondaries = (uint32_t)m_secondaryCmdbufs.size();
+
+			if (!cmdbufs.empty())
+				cmdbuf->executeCommands((uint32_t)cmdbufs.size(), cmdbufs.data());
+		}
+
+		// Note: region offsets are relative to underlying IGPUBuffers, not to BufferResources (see BufferResource::getOffset())
 		void copyBuffer(BufferResource* const srcBuffer, BufferResource* const dstBuffer, uint32_t regionCount, const nbl::video::IGPUCommandBuffer::SBufferCopy* const pRegions)
 		{
-			m_resources.addResource(refctd<Resource>(srcBuffer));
-			m_resources.addResource(refctd<Resource>(dstBuffer));
+			markUsed(srcBuffer);
+			markUsed(dstBuffer);
 
 			pushBarrier(srcBuffer, nbl::asset::ACCESS_FLAGS::TRANSFER_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT);
 			pushBarrier(dstBuffer, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT);
@@ -87,17 +132,285 @@ namespace kris
 
 		void copyBufferToImage(BufferResource* const srcBuffer, ImageResource* const dstImage, const uint32_t regionCount, const nbl::video::IGPUImage::SBufferCopy* const pRegions)
 		{
-			m_resources.addResource(refctd<Resource>(srcBuffer));
-			m_resources.addResource(refctd<Resource>(dstImage));
+			markUsed(srcBuffer);
+			markUsed(dstImage);
+
+			SubresourceBounds dstBounds;
+			for (uint32_t i = 0U; i < regionCount; ++i)
+				dstBounds.add(pRegions[i].imageSubresource);
 
 			pushBarrier(srcBuffer, nbl::asset::ACCESS_FLAGS::TRANSFER_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT);
-			pushBarrier(dstImage, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT, nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL);
+			pushBarrier(dstImage, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT, nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL, dstBounds);
 
 			emitBarrierCmd();
 
 			cmdbuf->copyBufferToImage(srcBuffer->getBuffer(), dstImage->getImage(), nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL, regionCount, pRegions);
 		}
 
+		void copyImage(ImageResource* const srcImage, ImageResource* const dstImage, const uint32_t regionCount, const nbl::video::IGPUImage::SImageCopy* const pRegions)
+		{
+			markUsed(srcImage);
+			markUsed(dstImage);
+
+			SubresourceBounds srcBounds, dstBounds;
+			for (uint32_t i = 0U; i < regionCount; ++i)
+			{
+				srcBounds.add(pRegions[i].srcSubresource);
+				dstBounds.add(pRegions[i].dstSubresource);
+			}
+
+			pushBarrier(srcImage, nbl::asset::ACCESS_FLAGS::TRANSFER_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT, nbl::video::IGPUImage::LAYOUT::TRANSFER_SRC_OPTIMAL, srcBounds);
+			pushBarrier(dstImage, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT, nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL, dstBounds);
+
+			emitBarrierCmd();
+
+			cmdbuf->copyImage(srcImage->getImage(), nbl::video::IGPUImage::LAYOUT::TRANSFER_SRC_OPTIMAL, dstImage->getImage(), nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL, regionCount, pRegions);
+		}
+
+		void copyImageToBuffer(ImageResource* const srcImage, BufferResource* const dstBuffer, const uint32_t regionCount, const nbl::video::IGPUImage::SBufferCopy* const pRegions)
+		{
+			markUsed(srcImage);
+			markUsed(dstBuffer);
+
+			SubresourceBounds srcBounds;
+			for (uint32_t i = 0U; i < regionCount; ++i)
+				srcBounds.add(pRegions[i].imageSubresource);
+
+			pushBarrier(srcImage, nbl::asset::ACCESS_FLAGS::TRANSFER_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT, nbl::video::IGPUImage::LAYOUT::TRANSFER_SRC_OPTIMAL, srcBounds);
+			pushBarrier(dstBuffer, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT);
+
+			emitBarrierCmd();
+
+			cmdbuf->copyImageToBuffer(srcImage->getImage(), nbl::video::IGPUImage::LAYOUT::TRANSFER_SRC_OPTIMAL, dstBuffer->getBuffer(), regionCount, pRegions);
+		}
+
+		void fillBuffer(BufferResource* const buffer, size_t offset, size_t size, uint32_t value)
+		{
+			markUsed(buffer);
+
+			pushBarrier(buffer, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::CLEAR_BIT);
+
+			emitBarrierCmd();
+
+			cmdbuf->fillBuffer({ .offset = buffer->getOffset() + offset, .size = size, .buffer = refctd<nbl::video::IGPUBuffer>(buffer->getBuffer()) }, value);
+		}
+
+		// Writes mips 1.. of the image from its mip 0 (see MipGenerator), outside of render pass.
+		// Image is left in GENERAL layout, its next usage transitions it as needed.
+		bool generateMips(MipGenerator* const mipgen, ImageResource* const image)
+		{
+			if (!MipGenerator::isSupported(image))
+				return false;
+
+			BufferResource* const counters = mipgen->getCounterBuffer();
+			if (mipgen->needsCounterClear())
+			{
+				fillBuffer(counters, 0ULL, counters->getSize(), 0U);
+				mipgen->onCountersCleared();
+			}
+
+			markUsed(image);
+			markUsed(counters);
+
+			pushBarrier(image,
+				nbl::core::bitflag(nbl::asset::ACCESS_FLAGS::SAMPLED_READ_BIT) | nbl::asset::ACCESS_FLAGS::STORAGE_READ_BIT | nbl::asset::ACCESS_FLAGS::STORAGE_WRITE_BIT,
+				nbl::asset::PIPELINE_STAGE_FLAGS::COMPUTE_SHADER_BIT,
+				nbl::video::IGPUImage::LAYOUT::GENERAL);
+			pushBarrier(counters,
+				nbl::core::bitflag(nbl::asset::ACCESS_FLAGS::STORAGE_READ_BIT) | nbl::asset::ACCESS_FLAGS::STORAGE_WRITE_BIT,
+				nbl::asset::PIPELINE_STAGE_FLAGS::COMPUTE_SHADER_BIT);
+
+			emitBarrierCmd();
+
+			return mipgen->record(cmdbuf.get(), image, frameVal);
+		}
+
+		// Layout change alone (e.g. for presentation), barrier is batched with the following ones
+		void transitionLayout(ImageResource* const image, nbl::video::IGPUImage::LAYOUT layout)
+		{
+			markUsed(image);
+			pushBarrier(image, nbl::asset::ACCESS_FLAGS::NONE, nbl::asset::PIPELINE_STAGE_FLAGS::NONE, layout);
+		}
+
+		// Device writes to the buffer are made available to host reads once the submission is done (e.g. readbacks)
+		void makeHostReadable(BufferResource* const buffer)
+		{
+			pushBarrier(buffer, nbl::asset::ACCESS_FLAGS::HOST_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::HOST_BIT);
+			emitBarrierCmd();
+		}
+
+		struct BufferCopies
+		{
+			BufferResource* dst;
+			uint32_t regionCount;
+			const nbl::video::IGPUCommandBuffer::SBufferCopy* regions;
+		};
+		struct BufferToImageCopies
+		{
+			ImageResource* dst;
+			uint32_t regionCount;
+			const nbl::video::IGPUImage::SBufferCopy* regions;
+		};
+
+		// Copies from one source buffer into many destinations, barriers of all the destinations are emitted together
+		// instead of one barrier command per copy. Destinations must be distinct and their regions must not overlap.
+		// Barriers cover just the ranges and subresources written (see pushBarrier()).
+		void copyBatched(BufferResource* const srcBuffer,
+			uint32_t bufCount, const BufferCopies* const bufCopies,
+			uint32_t imgCount, const BufferToImageCopies* const imgCopies)
+		{
+			markUsed(srcBuffer);
+			pushBarrier(srcBuffer, nbl::asset::ACCESS_FLAGS::TRANSFER_READ_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT);
+
+			for (uint32_t i = 0U; i < bufCount; ++i)
+			{
+				const BufferCopies& c = bufCopies[i];
+
+				size_t begin = ~0ULL;
+				size_t end = 0ULL;
+				for (uint32_t r = 0U; r < c.regionCount; ++r)
+				{
+					begin = std::min<size_t>(begin, c.regions[r].dstOffset);
+					end = std::max<size_t>(end, c.regions[r].dstOffset + c.regions[r].size);
+				}
+
+				markUsed(c.dst);
+				pushBarrier(c.dst, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT,
+					begin - c.dst->getOffset(), end - begin);
+			}
+			for (uint32_t i = 0U; i < imgCount; ++i)
+			{
+				const BufferToImageCopies& c = imgCopies[i];
+
+				SubresourceBounds bounds;
+				for (uint32_t r = 0U; r < c.regionCount; ++r)
+					bounds.add(c.regions[r].imageSubresource);
+
+				markUsed(c.dst);
+				pushBarrier(c.dst, nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT, nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL, bounds);
+			}
+
+			emitBarrierCmd();
+
+			for (uint32_t i = 0U; i < bufCount; ++i)
+			{
+				cmdbuf->copyBuffer(srcBuffer->getBuffer(), bufCopies[i].dst->getBuffer(), bufCopies[i].regionCount, bufCopies[i].regions);
+			}
+			for (uint32_t i = 0U; i < imgCount; ++i)
+			{
+				cmdbuf->copyBufferToImage(srcBuffer->getBuffer(), imgCopies[i].dst->getImage(), nbl::video::IGPUImage::LAYOUT::TRANSFER_DST_OPTIMAL, imgCopies[i].regionCount, imgCopies[i].regions);
+			}
+		}
+
+		// Queue family ownership transfer of resource written on one queue family and used on another one.
+		// Release half is recorded on source queue, acquire half on destination queue, whose submission must wait for the source one.
+		// Image layout is kept as is, so that both halves match without any extra bookkeeping.
+		void releaseOwnership(BufferResource* const buffer, uint32_t dstQueueFamilyIx)
+		{
+			markUsed(buffer);
+
+			emitBarrierCmdIfNeeded(1U, 0U);
+			m_barriers.pushOwnershipBarrier(BufferBarrier{
+				.buffer = buffer,
+				.srcaccess = buffer->lastAccesses,
+				.dstaccess = nbl::asset::ACCESS_FLAGS::NONE,
+				.srcstages = buffer->lastStages,
+				.dststages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE,
+				.ownershipOp = OwnershipOp::RELEASE,
+				.otherQueueFamilyIx = dstQueueFamilyIx
+				});
+		}
+		void releaseOwnership(ImageResource* const image, uint32_t dstQueueFamilyIx)
+		{
+			markUsed(image);
+			makeUniform(image);
+
+			emitBarrierCmdIfNeeded(0U, 1U);
+			m_barriers.pushOwnershipBarrier(ImageBarrier{
+				.image = image,
+				.srcaccess = image->lastAccesses,
+				.dstaccess = nbl::asset::ACCESS_FLAGS::NONE,
+				.srcstages = image->lastStages,
+				.dststages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE,
+				.srclayout = image->layout,
+				.dstlayout = image->layout,
+				.ownershipOp = OwnershipOp::RELEASE,
+				.otherQueueFamilyIx = dstQueueFamilyIx
+				});
+		}
+		// Resource is seen as just written by transfer afterwards, so that its next usage gets proper barrier
+		void acquireOwnership(BufferResource* const buffer, uint32_t srcQueueFamilyIx)
+		{
+			markUsed(buffer);
+
+			emitBarrierCmdIfNeeded(1U, 0U);
+			m_barriers.pushOwnershipBarrier(BufferBarrier{
+				.buffer = buffer,
+				.srcaccess = nbl::asset::ACCESS_FLAGS::NONE,
+				.dstaccess = nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT,
+				.srcstages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE,
+				.dststages = nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT,
+				.ownershipOp = OwnershipOp::ACQUIRE,
+				.otherQueueFamilyIx = srcQueueFamilyIx
+				});
+		}
+		void acquireOwnership(ImageResource* const image, uint32_t srcQueueFamilyIx)
+		{
+			markUsed(image);
+			makeUniform(image);
+
+			emitBarrierCmdIfNeeded(0U, 1U);
+			m_barriers.pushOwnershipBarrier(ImageBarrier{
+				.image = image,
+				.srcaccess = nbl::asset::ACCESS_FLAGS::NONE,
+				.dstaccess = nbl::asset::ACCESS_FLAGS::TRANSFER_WRITE_BIT,
+				.srcstages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE,
+				.dststages = nbl::asset::PIPELINE_STAGE_FLAGS::COPY_BIT,
+				.srclayout = image->layout,
+				.dstlayout = image->layout,
+				.ownershipOp = OwnershipOp::ACQUIRE,
+				.otherQueueFamilyIx = srcQueueFamilyIx
+				});
+		}
+		// Declared access of RenderGraph pass (see graphScope), returns true if barrier was pushed
+		bool declareAccess(BufferResource* const buffer, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages)
+		{
+			KRIS_ASSERT(graphScope != 0ULL);
+
+			markUsed(buffer);
+			const bool pushed = pushBarrier(buffer, access, stages);
+			buffer->graphScope = graphScope;
+			return pushed;
+		}
+		bool declareAccess(ImageResource* const image, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages, nbl::video::IGPUImage::LAYOUT layout)
+		{
+			KRIS_ASSERT(graphScope != 0ULL);
+
+			markUsed(image);
+			const bool pushed = pushBarrier(image, access, stages, layout);
+			image->graphScope = graphScope;
+			return pushed;
+		}
+
+		// Barriers are batched, flushes them (e.g. before ending command buffer)
+		void flushBarriers()
+		{
+			emitBarrierCmd();
+		}
+
+		// Setup of a pass: barriers pushed by setupDrawMesh()/setupDrawSceneNode() are gathered (one per resource,
+		// see m_barriers.pushBarrier()) and emitted in a single command by beginRenderPass() or endSetup().
+		// Commands needing their barriers right away (copies, dispatches) still emit everything gathered so far.
+		void beginSetup()
+		{
+			m_gatherBarriers = true;
+		}
+		void endSetup()
+		{
+			m_gatherBarriers = false;
+			emitBarrierCmd();
+		}
+
 		void dispatch(nbl::video::ILogicalDevice* device, EPass pass,
 			ComputeMaterial* mtl, uint32_t wgcx, uint32_t wgcy, uint32_t wgcz)
 		{
@@ -133,12 +446,16 @@ namespace kris
 
 		void setupDrawSceneNode(nbl::video::ILogicalDevice* device, SceneNode* mesh);
 		void drawSceneNode(nbl::video::ILogicalDevice* device, EPass pass, SceneNode* mesh);
+		// Nodes alone, without their children (e.g. slice of SceneNode::flatten())
+		void drawSceneNodes(nbl::video::ILogicalDevice* device, EPass pass, SceneNode* const* nodes, uint32_t count);
 
 		void setupDrawMesh(nbl::video::ILogicalDevice* device, Mesh* mesh);
 		void drawMesh(nbl::video::ILogicalDevice* device, EPass pass, Mesh* mesh);
 
 		void setupMaterial(nbl::video::ILogicalDevice* device, Material* mtl)
 		{
+			KRIS_ASSERT_MSG(!secondary, "Secondary recorders can't set up draws!");
+
 			Material::ProtoBufferBarrier bbarriers[Material::BufferBindingCount];
 			Material::ProtoImageBarrier ibarriers[Material::TextureBindingCount];
 
@@ -156,10 +473,12 @@ namespace kris
 			}
 		}
 
+		// Contents are SECONDARY_COMMAND_BUFFERS when the render pass is recorded by secondaries (see executeSecondaries())
 		void beginRenderPass(const VkRect2D& area,
 			const nbl::video::IGPUCommandBuffer::SClearColorValue& clearcolor,
 			const nbl::video::IGPUCommandBuffer::SClearDepthStencilValue& cleardepth,
-			const Framebuffer& fb)
+			const Framebuffer& fb,
+			nbl::video::IGPUCommandBuffer::SUBPASS_CONTENTS contents = nbl::video::IGPUCommandBuffer::SUBPASS_CONTENTS::INLINE)
 		{
 			constexpr auto PIPELINE_STAGE_FRAGMENT_TESTS_BITS = 
 				nbl::asset::PIPELINE_STAGE_FLAGS::EARLY_FRAGMENT_TESTS_BIT | 
@@ -175,7 +494,8 @@ namespace kris
 					nbl::asset::ACCESS_FLAGS::COLOR_ATTACHMENT_WRITE_BIT, 
 					nbl::asset::PIPELINE_STAGE_FLAGS::COLOR_ATTACHMENT_OUTPUT_BIT, 
 					desc.initialLayout);
-				m_resources.addResource(refctd(fb.m_colors[i]));
+				markUsed(fb.m_colors[i].get());
+				fb.m_colors[i]->invalidateContents();
 			}
 			if (fb.m_depth)
 			{
@@ -185,10 +505,11 @@ namespace kris
 					nbl::asset::ACCESS_FLAGS::DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | nbl::asset::ACCESS_FLAGS::DEPTH_STENCIL_ATTACHMENT_READ_BIT,
 					PIPELINE_STAGE_FRAGMENT_TESTS_BITS,
 					desc.initialLayout.depth);
-				m_resources.addResource(refctd(fb.m_depth));
+				markUsed(fb.m_depth.get());
+				fb.m_depth->invalidateContents();
 			}
 
-			emitBarrierCmd();
+			endSetup();
 
 			const nbl::video::IGPUCommandBuffer::SRenderpassBeginInfo info =
 			{
@@ -198,7 +519,7 @@ namespace kris
 				.renderArea = area
 			};
 
-			cmdbuf->beginRenderPass(info, nbl::video::IGPUCommandBuffer::SUBPASS_CONTENTS::INLINE);
+			cmdbuf->beginRenderPass(info, contents);
 		}
 
 		void endRenderPass(const Framebuffer& fb, bool toBePresented, uint32_t colorToPresent = 0U)
@@ -211,13 +532,13 @@ namespace kris
 			{
 				auto& desc = renderpass->getCreationParameters().colorAttachments[i];
 
-				fb.m_colors[i]->layout = desc.finalLayout;
+				fb.m_colors[i]->setState({ fb.m_colors[i]->lastAccesses, fb.m_colors[i]->lastStages, desc.finalLayout });
 			}
 			if (fb.m_depth)
 			{
 				auto& desc = renderpass->getCreationParameters().depthStencilAttachments[0];
 
-				fb.m_depth->layout = desc.finalLayout.depth;
+				fb.m_depth->setState({ fb.m_depth->lastAccesses, fb.m_depth->lastStages, desc.finalLayout.depth });
 			}
 
 			if (toBePresented)
@@ -242,19 +563,22 @@ namespace kris
 			const nbl::video::IGPUPipelineLayout* layout,
 			uint32_t dsIx,
 			uint32_t bndmask,
-			const DescriptorSet* ds)
+			const DescriptorSet* ds,
+			uint32_t dynOffsetCount = 0U,
+			const uint32_t* dynOffsets = nullptr)
 		{
-			cmdbuf->bindDescriptorSets(q, layout, dsIx, 1U, &ds->m_ds.get());
+			cmdbuf->bindDescriptorSets(q, layout, dsIx, 1U, &ds->m_ds.get(), dynOffsetCount, dynOffsets);
 
+			KRIS_ASSERT(ra);
 			const auto rsrcRange = ds->getResources();
 
 			for (uint32_t i = 0U; i < (uint32_t) rsrcRange.size(); ++i)
 			{
 				if (bndmask & (1U << i))
 				{
-					auto& res = rsrcRange.begin()[i];
-					KRIS_ASSERT(res);
-					m_resources.addResource(refctd(res));
+					const ResourceHandle h = rsrcRange.begin()[i];
+					KRIS_ASSERT(h.isValid());
+					markUsed(h);
 				}
 			}
 		}
@@ -286,11 +610,13 @@ namespace kris
 							}
 						},
 						.range = {
-							.offset = 0ULL,
-							.size = buffer->getSize(),
+							.offset = buffer->getOffset() + b.offset,
+							.size = b.isPartial() ? b.size : buffer->getSize(),
 							.buffer = refctd<nbl::video::IGPUBuffer>(buffer->getBuffer())
 						}
 				};
+				barrier.barrier.ownershipOp = b.ownershipOp;
+				barrier.barrier.otherQueueFamilyIndex = b.otherQueueFamilyIx;
 			}
 
 			ibarrier_t ibarriers[MaxBarriers];
@@ -300,14 +626,8 @@ namespace kris
 				auto* const image = b.image;
 				auto& dst = ibarriers[i];
 
-				const nbl::asset::E_FORMAT format = image->getImage()->getCreationParameters().format;
-				nbl::core::bitflag<nbl::video::IGPUImage::E_ASPECT_FLAGS> aspect = nbl::video::IGPUImage::EAF_NONE;
-				if (nbl::asset::isDepthOnlyFormat(format))
-					aspect = nbl::video::IGPUImage::EAF_DEPTH_BIT;
-				else if (nbl::asset::isDepthOrStencilFormat(format))
-					aspect = nbl::core::bitflag<nbl::video::IGPUImage::E_ASPECT_FLAGS>(nbl::video::IGPUImage::EAF_DEPTH_BIT) | nbl::video::IGPUImage::EAF_STENCIL_BIT;
-				else
-					aspect = nbl::video::IGPUImage::EAF_COLOR_BIT;
+				const nbl::core::bitflag<nbl::video::IGPUImage::E_ASPECT_FLAGS> aspect = image->getAspectFlags();
+				const auto& params = image->getImage()->getCreationParameters();
 
 				dst = {
 					.barrier = {
@@ -322,16 +642,16 @@ namespace kris
 					.image = image->getImage(),
 					.subresourceRange = {
 						.aspectMask = aspect,
-						// all the mips
-						.baseMipLevel = 0,
-						.levelCount = image->getImage()->getCreationParameters().mipLevels,
-						// all the layers
-						.baseArrayLayer = 0,
-						.layerCount = image->getImage()->getCreationParameters().arrayLayers
+						.baseMipLevel = b.baseMip,
+						.levelCount = b.isPartial() ? b.mipCount : params.mipLevels,
+						.baseArrayLayer = b.baseLayer,
+						.layerCount = b.isPartial() ? b.layerCount : params.arrayLayers
 					},
 					.oldLayout = b.srclayout,
 					.newLayout = b.dstlayout
 				};
+				dst.barrier.ownershipOp = b.ownershipOp;
+				dst.barrier.otherQueueFamilyIndex = b.otherQueueFamilyIx;
 			}
 
 			cmdbuf->pipelineBarrier(nbl::asset::EDF_NONE,
@@ -340,7 +660,27 @@ namespace kris
 					.bufBarriers = {bbarriers, m_barriers.count.buffer},
 					.imgBarriers = {ibarriers, m_barriers.count.image} });
 
+			barrierStats.commands++;
+			barrierStats.entries += m_barriers.count.buffer + m_barriers.count.image;
+
 			m_barriers.reset();
+			m_gatheredBarrierCount = 0U;
+		}
+		// Barriers needed by draws, they can wait for render pass while in setup
+		void emitSetupBarrierCmd()
+		{
+			if (!m_gatherBarriers)
+			{
+				emitBarrierCmd();
+				return;
+			}
+
+			const uint32_t count = m_barriers.count.buffer + m_barriers.count.image;
+			if (count != m_gatheredBarrierCount)
+			{
+				barrierStats.gatheredCommands++;
+				m_gatheredBarrierCount = count;
+			}
 		}
 		void emitBarrierCmdIfNeeded(uint32_t bufToBePushed, uint32_t imgToBePushed)
 		{
@@ -350,8 +690,20 @@ namespace kris
 			}
 		}
 
-		bool pushBarrier(BufferResource* buffer, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages)
+		// Barrier can be limited to a range (0 size means whole buffer), accesses outside of it are then kept
+		// as the buffer's last ones, so that next barrier syncs with them as well
+		bool pushBarrier(BufferResource* buffer, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages,
+			size_t offset = 0ULL, size_t size = 0ULL)
 		{
+			KRIS_ASSERT_MSG(!secondary, "Secondary recorders can't push barriers!");
+			if (offset == 0ULL && size == buffer->getSize())
+				size = 0ULL;
+			if (isCoveredByGraph(buffer, access, stages))
+			{
+				barrierStats.coveredByGraph++;
+				return false;
+			}
+
 			emitBarrierCmdIfNeeded(1U, 0U);
 			return m_barriers.pushBarrier(BufferBarrier{
 				.buffer = buffer,
@@ -359,56 +711,205 @@ namespace kris
 				.dstaccess = access,
 				.srcstages = buffer->lastStages,
 				.dststages = stages,
+				.offset = size ? offset : 0ULL,
+				.size = size
 				});
 		}
-		bool pushBarrier(ImageResource* image, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages, nbl::video::IGPUImage::LAYOUT layout)
+		// Same as for buffers, subresources can be limited (0 mip count means all of them). Image state is tracked per subresource
+		// (see ImageResource::SubresourceState), subresources of the range being in different states get separate barriers.
+		// Layout UNDEFINED keeps current layout of every subresource.
+		bool pushBarrier(ImageResource* image, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages, nbl::video::IGPUImage::LAYOUT layout,
+			uint32_t baseMip = 0U, uint32_t mipCount = 0U, uint32_t baseLayer = 0U, uint32_t layerCount = 0U)
 		{
-			emitBarrierCmdIfNeeded(0U, 1U);
-			return m_barriers.pushBarrier(ImageBarrier{
+			KRIS_ASSERT_MSG(!secondary, "Secondary recorders can't push barriers!");
+			const auto& params = image->getImage()->getCreationParameters();
+			if (mipCount == 0U)
+			{
+				baseMip = baseLayer = 0U;
+				mipCount = params.mipLevels;
+				layerCount = params.arrayLayers;
+			}
+
+			ImageResource::SubresourceState state;
+			if (image->getState(baseMip, mipCount, baseLayer, layerCount, state))
+				return pushSubresourceBarrier(image, state, access, stages, layout, baseMip, mipCount, baseLayer, layerCount);
+
+			// runs of layers in the same state, separately for every mip
+			bool pushed = false;
+			for (uint32_t mip = baseMip; mip < baseMip + mipCount; ++mip)
+			{
+				for (uint32_t layer = baseLayer; layer < baseLayer + layerCount;)
+				{
+					state = image->getState(mip, layer);
+					uint32_t end = layer + 1U;
+					while (end < baseLayer + layerCount && image->getState(mip, end) == state)
+						++end;
+
+					pushed |= pushSubresourceBarrier(image, state, access, stages, layout, mip, 1U, layer, end - layer);
+					layer = end;
+				}
+			}
+			return pushed;
+		}
+		// Subresources of the range must all be in `src` state
+		bool pushSubresourceBarrier(ImageResource* image, const ImageResource::SubresourceState& src,
+			nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages, nbl::video::IGPUImage::LAYOUT layout,
+			uint32_t baseMip, uint32_t mipCount, uint32_t baseLayer, uint32_t layerCount)
+		{
+			const auto& params = image->getImage()->getCreationParameters();
+			const bool whole = (mipCount == params.mipLevels && layerCount == params.arrayLayers);
+			const nbl::video::IGPUImage::LAYOUT dstlayout = (layout == nbl::video::IGPUImage::LAYOUT::UNDEFINED) ? src.layout : layout;
+			if (whole && dstlayout == src.layout && isCoveredByGraph(image, access, stages))
+			{
+				barrierStats.coveredByGraph++;
+				return false;
+			}
+
+			const ImageBarrier ib = {
 				.image = image,
-				.srcaccess = image->lastAccesses,
+				.srcaccess = src.accesses,
 				.dstaccess = access,
-				.srcstages = image->lastStages,
+				.srcstages = src.stages,
 				.dststages = stages,
-				.srclayout = image->layout,
-				.dstlayout = (layout == nbl::video::IGPUImage::LAYOUT::UNDEFINED) ? image->layout : layout
-				});
+				.srclayout = src.layout,
+				.dstlayout = dstlayout,
+				.baseMip = whole ? 0U : baseMip,
+				.mipCount = whole ? 0U : mipCount,
+				.baseLayer = whole ? 0U : baseLayer,
+				.layerCount = whole ? 0U : layerCount
+			};
+
+			// barriers within one command aren't ordered, pending barrier of overlapping subresources can only be widened
+			// if it's of the same ones and transitions them to the same layout
+			const ImageBarrier* pending = m_barriers.findPending(ib);
+			if (pending && (!pending->isSameRange(ib) || pending->dstlayout != dstlayout))
+				emitBarrierCmd();
+			emitBarrierCmdIfNeeded(0U, 1U);
+			return m_barriers.pushBarrier(ib);
+		}
+		// Ownership transfers are done for whole images, split ones get all their subresources synchronized into one state first
+		void makeUniform(ImageResource* image)
+		{
+			if (image->isUniform())
+				return;
+
+			if (pushBarrier(image, image->lastAccesses, image->lastStages, image->getState(0U, 0U).layout))
+				emitBarrierCmd();
+			KRIS_ASSERT(image->isUniform());
+		}
+
+		// Bounds of subresources written or read by copy regions
+		struct SubresourceBounds
+		{
+			uint32_t mipBegin = ~0U;
+			uint32_t mipEnd = 0U;
+			uint32_t layerBegin = ~0U;
+			uint32_t layerEnd = 0U;
+
+			void add(const nbl::asset::IImage::SSubresourceLayers& sub)
+			{
+				mipBegin = std::min(mipBegin, sub.mipLevel);
+				mipEnd = std::max(mipEnd, sub.mipLevel + 1U);
+				layerBegin = std::min(layerBegin, sub.baseArrayLayer);
+				layerEnd = std::max(layerEnd, sub.baseArrayLayer + sub.layerCount);
+			}
+		};
+		bool pushBarrier(ImageResource* image, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages, nbl::video::IGPUImage::LAYOUT layout,
+			const SubresourceBounds& bounds)
+		{
+			return pushBarrier(image, access, stages, layout,
+				bounds.mipBegin, bounds.mipEnd - bounds.mipBegin, bounds.layerBegin, bounds.layerEnd - bounds.layerBegin);
+		}
+
+		// Pass's own commands aren't synchronized against each other for declared resources, dependent work goes into separate passes
+		bool isCoveredByGraph(const Resource* res, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages) const
+		{
+			return graphScope != 0ULL && res->graphScope == graphScope &&
+				res->lastAccesses.hasFlags(access) && res->lastStages.hasFlags(stages);
 		}
 
+		bool m_gatherBarriers = false; // see beginSetup()
+		uint32_t m_gatheredBarrierCount = 0U; // barriers pending at the last draw setup
+
+		nbl::core::vector<ResourceHandle> m_usedHandles; // secondary only, see markUsed()
+		nbl::core::vector<refctd<nbl::video::IGPUCommandBuffer>> m_secondaryCmdbufs; // merged secondaries
+		uint32_t m_executedSecondaries = 0U;
+
 		static inline constexpr uint32_t MaxBarriers = 50U;
 		struct {
 			BufferBarrier buffers[MaxBarriers];
 			ImageBarrier images[MaxBarriers];
 			BarrierCounts count;
 
+			// Resource already having barrier in the batch gets that one widened instead of another one,
+			// which wouldn't sync with accesses before the batch anyway (its source is the pending barrier's destination)
 			bool pushBarrier(const BufferBarrier& bb)
 			{
-				bb.buffer->lastAccesses = bb.dstaccess;
-				bb.buffer->lastStages = bb.dststages;
+				if (BufferBarrier* pending = findPending(bb.buffer))
+				{
+					if (!pending->isPartial() || !bb.isPartial())
+					{
+						pending->offset = 0ULL;
+						pending->size = 0ULL;
+					}
+					else
+					{
+						const size_t end = std::max(pending->offset + pending->size, bb.offset + bb.size);
+						pending->offset = std::min(pending->offset, bb.offset);
+						pending->size = end - pending->offset;
+					}
+					pending->dstaccess |= bb.dstaccess;
+					pending->dststages |= bb.dststages;
+					bb.buffer->lastAccesses |= bb.dstaccess;
+					bb.buffer->lastStages |= bb.dststages;
+					return true;
+				}
+
+				bb.buffer->lastAccesses = bb.isPartial() ? pendingAccesses(bb.srcaccess, bb.dstaccess) : bb.dstaccess;
+				bb.buffer->lastStages = bb.isPartial() ? (bb.srcstages | bb.dststages) : bb.dststages;
 				if (isBarrierNeededCommon(bb.srcaccess, bb.dstaccess))
 				{
 					buffers[count.buffer++] = bb;
 
-
 					return true;
 				}
 				return false;
 			}
+			// Same as for buffers, but pending barrier must be of the same subresources and layout (see CommandRecorder::pushSubresourceBarrier())
 			bool pushBarrier(const ImageBarrier& ib)
 			{
-				ib.image->lastAccesses = ib.dstaccess;
-				ib.image->lastStages = ib.dststages;
+				if (ImageBarrier* pending = findPending(ib))
+				{
+					KRIS_ASSERT(pending->isSameRange(ib) && pending->dstlayout == ib.dstlayout);
+					pending->dstaccess |= ib.dstaccess;
+					pending->dststages |= ib.dststages;
+					setImageState(*pending);
+					return true;
+				}
+
+				setImageState(ib);
 				if (isBarrierNeededCommon(ib.srcaccess, ib.srclayout, ib.dstaccess, ib.dstlayout))
 				{
 					images[count.image++] = ib;
 
-					ib.image->layout = ib.dstlayout;
-
 					return true;
 				}
 				return false;
 			}
 
+			// ownership transfers are never skipped
+			void pushOwnershipBarrier(const BufferBarrier& bb)
+			{
+				bb.buffer->lastAccesses = bb.dstaccess;
+				bb.buffer->lastStages = bb.dststages;
+				buffers[count.buffer++] = bb;
+			}
+			void pushOwnershipBarrier(const ImageBarrier& ib)
+			{
+				setImageState(ib);
+				images[count.image++] = ib;
+			}
+
 			bool shouldBarrierCmdBeEmitted(uint32_t bufToBePushed, uint32_t imgToBePushed)
 			{
 				// if next updateDescSet() call might potentially overflow barriers buffer
@@ -420,10 +921,45 @@ namespace kris
 				count.reset();
 			}
 
+			// ownership transfers are never merged
+			BufferBarrier* findPending(const BufferResource* buffer)
+			{
+				for (uint32_t i = 0U; i < count.buffer; ++i)
+				{
+					if (buffers[i].buffer == buffer && buffers[i].ownershipOp == OwnershipOp::NONE)
+						return buffers + i;
+				}
+				return nullptr;
+			}
+			ImageBarrier* findPending(const ImageBarrier& ib)
+			{
+				for (uint32_t i = 0U; i < count.image; ++i)
+				{
+					if (images[i].image == ib.image && images[i].ownershipOp == OwnershipOp::NONE && images[i].overlaps(ib))
+						return images + i;
+				}
+				return nullptr;
+			}
+
 			BufferBarrier* getBuffersPtr() { return buffers + count.buffer; }
 			ImageBarrier* getImagesPtr() { return images + count.image; }
 
 		private:
+			static void setImageState(const ImageBarrier& ib)
+			{
+				const ImageResource::SubresourceState state = { ib.dstaccess, ib.dststages, ib.dstlayout };
+				if (ib.isPartial())
+					ib.image->setState(ib.baseMip, ib.mipCount, ib.baseLayer, ib.layerCount, state);
+				else
+					ib.image->setState(state);
+			}
+
+			// writes outside of partial barrier's range weren't made visible yet
+			static nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> pendingAccesses(nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> srcaccess, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> dstaccess)
+			{
+				return dstaccess | (srcaccess & nbl::asset::ACCESS_FLAGS::MEMORY_WRITE_BITS);
+			}
+
 			bool isBarrierNeededCommon(nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> srcaccess, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> dstaccess)
 			{
 				KRIS_UNUSED_PARAM(dstaccess);
@@ -439,6 +975,5 @@ namespace kris
 				return isBarrierNeededCommon(srcaccess, dstaccess);
 			}
 		} m_barriers;
-		DeferredAllocDeletion m_resources;
 	};
 }
\ No newline at end of file
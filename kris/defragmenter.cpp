@@ -0,0 +1,194 @@
+#include "defragmenter.h"
+
+namespace kris
+{
+	MemDefragmenter::DefragStats MemDefragmenter::step(CommandRecorder& cmdrec, size_t byteBudget)
+	{
+		DefragStats stats;
+
+		if (byteBudget == 0ULL)
+			return stats;
+
+		// pool might have been freed in the meantime if all its resources died
+		if (m_pool && !isPoolValid())
+		{
+			m_pool = nullptr;
+		}
+		for (uint32_t ix = 0U; !m_pool && ix < (uint32_t)m_ra->m_heaps.size(); ++ix)
+		{
+			if (MemPool* pool = pickPool(ix))
+			{
+				m_heapIx = ix;
+				m_pool = pool;
+				m_ra->m_heaps[ix].setPoolEvacuation(pool, MemPool::EEvacuation::Evacuating);
+			}
+		}
+		if (!m_pool)
+			return stats;
+
+		MemHeap& heap = m_ra->m_heaps[m_heapIx];
+
+		// relocation takes the allocation off the pool's list, evacuating pool doesn't get any new ones
+		for (;;)
+		{
+			const auto& live = m_ra->getLiveAllocations(m_pool);
+			if (live.empty())
+				break;
+			Resource* const al = live.back();
+			// got into async upload since the pool was picked
+			if (!canMove(al))
+				return stats; // continue next frame
+
+			// at least one allocation is moved every step, otherwise the ones bigger than budget would never leave the pool
+			const size_t size = al->getSize();
+			if (stats.bytesMoved != 0ULL && stats.bytesMoved + size > byteBudget)
+				return stats; // continue next frame
+
+			if (!relocate(cmdrec, al))
+			{
+				// no space left in other pools, give up on this one
+				heap.setPoolEvacuation(m_pool, MemPool::EEvacuation::None);
+				m_pool = nullptr;
+				return stats;
+			}
+
+			stats.bytesMoved += size;
+			stats.allocationsMoved++;
+		}
+
+		// pool holds only retired allocations now and will be freed together with them
+		heap.setPoolEvacuation(m_pool, MemPool::EEvacuation::Evacuated);
+		stats.bytesReclaimed += m_pool->getTotalSize();
+		m_pool = nullptr;
+
+		return stats;
+	}
+
+	bool MemDefragmenter::canMove(Resource* al) const
+	{
+		// copy out of the retired allocation would race transfer queue writing it
+		if (!al->isMovable() || al->asyncUploadPins != 0U)
+			return false;
+
+		if (al->isBuffer())
+		{
+			const auto usage = static_cast<BufferResource*>(al)->getBuffer()->getCreationParams().usage;
+			return usage.hasFlags(nbl::core::bitflag(nbl::asset::IBuffer::EUF_TRANSFER_SRC_BIT) | nbl::asset::IBuffer::EUF_TRANSFER_DST_BIT);
+		}
+
+		const auto& params = static_cast<ImageResource*>(al)->getImage()->getCreationParameters();
+		const auto usage = params.usage | params.depthUsage | params.stencilUsage;
+		return usage.hasFlags(nbl::core::bitflag(nbl::asset::IImage::EUF_TRANSFER_SRC_BIT) | nbl::asset::IImage::EUF_TRANSFER_DST_BIT) &&
+			!usage.hasFlags(nbl::asset::IImage::EUF_RENDER_ATTACHMENT_BIT);
+	}
+
+	bool MemDefragmenter::isPoolValid() const
+	{
+		const auto& pools = m_ra->m_heaps[m_heapIx].getPools();
+		if (std::find(pools.begin(), pools.end(), m_pool) == pools.end())
+			return false;
+		// same address might have been reused by brand new pool
+		return m_pool->m_evacuation == MemPool::EEvacuation::Evacuating;
+	}
+
+	MemPool* MemDefragmenter::pickPool(uint32_t heapIx) const
+	{
+		const auto& memprops = m_device->getPhysicalDevice()->getMemoryProperties();
+		if (heapIx >= memprops.memoryTypeCount ||
+			memprops.memoryTypes[heapIx].propertyFlags.hasFlags(nbl::video::IDeviceMemoryAllocation::EMPF_HOST_VISIBLE_BIT))
+			return nullptr;
+
+		const auto& pools = m_ra->m_heaps[heapIx].getPools();
+		if (pools.size() < 2U)
+			return nullptr;
+
+		// free space outside the evacuated pool must be able to take all of its contents
+		size_t totalFree = 0ULL;
+		for (MemPool* pool : pools)
+		{
+			if (!pool->isEvacuating())
+				totalFree += pool->getFreeSize();
+		}
+
+		MemPool* best = nullptr;
+		size_t bestUsed = ~0ULL;
+		for (MemPool* pool : pools)
+		{
+			if (pool->isEvacuating())
+				continue;
+
+			const size_t used = pool->getTotalSize() - pool->getFreeSize();
+			// empty pools are up to MemHeap's retention policy
+			if (used == 0ULL)
+				continue;
+			if (used * 100ULL >= pool->getTotalSize() * MaxOccupancyPercent || used >= bestUsed)
+				continue;
+			if (used > totalFree - pool->getFreeSize())
+				continue;
+
+			const auto& live = m_ra->getLiveAllocations(pool);
+			if (std::all_of(live.begin(), live.end(), [this](Resource* al) { return canMove(al); }))
+			{
+				best = pool;
+				bestUsed = used;
+			}
+		}
+
+		return best;
+	}
+
+	bool MemDefragmenter::relocate(CommandRecorder& cmdrec, Resource* al)
+	{
+		if (al->isBuffer())
+		{
+			BufferResource* const buf = static_cast<BufferResource*>(al);
+
+			refctd<BufferResource> retired = m_ra->relocateBuffer(m_device, buf);
+			if (!retired)
+				return false;
+
+			nbl::video::IGPUCommandBuffer::SBufferCopy region;
+			region.srcOffset = 0ULL;
+			region.dstOffset = 0ULL;
+			region.size = buf->getSize();
+			cmdrec.copyBuffer(retired.get(), buf, 1U, &region);
+
+			return true;
+		}
+
+		ImageResource* const img = static_cast<ImageResource*>(al);
+
+		refctd<ImageResource> retired = m_ra->relocateImage(m_device, img);
+		if (!retired)
+			return false;
+
+		// never written, nothing to copy, retired memory is freed once frames in flight are done with it
+		if (retired->isUndefined())
+		{
+			return true;
+		}
+
+		const auto& params = img->getImage()->getCreationParameters();
+		const auto aspect = img->getAspectFlags();
+
+		KRIS_ASSERT(params.mipLevels <= MaxMipLevels);
+		nbl::video::IGPUImage::SImageCopy regions[MaxMipLevels];
+		for (uint32_t mip = 0U; mip < params.mipLevels; ++mip)
+		{
+			const auto extent = img->getImage()->getMipSize(mip);
+
+			auto& region = regions[mip];
+			region.srcSubresource.aspectMask = aspect;
+			region.srcSubresource.mipLevel = mip;
+			region.srcSubresource.baseArrayLayer = 0U;
+			region.srcSubresource.layerCount = params.arrayLayers;
+			region.dstSubresource = region.srcSubresource;
+			region.srcOffset = { 0U, 0U, 0U };
+			region.dstOffset = { 0U, 0U, 0U };
+			region.extent = { extent.x, extent.y, extent.z };
+		}
+		cmdrec.copyImage(retired.get(), img, params.mipLevels, regions);
+
+		return true;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "kris_common.h"
+#include "resource_allocator.h"
+#include "cmd_recorder.h"
+
+namespace kris
+{
+	// Incrementally empties sparsely used MemPools by moving their allocations into other pools of the same heap.
+	// Works on one pool at a time, every step() moves allocations within given byte budget and records GPU copies.
+	// Descriptor sets referencing moved resources are patched lazily, see Resource::getGeneration().
+	// Only device-local (not host-visible) memory is compacted, since mapped pointers cannot be patched.
+	// Resources must be created with TRANSFER_SRC and TRANSFER_DST usages to be movable, render attachments never are.
+	class MemDefragmenter
+	{
+	public:
+		enum : uint32_t
+		{
+			// pools used less than this are evacuated
+			MaxOccupancyPercent = 25U,
+		};
+		enum : size_t
+		{
+			DefaultFrameBudget = 4ULL << 20,
+		};
+
+		struct DefragStats
+		{
+			size_t bytesMoved = 0ULL;
+			uint32_t allocationsMoved = 0U;
+			// memory of pools emptied by this step, released once GPU is done with the old placements
+			size_t bytesReclaimed = 0ULL;
+		};
+
+		MemDefragmenter() = default;
+
+		void init(nbl::video::ILogicalDevice* device, ResourceAllocator* ra)
+		{
+			m_device = device;
+			m_ra = ra;
+		}
+
+		// Moves at most `byteBudget` bytes of resources (but always at least one resource, however big), copy commands are recorded to `cmdrec`.
+		// Must be called outside of render pass.
+		DefragStats step(CommandRecorder& cmdrec, size_t byteBudget);
+
+	private:
+		enum : uint32_t
+		{
+			MaxMipLevels = 16U,
+		};
+
+		bool canMove(Resource* al) const;
+		bool isPoolValid() const;
+		MemPool* pickPool(uint32_t heapIx) const;
+		bool relocate(CommandRecorder& cmdrec, Resource* al);
+
+		nbl::video::ILogicalDevice* m_device = nullptr;
+		ResourceAllocator* m_ra = nullptr;
+
+		// pool currently being evacuated
+		uint32_t m_heapIx = ~0U;
+		MemPool* m_pool = nullptr;
+	};
+}
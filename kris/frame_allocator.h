@@ -0,0 +1,107 @@
+#pragma once
+
+#include "kris_common.h"
+#include "resource_allocator.h"
+
+namespace kris
+{
+	// Linear allocator of transient per-frame GPU data (uniforms, storage, vertices).
+	// One persistently mapped host-visible buffer is split into FramesInFlight regions,
+	// region is reused once Renderer waited on its fence for the frame which used it last.
+	// Writing data is just memcpy, consumers bind the buffer with dynamic offsets.
+	class FrameAllocator
+	{
+	public:
+		enum : uint32_t
+		{
+			DefaultFrameSize = 1U << 20, // 1M
+		};
+
+		struct Allocation
+		{
+			BufferResource* buffer = nullptr;
+			uint32_t offset = 0U; // relative to `buffer` (see BufferResource::getOffset()), can be used as dynamic offset directly
+			void* ptr = nullptr;
+
+			bool isValid() const { return ptr != nullptr; }
+		};
+
+		FrameAllocator() = default;
+
+		void init(nbl::video::ILogicalDevice* device, ResourceAllocator* ra, uint32_t frameSize = DefaultFrameSize)
+		{
+			m_device = device;
+
+			const auto& limits = device->getPhysicalDevice()->getLimits();
+			m_minAlignment = std::max<uint32_t>(limits.minUBOAlignment, limits.minSSBOAlignment);
+			m_frameSize = nbl::core::alignUp(frameSize, m_minAlignment);
+
+			nbl::video::IGPUBuffer::SCreationParams ci = {};
+			ci.size = (size_t)m_frameSize * FramesInFlight;
+			ci.usage = nbl::core::bitflag(nbl::video::IGPUBuffer::EUF_UNIFORM_BUFFER_BIT) |
+				nbl::video::IGPUBuffer::EUF_STORAGE_BUFFER_BIT |
+				nbl::video::IGPUBuffer::EUF_VERTEX_BUFFER_BIT |
+				nbl::video::IGPUBuffer::EUF_INDEX_BUFFER_BIT;
+			m_buffer = ra->allocBuffer(device, std::move(ci), device->getPhysicalDevice()->getHostVisibleMemoryTypeBits(), ResourceAllocator::AllocFlags::Pinned);
+			KRIS_ASSERT(m_buffer && m_buffer->isPersistentlyMapped());
+			m_buffer->getBuffer()->setObjectDebugName("FrameAllocator ring");
+		}
+
+		// Caller must make sure GPU is done with the frame which used `frameIx` region the last time
+		void beginFrame(uint32_t frameIx)
+		{
+			KRIS_ASSERT(frameIx < FramesInFlight);
+			m_frameIx = frameIx;
+			m_cursor = 0U;
+		}
+
+		// `alignment` 0 means alignment suitable for uniform/storage buffer dynamic offsets
+		Allocation alloc(uint32_t size, uint32_t alignment = 0U)
+		{
+			const uint32_t offset = nbl::core::alignUp(m_cursor, std::max(alignment, m_minAlignment));
+			KRIS_ASSERT_MSG(offset + size <= m_frameSize, "FrameAllocator: out of space for current frame!");
+			if (offset + size > m_frameSize)
+				return {};
+
+			m_cursor = offset + size;
+
+			Allocation a;
+			a.buffer = m_buffer.get();
+			a.offset = getRegionOffset() + offset;
+			a.ptr = reinterpret_cast<uint8_t*>(m_buffer->getMappedPtr()) + a.offset;
+			return a;
+		}
+
+		template <typename T>
+		Allocation push(const T& data, uint32_t alignment = 0U)
+		{
+			Allocation a = alloc(sizeof(T), alignment);
+			if (a.isValid())
+				memcpy(a.ptr, &data, sizeof(T));
+			return a;
+		}
+
+		// Makes all the data written in current frame visible to device, must be called before submission
+		void flush()
+		{
+			if (m_cursor == 0U)
+				return;
+
+			const ResourceAllocator::MappedRange range = { m_buffer.get(), getRegionOffset(), m_cursor };
+			ResourceAllocator::flushMappedRanges(m_device, 1U, &range);
+		}
+
+		BufferResource* getBuffer() const { return m_buffer.get(); }
+		uint32_t getUsedSize() const { return m_cursor; }
+
+	private:
+		uint32_t getRegionOffset() const { return m_frameIx * m_frameSize; }
+
+		nbl::video::ILogicalDevice* m_device = nullptr;
+		refctd<BufferResource> m_buffer;
+		uint32_t m_frameSize = 0U;
+		uint32_t m_minAlignment = 1U;
+		uint32_t m_frameIx = 0U;
+		uint32_t m_cursor = 0U;
+	};
+}
@@ -0,0 +1,206 @@
+#include "job_system.h"
+
+namespace kris
+{
+	namespace
+	{
+		// worker the calling thread is, of which JobSystem
+		thread_local const JobSystem* tl_jobSystem = nullptr;
+		thread_local uint32_t tl_workerIx = JobSystem::InvalidWorkerIx;
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard lock(m_sleepMutex);
+			m_quit = true;
+		}
+		m_sleepCv.notify_all();
+		for (auto& t : m_threads)
+			t.join();
+
+		if (tl_jobSystem == this)
+		{
+			tl_jobSystem = nullptr;
+			tl_workerIx = InvalidWorkerIx;
+		}
+	}
+
+	void JobSystem::init(uint32_t workerCount)
+	{
+		KRIS_ASSERT(m_workerCount == 0U);
+
+		m_workerCount = std::clamp(workerCount, 1U, (uint32_t)MaxWorkers);
+		m_deques = std::make_unique<Deque[]>(m_workerCount);
+
+		tl_jobSystem = this;
+		tl_workerIx = 0U;
+
+		for (uint32_t i = 1U; i < m_workerCount; ++i)
+			m_threads.emplace_back(&JobSystem::workerMain, this, i);
+	}
+
+	uint32_t JobSystem::getWorkerIx() const
+	{
+		return (tl_jobSystem == this) ? tl_workerIx : InvalidWorkerIx;
+	}
+
+	void JobSystem::run(Counter& counter, job_fn_t&& fn)
+	{
+		counter.m_value.fetch_add(1U, std::memory_order_relaxed);
+		schedule(KRIS_MEM_NEW Job{ std::move(fn), &counter });
+	}
+
+	void JobSystem::runAfter(Counter& dependency, Counter& counter, job_fn_t&& fn)
+	{
+		counter.m_value.fetch_add(1U, std::memory_order_relaxed);
+		Job* const job = KRIS_MEM_NEW Job{ std::move(fn), &counter };
+
+		{
+			// dependency dropping to 0 takes its continuations under the same lock (see execute())
+			std::lock_guard lock(dependency.m_mutex);
+			if (!dependency.isDone())
+			{
+				dependency.m_continuations.push_back(job);
+				return;
+			}
+		}
+		schedule(job);
+	}
+
+	void JobSystem::wait(Counter& counter)
+	{
+		const uint32_t workerIx = getWorkerIx();
+		while (!counter.isDone())
+		{
+			if (Job* const job = findJob(workerIx))
+				execute(job);
+			else
+				std::this_thread::yield();
+		}
+		// job which dropped the counter may still hold its lock (see execute())
+		std::lock_guard lock(counter.m_mutex);
+	}
+
+	void JobSystem::parallelFor(uint32_t count, uint32_t grain, const range_fn_t& fn)
+	{
+		if (count == 0U)
+			return;
+
+		grain = std::max(grain, 1U);
+		const uint32_t chunkCount = std::min((count + grain - 1U) / grain, m_workerCount * ChunksPerWorker);
+		if (chunkCount <= 1U)
+		{
+			fn(0U, count);
+			return;
+		}
+
+		const uint32_t chunkSize = (count + chunkCount - 1U) / chunkCount;
+		Counter counter;
+		for (uint32_t begin = chunkSize; begin < count; begin += chunkSize)
+		{
+			const uint32_t end = std::min(begin + chunkSize, count);
+			run(counter, [&fn, begin, end]() { fn(begin, end); });
+		}
+		fn(0U, chunkSize);
+
+		wait(counter);
+	}
+
+	void JobSystem::schedule(Job* job)
+	{
+		const uint32_t workerIx = getWorkerIx();
+		if (workerIx != InvalidWorkerIx)
+		{
+			if (!m_deques[workerIx].push(job))
+			{
+				execute(job);
+				return;
+			}
+		}
+		else
+		{
+			std::lock_guard lock(m_sharedMutex);
+			m_shared.push_back(job);
+		}
+
+		m_queuedJobs.fetch_add(1U, std::memory_order_release);
+		{
+			// so that worker going to sleep either sees the job or gets notified
+			std::lock_guard lock(m_sleepMutex);
+		}
+		m_sleepCv.notify_one();
+	}
+
+	JobSystem::Job* JobSystem::findJob(uint32_t workerIx)
+	{
+		if (m_queuedJobs.load(std::memory_order_acquire) == 0U)
+			return nullptr;
+
+		Job* job = nullptr;
+		if (workerIx != InvalidWorkerIx)
+			job = m_deques[workerIx].pop();
+
+		// steal, starting from the next worker so that thieves spread over victims
+		const uint32_t first = (workerIx == InvalidWorkerIx) ? 0U : workerIx + 1U;
+		for (uint32_t i = 0U; !job && i < m_workerCount; ++i)
+		{
+			const uint32_t victim = (first + i) % m_workerCount;
+			if (victim != workerIx)
+				job = m_deques[victim].steal();
+		}
+
+		if (!job)
+		{
+			std::lock_guard lock(m_sharedMutex);
+			if (!m_shared.empty())
+			{
+				job = m_shared.front();
+				m_shared.pop_front();
+			}
+		}
+
+		if (job)
+			m_queuedJobs.fetch_sub(1U, std::memory_order_relaxed);
+		return job;
+	}
+
+	void JobSystem::execute(Job* job)
+	{
+		job->fn();
+
+		Counter* const counter = job->counter;
+		KRIS_MEM_DELETE(job);
+
+		nbl::core::vector<Job*> continuations;
+		{
+			// under the lock so that runAfter() either finds the counter running or its continuations taken,
+			// and so that wait() doesn't return (letting the counter go out of scope) while it's still being touched here
+			std::lock_guard lock(counter->m_mutex);
+			if (counter->m_value.fetch_sub(1U, std::memory_order_acq_rel) == 1U)
+				continuations.swap(counter->m_continuations);
+		}
+		for (Job* const c : continuations)
+			schedule(c);
+	}
+
+	void JobSystem::workerMain(uint32_t workerIx)
+	{
+		tl_jobSystem = this;
+		tl_workerIx = workerIx;
+
+		for (;;)
+		{
+			if (Job* const job = findJob(workerIx))
+			{
+				execute(job);
+				continue;
+			}
+
+			std::unique_lock lock(m_sleepMutex);
+			m_sleepCv.wait(lock, [this] { return m_quit || m_queuedJobs.load(std::memory_order_acquire) != 0U; });
+			if (m_quit)
+				return;
+		}
+	}
+}
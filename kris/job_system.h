@@ -0,0 +1,169 @@
+#pragma once
+
+#include "kris_common.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace kris
+{
+	// Work-stealing job scheduler. Every worker thread owns a deque it pushes and pops its jobs at the bottom of (LIFO, cache-warm),
+	// workers running out of jobs steal from the top of other workers' deques. The thread calling init() is worker 0,
+	// it runs jobs only while waiting (wait(), parallelFor()). Threads which aren't workers submit into a shared queue.
+	// Completion is tracked with counters: a job bumps its counter when submitted and drops it once done, wait() runs other jobs
+	// until the counter drops to 0, so jobs can wait for jobs they submitted. Jobs can also depend on a counter (runAfter()),
+	// they're scheduled once it drops to 0.
+	class JobSystem
+	{
+		struct Job;
+
+	public:
+		enum : uint32_t
+		{
+			MaxWorkers = 32U,
+			DequeCapacity = 4096U, // jobs pushed into full deque are run right away instead
+			ChunksPerWorker = 4U, // parallelFor() splits ranges into at most this many chunks per worker, for stealing to balance them
+
+			InvalidWorkerIx = ~0U,
+		};
+
+		using job_fn_t = std::function<void()>;
+		using range_fn_t = std::function<void(uint32_t begin, uint32_t end)>;
+
+		// Must outlive jobs it counts (wait() for it before it goes out of scope)
+		class Counter
+		{
+		public:
+			Counter() = default;
+			Counter(const Counter&) = delete;
+			Counter& operator=(const Counter&) = delete;
+
+			bool isDone() const { return m_value.load(std::memory_order_acquire) == 0U; }
+
+		private:
+			friend class JobSystem;
+
+			std::atomic<uint32_t> m_value = 0U;
+			std::mutex m_mutex; // guards continuations
+			nbl::core::vector<Job*> m_continuations; // jobs waiting for the counter to drop to 0 (see runAfter())
+		};
+
+		JobSystem() = default;
+		~JobSystem();
+
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+
+		// `workerCount` includes the calling thread, 1 means no worker threads (jobs run inline in wait())
+		void init(uint32_t workerCount = std::thread::hardware_concurrency());
+
+		uint32_t getWorkerCount() const { return m_workerCount; }
+		// Index of the calling thread among workers, InvalidWorkerIx for other threads
+		uint32_t getWorkerIx() const;
+
+		void run(Counter& counter, job_fn_t&& fn);
+		// Scheduled once `dependency` drops to 0 (right away if it's 0 already), `counter` counts it from now on
+		void runAfter(Counter& dependency, Counter& counter, job_fn_t&& fn);
+		// Runs jobs until `counter` drops to 0
+		void wait(Counter& counter);
+
+		// fn(begin, end) over subranges of [0, count), each at least `grain` long. Calling thread runs the first subrange
+		// and returns once all are done.
+		void parallelFor(uint32_t count, uint32_t grain, const range_fn_t& fn);
+
+	private:
+		struct Job
+		{
+			job_fn_t fn;
+			Counter* counter;
+		};
+
+		// Chase-Lev deque: owner pushes and pops at bottom, thieves take from top, only the last job is contended.
+		// Fixed capacity, push() fails once full.
+		class Deque
+		{
+		public:
+			bool push(Job* job)
+			{
+				const int64_t b = m_bottom.load(std::memory_order_relaxed);
+				const int64_t t = m_top.load(std::memory_order_acquire);
+				if (b - t >= (int64_t)DequeCapacity)
+					return false;
+
+				m_jobs[b & (DequeCapacity - 1U)].store(job, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				m_bottom.store(b + 1, std::memory_order_relaxed);
+				return true;
+			}
+			// owner only
+			Job* pop()
+			{
+				const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+				m_bottom.store(b, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				int64_t t = m_top.load(std::memory_order_relaxed);
+
+				Job* job = nullptr;
+				if (t <= b)
+				{
+					job = m_jobs[b & (DequeCapacity - 1U)].load(std::memory_order_relaxed);
+					if (t == b)
+					{
+						// last job, race thieves for it
+						if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+							job = nullptr;
+						m_bottom.store(b + 1, std::memory_order_relaxed);
+					}
+				}
+				else
+				{
+					m_bottom.store(b + 1, std::memory_order_relaxed);
+				}
+				return job;
+			}
+			// any thread, null if empty or lost race with another thief or the owner
+			Job* steal()
+			{
+				int64_t t = m_top.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				const int64_t b = m_bottom.load(std::memory_order_acquire);
+				if (t >= b)
+					return nullptr;
+
+				Job* const job = m_jobs[t & (DequeCapacity - 1U)].load(std::memory_order_relaxed);
+				if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					return nullptr;
+				return job;
+			}
+
+		private:
+			static_assert((DequeCapacity & (DequeCapacity - 1U)) == 0U, "DequeCapacity must be power of 2!");
+
+			// top and bottom on separate cache lines, thieves hammer top
+			alignas(64) std::atomic<int64_t> m_top = 0;
+			alignas(64) std::atomic<int64_t> m_bottom = 0;
+			std::atomic<Job*> m_jobs[DequeCapacity] = {};
+		};
+
+		void schedule(Job* job);
+		Job* findJob(uint32_t workerIx);
+		void execute(Job* job);
+		void workerMain(uint32_t workerIx);
+
+		uint32_t m_workerCount = 0U;
+		std::unique_ptr<Deque[]> m_deques;
+		nbl::core::vector<std::thread> m_threads;
+
+		// submissions of non-worker threads
+		std::mutex m_sharedMutex;
+		nbl::core::deque<Job*> m_shared;
+
+		// idle workers sleep until anything is queued
+		std::atomic<uint32_t> m_queuedJobs = 0U;
+		std::mutex m_sleepMutex;
+		std::condition_variable m_sleepCv;
+		bool m_quit = false;
+	};
+}
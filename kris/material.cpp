@@ -95,9 +95,16 @@ namespace kris
 			auto& bnd = m_bindings[b];
 			auto& slot = rmap->slots[bnd.rmapIx];
 
-			Resource* const resource = slot.resource.get();
+			Resource* resource = m_creatorRenderer->getResourceAllocator()->resolve(slot.handle);
+			// owner of mapped resource already released it
+			if (!resource)
+			{
+				resource = isTextureBindingSlot((BindingSlot)b) ?
+					static_cast<Resource*>(m_creatorRenderer->getDefaultImageResource()) :
+					static_cast<Resource*>(m_creatorRenderer->getDefaultBufferResource());
+			}
 
-			const bool needToUpdate = !resource->compareIds(ds.m_resources[b].get());
+			const bool needToUpdate = !ds.isUpToDate(b, resource);
 
 			if (isBufferBindingSlot((BindingSlot)b))
 			{
@@ -8,17 +8,18 @@ namespace kris
 	// fwd decl, for creatorRenderer memeber
 	class Renderer;
 
+	// Slots don't own resources, owners (meshes, app) keep them alive, dead ones resolve to nullptr
 	struct ResourceMap
 	{
 		struct Slot
 		{
 			Slot& operator=(Resource* res)
 			{
-				resource = refctd<Resource>(res);
+				handle = res->getHandle();
 				return *this;
 			}
 
-			refctd<Resource> resource;
+			ResourceHandle handle;
 		};
 
 		Slot& operator[](size_t ix) { return slots[ix]; }
@@ -48,7 +49,7 @@ namespace kris
 
 		refctd<nbl::video::IGPUDescriptorSet> m_ds;
 
-		virtual nbl::core::SRange<const refctd<Resource>> getResources() const = 0;
+		virtual nbl::core::SRange<const ResourceHandle> getResources() const = 0;
 	};
 
 	template <uint32_t _MaxBindings>
@@ -61,7 +62,9 @@ namespace kris
 			FullBndMask = (1U << MaxBindings) - 1U,
 		};
 
-		refctd<Resource> m_resources[MaxBindings];
+		ResourceHandle m_resources[MaxBindings];
+		// generations of m_resources at the moment of writing them into descriptor set
+		uint32_t m_generations[MaxBindings] = {};
 
 		DescriptorSetTemplate() = default;
 		explicit DescriptorSetTemplate(refctd<nbl::video::IGPUDescriptorSet>&& ds) : DescriptorSet(std::move(ds))
@@ -72,7 +75,8 @@ namespace kris
 		{
 			for (uint32_t i = 0U; i < MaxBindings; ++i)
 			{
-				m_resources[i] = std::move(rhs.m_resources[i]);
+				m_resources[i] = rhs.m_resources[i];
+				m_generations[i] = rhs.m_generations[i];
 			}
 		}
 		virtual ~DescriptorSetTemplate() = default;
@@ -82,14 +86,21 @@ namespace kris
 			static_cast<DescriptorSet&>(*this) = rhs;
 			for (uint32_t i = 0U; i < MaxBindings; ++i)
 			{
-				m_resources[i] = std::move(rhs.m_resources[i]);
+				m_resources[i] = rhs.m_resources[i];
+				m_generations[i] = rhs.m_generations[i];
 			}
 			return *this;
 		}
 
-		nbl::core::SRange<const refctd<Resource>> getResources() const override
+		// false if binding holds different resource or the same one but since moved in memory
+		bool isUpToDate(uint32_t binding, Resource* resource) const
 		{
-			return nbl::core::SRange<const refctd<Resource>>(m_resources, m_resources + MaxBindings);
+			return m_resources[binding] == resource->getHandle() && m_generations[binding] == resource->getGeneration();
+		}
+
+		nbl::core::SRange<const ResourceHandle> getResources() const override
+		{
+			return nbl::core::SRange<const ResourceHandle>(m_resources, m_resources + MaxBindings);
 		}
 
 		void update(nbl::video::ILogicalDevice* device,
@@ -101,10 +112,11 @@ namespace kris
 			const bool full_range = (size == Size_FullRange);
 
 			info[0].desc = refctd<nbl::video::IGPUBuffer>(resource->getBuffer()); // bad API, too late to change, should just take raw-pointers since not consumed
-			info[0].info.buffer = { .offset = full_range ? 0 : offset,.size = full_range ? resource->getSize() : size };
+			info[0].info.buffer = { .offset = resource->getOffset() + (full_range ? 0 : offset),.size = full_range ? resource->getSize() : size };
 			write[0] = { .dstSet = m_ds.get(), .binding = binding, .arrayElement = 0U, .count = 1U, .info = info };
 
-			m_resources[binding] = refctd<Resource>(resource);
+			m_resources[binding] = resource->getHandle();
+			m_generations[binding] = resource->getGeneration();
 		}
 		void update(nbl::video::ILogicalDevice* device,
 			nbl::video::IGPUDescriptorSet::SWriteDescriptorSet* write, nbl::video::IGPUDescriptorSet::SDescriptorInfo* info,
@@ -130,7 +142,8 @@ namespace kris
 			info[0].info.combinedImageSampler.sampler = refctd<nbl::video::IGPUSampler>(sampler);
 			write[0] = { .dstSet = m_ds.get(),.binding = binding,.arrayElement = 0U,.count = 1U,.info = info };
 
-			m_resources[binding] = refctd<Resource>(resource);
+			m_resources[binding] = resource->getHandle();
+			m_generations[binding] = resource->getGeneration();
 		}
 		void update(nbl::video::ILogicalDevice* device,
 			nbl::video::IGPUDescriptorSet::SWriteDescriptorSet* write, nbl::video::IGPUDescriptorSet::SDescriptorInfo* info,
@@ -145,7 +158,8 @@ namespace kris
 			info[0].info.buffer.size = size;
 			write[0] = { .dstSet = m_ds.get(), .binding = binding, .arrayElement = 0U, .count = 1U, .info = info };
 
-			m_resources[binding] = refctd<Resource>(resource);
+			m_resources[binding] = resource->getHandle();
+			m_generations[binding] = resource->getGeneration();
 		}
 	};
 
@@ -17,6 +17,8 @@ namespace kris
         refctd<BufferResource> m_idxBuf;
 
         refctd<GfxMaterial> m_mtl;
+        // pipeline of every pass as resolved by CommandRecorder::setupDrawMesh(), kept so that material's cache evicting it doesn't matter
+        refctd<nbl::video::IGPUGraphicsPipeline> m_setupPso[NumPasses];
 
         struct ResourceMapping
         {
@@ -41,7 +43,7 @@ namespace kris
                 if (mapping.res)
                 {
                     KRIS_ASSERT(mapping.rmapIx >= FirstUsableResourceMapSlot);
-                    (*rmap)[mapping.rmapIx].resource = mapping.res;
+                    (*rmap)[mapping.rmapIx] = mapping.res.get();
                 }
             }
         }
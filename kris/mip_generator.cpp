@@ -0,0 +1,386 @@
+#include "mip_generator.h"
+
+namespace kris
+{
+	namespace
+	{
+		struct FormatInfo
+		{
+			nbl::asset::E_FORMAT format;
+			nbl::asset::E_FORMAT storageFormat; // format of views mips are written through
+			const char* hlslFormat;
+			bool srgb;
+		};
+
+		constexpr FormatInfo SupportedFormats[] = {
+			{ nbl::asset::EF_R8G8B8A8_UNORM, nbl::asset::EF_R8G8B8A8_UNORM, "rgba8", false },
+			{ nbl::asset::EF_R8G8B8A8_SRGB, nbl::asset::EF_R8G8B8A8_UNORM, "rgba8", true },
+			{ nbl::asset::EF_R8G8_UNORM, nbl::asset::EF_R8G8_UNORM, "rg8", false },
+			{ nbl::asset::EF_R8_UNORM, nbl::asset::EF_R8_UNORM, "r8", false },
+			{ nbl::asset::EF_R16G16B16A16_SFLOAT, nbl::asset::EF_R16G16B16A16_SFLOAT, "rgba16f", false },
+			{ nbl::asset::EF_R16G16_SFLOAT, nbl::asset::EF_R16G16_SFLOAT, "rg16f", false },
+			{ nbl::asset::EF_R16_SFLOAT, nbl::asset::EF_R16_SFLOAT, "r16f", false },
+			{ nbl::asset::EF_R32G32B32A32_SFLOAT, nbl::asset::EF_R32G32B32A32_SFLOAT, "rgba32f", false },
+			{ nbl::asset::EF_R32_SFLOAT, nbl::asset::EF_R32_SFLOAT, "r32f", false },
+		};
+
+		const FormatInfo* findFormatInfo(nbl::asset::E_FORMAT format)
+		{
+			for (const auto& f : SupportedFormats)
+			{
+				if (f.format == format)
+					return &f;
+			}
+			return nullptr;
+		}
+
+		// KRIS_MIPGEN_FORMAT and KRIS_MIPGEN_SRGB are prepended per format
+		constexpr const char* ShaderSource = R"===(
+static const uint MaxMipLevels = 13;
+static const uint TileSize = 64;
+static const uint WorkgroupSize = 256;
+
+struct PushConstants
+{
+	uint2 srcSize;
+	float2 invSrcSize;
+	uint mipCount;
+	uint groupsPerLayer;
+};
+[[vk::push_constant]] PushConstants pc;
+
+[[vk::combinedImageSampler]] [[vk::binding(0, 0)]] Texture2DArray<float4> g_src;
+[[vk::combinedImageSampler]] [[vk::binding(0, 0)]] SamplerState g_smplr;
+// element i is mip i+1
+[[vk::binding(1, 0)]] [[vk::image_format(KRIS_MIPGEN_FORMAT)]] globallycoherent RWTexture2DArray<float4> g_mips[MaxMipLevels - 1];
+[[vk::binding(2, 0)]] globallycoherent RWStructuredBuffer<uint> g_counters;
+
+groupshared float4 s_tile[TileSize / 2][TileSize / 2];
+groupshared uint s_isLast;
+
+float4 encode(float4 c)
+{
+#if KRIS_MIPGEN_SRGB
+	c.rgb = lerp(c.rgb * 12.92, 1.055 * pow(c.rgb, 1.0 / 2.4) - 0.055, step(0.0031308, c.rgb));
+#endif
+	return c;
+}
+float4 decode(float4 c)
+{
+#if KRIS_MIPGEN_SRGB
+	c.rgb = lerp(c.rgb / 12.92, pow((c.rgb + 0.055) / 1.055, 2.4), step(0.04045, c.rgb));
+#endif
+	return c;
+}
+
+uint2 mipSize(uint mip)
+{
+	return max(pc.srcSize >> mip, uint2(1, 1));
+}
+
+void storeMip(uint mip, uint2 p, uint layer, float4 c)
+{
+	if (all(p < mipSize(mip)))
+		g_mips[mip - 1][uint3(p, layer)] = encode(c);
+}
+
+// s_tile holds 32x32 texels of mip `mip - 1`, reduces it in place down to 1x1 writing every level
+void reduceTile(uint2 tile, uint layer, uint mip, uint li)
+{
+	for (uint size = TileSize / 4; size != 0 && mip < pc.mipCount; size >>= 1, ++mip)
+	{
+		const uint2 t = uint2(li % size, li / size);
+		const bool active = li < size * size;
+
+		float4 c = float4(0, 0, 0, 0);
+		if (active)
+		{
+			const uint2 s = t * 2;
+			c = (s_tile[s.y][s.x] + s_tile[s.y][s.x + 1] + s_tile[s.y + 1][s.x] + s_tile[s.y + 1][s.x + 1]) * 0.25;
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if (active)
+		{
+			s_tile[t.y][t.x] = c;
+			storeMip(mip, tile * size + t, layer, c);
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+}
+
+[numthreads(WorkgroupSize, 1, 1)]
+void main(uint3 groupId : SV_GroupID, uint li : SV_GroupIndex)
+{
+	const uint layer = groupId.z;
+	const uint TileTexels = TileSize / 2;
+
+	// mip 1, bilinear sample in the middle of 2x2 texels of mip 0 averages them
+	for (uint i = 0; i < TileTexels * TileTexels / WorkgroupSize; ++i)
+	{
+		const uint ix = li + i * WorkgroupSize;
+		const uint2 t = uint2(ix % TileTexels, ix / TileTexels);
+		const uint2 p = groupId.xy * TileTexels + t;
+		const float2 uv = (float2(p * 2) + 1.0) * pc.invSrcSize;
+
+		const float4 c = g_src.SampleLevel(g_smplr, float3(uv, layer), 0);
+		s_tile[t.y][t.x] = c;
+		storeMip(1, p, layer, c);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// mips 2..6
+	reduceTile(groupId.xy, layer, 2, li);
+	if (pc.mipCount <= 7)
+		return;
+
+	// mip 6 of this tile must be visible to whichever workgroup reads it back
+	DeviceMemoryBarrierWithGroupSync();
+	if (li == 0)
+	{
+		uint prev;
+		InterlockedAdd(g_counters[layer], 1, prev);
+		s_isLast = (prev == pc.groupsPerLayer - 1) ? 1 : 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+	if (s_isLast == 0)
+		return;
+	if (li == 0)
+		g_counters[layer] = 0; // ready for the next dispatch
+
+	// mip 7 from mip 6 (64x64 at most), the whole layer is one tile from now on
+	const uint2 lastTexel = mipSize(6) - 1;
+	for (uint i = 0; i < TileTexels * TileTexels / WorkgroupSize; ++i)
+	{
+		const uint ix = li + i * WorkgroupSize;
+		const uint2 t = uint2(ix % TileTexels, ix / TileTexels);
+		const uint2 s0 = min(t * 2, lastTexel);
+		const uint2 s1 = min(t * 2 + 1, lastTexel);
+
+		const float4 c = (
+			decode(g_mips[5][uint3(s0.x, s0.y, layer)]) + decode(g_mips[5][uint3(s1.x, s0.y, layer)]) +
+			decode(g_mips[5][uint3(s0.x, s1.y, layer)]) + decode(g_mips[5][uint3(s1.x, s1.y, layer)])) * 0.25;
+		s_tile[t.y][t.x] = c;
+		storeMip(7, t, layer, c);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// mips 8..12
+	reduceTile(uint2(0, 0), layer, 8, li);
+}
+)===";
+	}
+
+	void MipGenerator::init(nbl::video::ILogicalDevice* device, nbl::system::ISystem* system, nbl::system::ILogger* logger,
+		ResourceAllocator* ra, nbl::video::ISemaphore* frameTimeline)
+	{
+		m_device = device;
+		m_logger = logger;
+		m_frameTimeline = frameTimeline;
+		m_compiler = nbl::core::make_smart_refctd_ptr<nbl::asset::CHLSLCompiler>(refctd<nbl::system::ISystem>(system));
+
+		// ds layout: mip 0, mips 1.., atomic counters
+		{
+			nbl::video::IGPUDescriptorSetLayout::SBinding bindings[3];
+			uint32_t b_ix = 0;
+			for (auto& b : bindings)
+			{
+				b.binding = b_ix++;
+				b.count = 1;
+				b.immutableSamplers = nullptr;
+				b.stageFlags = nbl::hlsl::ESS_COMPUTE;
+				b.createFlags = nbl::video::IGPUDescriptorSetLayout::SBinding::E_CREATE_FLAGS::ECF_NONE;
+			}
+			bindings[0].type = nbl::asset::IDescriptor::E_TYPE::ET_COMBINED_IMAGE_SAMPLER;
+			bindings[1].type = nbl::asset::IDescriptor::E_TYPE::ET_STORAGE_IMAGE;
+			bindings[1].count = MaxMipLevels - 1U;
+			bindings[2].type = nbl::asset::IDescriptor::E_TYPE::ET_STORAGE_BUFFER;
+
+			m_dsl = device->createDescriptorSetLayout({ bindings, 3 });
+			KRIS_ASSERT(m_dsl);
+		}
+
+		// ppln layout
+		{
+			nbl::asset::SPushConstantRange pcRange;
+			pcRange.stageFlags = nbl::hlsl::ESS_COMPUTE;
+			pcRange.offset = 0U;
+			pcRange.size = sizeof(PushConstants);
+
+			m_pplnLayout = device->createPipelineLayout({ &pcRange, 1 }, refctd(m_dsl));
+		}
+
+		// desc pool, sets are freed one by one as frames finish
+		{
+			nbl::video::IDescriptorPool::SCreateInfo ci = {};
+			ci.flags = nbl::video::IDescriptorPool::ECF_FREE_DESCRIPTOR_SET_BIT;
+			ci.maxSets = MaxSetsInFlight;
+			ci.maxDescriptorCount[(uint32_t)nbl::asset::IDescriptor::E_TYPE::ET_COMBINED_IMAGE_SAMPLER] = MaxSetsInFlight;
+			ci.maxDescriptorCount[(uint32_t)nbl::asset::IDescriptor::E_TYPE::ET_STORAGE_IMAGE] = MaxSetsInFlight * (MaxMipLevels - 1U);
+			ci.maxDescriptorCount[(uint32_t)nbl::asset::IDescriptor::E_TYPE::ET_STORAGE_BUFFER] = MaxSetsInFlight;
+
+			m_descPool = device->createDescriptorPool(ci);
+		}
+
+		// mip 1 is sampled in the middle of 2x2 texels of mip 0
+		{
+			nbl::video::IGPUSampler::SParams params;
+			params.TextureWrapU = nbl::video::IGPUSampler::ETC_CLAMP_TO_EDGE;
+			params.TextureWrapV = nbl::video::IGPUSampler::ETC_CLAMP_TO_EDGE;
+			params.TextureWrapW = nbl::video::IGPUSampler::ETC_CLAMP_TO_EDGE;
+			params.MinFilter = nbl::video::IGPUSampler::ETF_LINEAR;
+			params.MaxFilter = nbl::video::IGPUSampler::ETF_LINEAR;
+			params.MipmapMode = nbl::video::IGPUSampler::ESMM_NEAREST;
+			params.AnisotropicFilter = 0;
+
+			m_sampler = device->createSampler(params);
+		}
+
+		// counters
+		{
+			nbl::video::IGPUBuffer::SCreationParams ci = {};
+			ci.size = MaxLayers * sizeof(uint32_t);
+			ci.usage = nbl::core::bitflag(nbl::video::IGPUBuffer::EUF_STORAGE_BUFFER_BIT) | nbl::video::IGPUBuffer::EUF_TRANSFER_DST_BIT;
+			m_counters = ra->allocBuffer(device, std::move(ci), device->getPhysicalDevice()->getDeviceLocalMemoryTypeBits());
+			m_counters->getBuffer()->setObjectDebugName("MipGenerator counters");
+		}
+	}
+
+	void MipGenerator::adjustCreationParams(nbl::video::IGPUImage::SCreationParams& params)
+	{
+		params.usage |= nbl::core::bitflag(nbl::asset::IImage::EUF_STORAGE_BIT) | nbl::asset::IImage::EUF_SAMPLED_BIT;
+
+		// sRGB formats don't support storage, mips are written through UNORM views
+		const FormatInfo* info = findFormatInfo(params.format);
+		if (info && info->storageFormat != info->format)
+			params.flags |= nbl::core::bitflag(nbl::asset::IImage::ECF_MUTABLE_FORMAT_BIT) | nbl::asset::IImage::ECF_EXTENDED_USAGE_BIT;
+	}
+
+	bool MipGenerator::isSupported(const ImageResource* image)
+	{
+		const auto& params = image->getImage()->getCreationParameters();
+
+		const FormatInfo* info = findFormatInfo(params.format);
+		if (!info)
+			return false;
+		if (info->storageFormat != info->format && !params.flags.hasFlags(nbl::asset::IImage::ECF_MUTABLE_FORMAT_BIT))
+			return false;
+
+		return params.type == nbl::asset::IImage::ET_2D &&
+			params.usage.hasFlags(nbl::core::bitflag(nbl::asset::IImage::EUF_STORAGE_BIT) | nbl::asset::IImage::EUF_SAMPLED_BIT) &&
+			params.mipLevels > 1U && params.mipLevels <= MaxMipLevels &&
+			params.extent.width <= MaxExtent && params.extent.height <= MaxExtent &&
+			params.arrayLayers <= MaxLayers;
+	}
+
+	nbl::video::IGPUComputePipeline* MipGenerator::getPipeline(nbl::asset::E_FORMAT format)
+	{
+		auto found = m_pipelines.find((uint32_t)format);
+		if (found != m_pipelines.end())
+			return found->second.get();
+
+		// failures are cached too, so that compilation isn't retried over and over
+		refctd<nbl::video::IGPUComputePipeline>& pipeline = m_pipelines[(uint32_t)format];
+
+		const FormatInfo* info = findFormatInfo(format);
+		KRIS_ASSERT(info);
+
+		std::string hlsl = "#define KRIS_MIPGEN_FORMAT \"";
+		hlsl += info->hlslFormat;
+		hlsl += "\"\n#define KRIS_MIPGEN_SRGB ";
+		hlsl += info->srgb ? "1\n" : "0\n";
+		hlsl += ShaderSource;
+
+		nbl::asset::CHLSLCompiler::SOptions options = {};
+		options.stage = nbl::hlsl::ESS_COMPUTE;
+#if !KRIS_CFG_SHIPPING
+		options.debugInfoFlags |= nbl::asset::IShaderCompiler::E_DEBUG_INFO_FLAGS::EDIF_LINE_BIT;
+#endif
+		options.preprocessorOptions.sourceIdentifier = "kris_mip_generator.comp";
+		options.preprocessorOptions.logger = m_logger;
+		options.preprocessorOptions.includeFinder = m_compiler->getDefaultIncludeFinder();
+
+		auto cpushader = m_compiler->compileToSPIRV(hlsl, options);
+		if (!cpushader)
+			return nullptr;
+
+		auto shader = m_device->createShader(cpushader.get());
+
+		nbl::video::IGPUComputePipeline::SCreationParams params;
+		params.layout = m_pplnLayout.get();
+		params.shader.entryPoint = "main";
+		params.shader.shader = shader.get();
+
+		if (!m_device->createComputePipelines(nullptr, { &params,1 }, &pipeline))
+			pipeline = nullptr;
+
+		return pipeline.get();
+	}
+
+	bool MipGenerator::record(nbl::video::IGPUCommandBuffer* cmdbuf, ImageResource* image, uint64_t frameVal)
+	{
+		KRIS_ASSERT(isSupported(image));
+
+		const uint64_t completed = m_frameTimeline->getCounterValue();
+		while (!m_inflightSets.empty() && m_inflightSets.front().frameVal <= completed)
+		{
+			m_inflightSets.pop_front();
+		}
+
+		const auto& params = image->getImage()->getCreationParameters();
+		const FormatInfo* info = findFormatInfo(params.format);
+
+		nbl::video::IGPUComputePipeline* pipeline = getPipeline(params.format);
+		if (!pipeline)
+			return false;
+
+		auto ds = m_descPool->createDescriptorSet(refctd(m_dsl));
+		if (!ds)
+			return false;
+
+		// mip 0, mips 1.. and counters
+		nbl::video::IGPUDescriptorSet::SDescriptorInfo infos[MaxMipLevels + 1U];
+		nbl::video::IGPUDescriptorSet::SWriteDescriptorSet writes[3];
+		{
+			const uint32_t layers = params.arrayLayers;
+
+			infos[0].desc = image->getView(m_device, nbl::video::IGPUImageView::ET_2D_ARRAY, params.format, nbl::asset::IImage::EAF_COLOR_BIT, 0U, 1U, 0U, layers);
+			infos[0].info.combinedImageSampler.imageLayout = nbl::video::IGPUImage::LAYOUT::GENERAL;
+			infos[0].info.combinedImageSampler.sampler = m_sampler;
+			for (uint32_t i = 1U; i < MaxMipLevels; ++i)
+			{
+				// elements past the last mip alias it, they're never written
+				const uint32_t mip = std::min(i, params.mipLevels - 1U);
+				infos[i].desc = image->getView(m_device, nbl::video::IGPUImageView::ET_2D_ARRAY, info->storageFormat, nbl::asset::IImage::EAF_COLOR_BIT, mip, 1U, 0U, layers);
+				infos[i].info.image.imageLayout = nbl::video::IGPUImage::LAYOUT::GENERAL;
+			}
+			infos[MaxMipLevels].desc = refctd<nbl::video::IGPUBuffer>(m_counters->getBuffer());
+			infos[MaxMipLevels].info.buffer = { .offset = m_counters->getOffset(),.size = m_counters->getSize() };
+
+			writes[0] = { .dstSet = ds.get(), .binding = 0U, .arrayElement = 0U, .count = 1U, .info = infos };
+			writes[1] = { .dstSet = ds.get(), .binding = 1U, .arrayElement = 0U, .count = MaxMipLevels - 1U, .info = infos + 1 };
+			writes[2] = { .dstSet = ds.get(), .binding = 2U, .arrayElement = 0U, .count = 1U, .info = infos + MaxMipLevels };
+			m_device->updateDescriptorSets({ writes, 3 }, {});
+		}
+
+		const uint32_t groupsX = (params.extent.width + TileSize - 1U) / TileSize;
+		const uint32_t groupsY = (params.extent.height + TileSize - 1U) / TileSize;
+
+		PushConstants pc;
+		pc.srcWidth = params.extent.width;
+		pc.srcHeight = params.extent.height;
+		pc.invSrcWidth = 1.f / (float)params.extent.width;
+		pc.invSrcHeight = 1.f / (float)params.extent.height;
+		pc.mipCount = params.mipLevels;
+		pc.groupsPerLayer = groupsX * groupsY;
+
+		const nbl::video::IGPUDescriptorSet* sets[1] = { ds.get() };
+		cmdbuf->bindComputePipeline(pipeline);
+		cmdbuf->bindDescriptorSets(nbl::asset::EPBP_COMPUTE, m_pplnLayout.get(), 0U, 1U, sets);
+		cmdbuf->pushConstants(m_pplnLayout.get(), nbl::hlsl::ESS_COMPUTE, 0U, sizeof(pc), &pc);
+		cmdbuf->dispatch(groupsX, groupsY, params.arrayLayers);
+
+		m_inflightSets.push_back({ frameVal, std::move(ds) });
+		return true;
+	}
+}
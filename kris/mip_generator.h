@@ -0,0 +1,81 @@
+#pragma once
+
+#include "kris_common.h"
+#include "resource_allocator.h"
+
+namespace kris
+{
+	// Generates whole mip chain of an image from its mip 0 in a single compute dispatch (single-pass downsampler).
+	// Every workgroup reduces 64x64 tile of mip 0 down to mip 6 in shared memory, the last workgroup finishing a layer
+	// (atomic counter per layer) carries on with mip 7 and further, reading mip 6 back.
+	// Supported are 2D (array, cube) images up to MaxExtent of a few uncompressed formats (see isSupported()),
+	// sRGB ones are written through UNORM views so they need creation params adjusted (see adjustCreationParams()).
+	// Recorded through CommandRecorder::generateMips(), which does barriers and layout transitions.
+	class MipGenerator
+	{
+	public:
+		enum : uint32_t
+		{
+			MaxMipLevels = 13U,
+			MaxExtent = 1U << (MaxMipLevels - 1U), // 4096, so that mip 6 fits into tile of the last workgroup
+			MaxLayers = 2048U,
+			TileSize = 64U, // mip 0 texels per workgroup in each dimension
+
+			MaxSetsInFlight = 64U,
+		};
+
+		MipGenerator() = default;
+
+		// Shaders are compiled on first use of every format. `frameTimeline` is Renderer's frame semaphore,
+		// descriptor sets of dispatches are recycled with it.
+		void init(nbl::video::ILogicalDevice* device, nbl::system::ISystem* system, nbl::system::ILogger* logger,
+			ResourceAllocator* ra, nbl::video::ISemaphore* frameTimeline);
+
+		// Adds storage and sampled usage, sRGB images also get mutable format and extended usage flags
+		static void adjustCreationParams(nbl::video::IGPUImage::SCreationParams& params);
+		static bool isSupported(const ImageResource* image);
+
+		BufferResource* getCounterBuffer() const { return m_counters.get(); }
+		// Counters must be zeroed once before first dispatch, the shader keeps them zeroed afterwards
+		bool needsCounterClear() const { return !m_countersCleared; }
+		void onCountersCleared() { m_countersCleared = true; }
+
+		// Only binds and dispatches, image must be already in GENERAL layout. `frameVal` as in CommandRecorder.
+		// Returns false if the image's format pipeline couldn't be created or no descriptor set is available.
+		bool record(nbl::video::IGPUCommandBuffer* cmdbuf, ImageResource* image, uint64_t frameVal);
+
+	private:
+		struct PushConstants
+		{
+			uint32_t srcWidth;
+			uint32_t srcHeight;
+			float invSrcWidth;
+			float invSrcHeight;
+			uint32_t mipCount;
+			uint32_t groupsPerLayer;
+		};
+
+		struct InflightSet
+		{
+			uint64_t frameVal;
+			refctd<nbl::video::IGPUDescriptorSet> ds;
+		};
+
+		nbl::video::IGPUComputePipeline* getPipeline(nbl::asset::E_FORMAT format);
+
+		nbl::video::ILogicalDevice* m_device = nullptr;
+		nbl::system::ILogger* m_logger = nullptr;
+		nbl::video::ISemaphore* m_frameTimeline = nullptr;
+		refctd<nbl::asset::CHLSLCompiler> m_compiler;
+
+		refctd<nbl::video::IGPUDescriptorSetLayout> m_dsl;
+		refctd<nbl::video::IGPUPipelineLayout> m_pplnLayout;
+		refctd<nbl::video::IDescriptorPool> m_descPool;
+		refctd<nbl::video::IGPUSampler> m_sampler;
+		refctd<BufferResource> m_counters;
+		bool m_countersCleared = false;
+
+		nbl::core::unordered_map<uint32_t, refctd<nbl::video::IGPUComputePipeline>> m_pipelines; // per storage format
+		nbl::core::deque<InflightSet> m_inflightSets;
+	};
+}
@@ -92,48 +92,11 @@ namespace kris::base_pass
 
 	bool createPassResources(PassResources* resources, 
 		nbl::video::ILogicalDevice* device, 
-		ResourceAllocator* ra, 
-		ImageResource* colorimages[FramesInFlight],
-		ImageResource* depthimage,
-		uint32_t width, uint32_t height)
+		nbl::asset::E_FORMAT colorFormat,
+		nbl::asset::E_FORMAT depthFormat)
 	{
-		const nbl::asset::E_FORMAT format = colorimages[0]->getImage()->getCreationParameters().format;
-		KRIS_ASSERT(depthimage);
-		const nbl::asset::E_FORMAT depthFormat = depthimage->getImage()->getCreationParameters().format;
+		resources->m_renderpass = createRenderpass(device, colorFormat, depthFormat);
 
-		resources->m_renderpass = createRenderpass(device, format, depthFormat);
-
-		for (uint32_t i = 0U; i < FramesInFlight; ++i)
-		{
-			auto& fb = resources->m_fb[i];
-
-			fb.m_colorCount = 1U;
-			fb.m_colors[0] = refctd<ImageResource>(colorimages[i]);
-			fb.m_depth = refctd<ImageResource>(depthimage);
-
-			auto colorview = fb.m_colors[0]->getView(
-				device,
-				nbl::video::IGPUImageView::ET_2D,
-				fb.m_colors[0]->getImage()->getCreationParameters().format,
-				nbl::video::IGPUImage::EAF_COLOR_BIT,
-				0, 1, 0, 1);
-			auto depthview = fb.m_depth->getView(
-				device,
-				nbl::video::IGPUImageView::ET_2D,
-				fb.m_depth->getImage()->getCreationParameters().format,
-				nbl::video::IGPUImage::EAF_DEPTH_BIT,
-				0, 1, 0, 1);
-
-			nbl::video::IGPUFramebuffer::SCreationParams ci;
-			ci.width = width;
-			ci.height = height;
-			ci.renderpass = resources->m_renderpass;
-			ci.colorAttachments = &colorview.get();
-			ci.depthStencilAttachments = &depthview.get();
-
-			fb.m_fb = device->createFramebuffer(std::move(ci));
-		}
-
-		return true;
+		return resources->m_renderpass != nullptr;
 	}
 }
\ No newline at end of file
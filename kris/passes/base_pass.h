@@ -9,8 +9,6 @@ namespace kris::base_pass
 {
 	bool createPassResources(PassResources* resources, 
 		nbl::video::ILogicalDevice* device, 
-		ResourceAllocator* alctr, 
-		ImageResource* colorimages[FramesInFlight],
-		ImageResource* depthimage,
-		uint32_t width, uint32_t height);
+		nbl::asset::E_FORMAT colorFormat,
+		nbl::asset::E_FORMAT depthFormat);
 }
\ No newline at end of file
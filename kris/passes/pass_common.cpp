@@ -2,6 +2,66 @@
 
 namespace kris
 {
+	const Framebuffer& PassResources::getFramebuffer(nbl::video::ILogicalDevice* device,
+		ImageResource* const* colors, uint32_t colorCount, ImageResource* depth,
+		uint32_t width, uint32_t height)
+	{
+		KRIS_ASSERT(colorCount <= MaxColorBuffers);
+
+		for (const Framebuffer& fb : m_fbCache)
+		{
+			if (fb.m_colorCount != colorCount || fb.m_depth.get() != depth)
+				continue;
+
+			bool match = true;
+			for (uint32_t i = 0U; i < colorCount && match; ++i)
+				match = (fb.m_colors[i].get() == colors[i]);
+			if (match)
+				return fb;
+		}
+
+		// command buffers keep framebuffers they use alive, dropping ones still in flight is fine
+		if (m_fbCache.size() >= MaxCachedFramebuffers)
+			m_fbCache.pop_front();
+
+		Framebuffer& fb = m_fbCache.emplace_back();
+		fb.m_colorCount = colorCount;
+
+		refctd<nbl::video::IGPUImageView> colorviews[MaxColorBuffers];
+		for (uint32_t i = 0U; i < colorCount; ++i)
+		{
+			fb.m_colors[i] = refctd<ImageResource>(colors[i]);
+			colorviews[i] = colors[i]->getView(
+				device,
+				nbl::video::IGPUImageView::ET_2D,
+				colors[i]->getImage()->getCreationParameters().format,
+				nbl::video::IGPUImage::EAF_COLOR_BIT,
+				0, 1, 0, 1);
+		}
+		refctd<nbl::video::IGPUImageView> depthview;
+		if (depth)
+		{
+			fb.m_depth = refctd<ImageResource>(depth);
+			depthview = depth->getView(
+				device,
+				nbl::video::IGPUImageView::ET_2D,
+				depth->getImage()->getCreationParameters().format,
+				nbl::video::IGPUImage::EAF_DEPTH_BIT,
+				0, 1, 0, 1);
+		}
+
+		nbl::video::IGPUFramebuffer::SCreationParams ci;
+		ci.width = width;
+		ci.height = height;
+		ci.renderpass = m_renderpass;
+		ci.colorAttachments = &colorviews[0].get();
+		ci.depthStencilAttachments = depth ? &depthview.get() : nullptr;
+
+		fb.m_fb = device->createFramebuffer(std::move(ci));
+
+		return fb;
+	}
+
 	refctd<nbl::video::IGPUGraphicsPipeline> PassResources::createGfxPipeline(
 		nbl::video::ILogicalDevice* device,
 		const nbl::video::IGPUPipelineLayout* layout,
@@ -15,8 +15,19 @@ namespace kris
 	};
 	struct PassResources
 	{
-		Framebuffer m_fb[FramesInFlight];
+		enum : uint32_t
+		{
+			MaxCachedFramebuffers = 4U * FramesInFlight,
+		};
+
 		refctd<nbl::video::IGPURenderpass> m_renderpass;
+		// Attachments come from RenderGraph and may change between frames (transient images), so framebuffers are created
+		// on first use of attachment combination and the oldest ones are dropped once there's too many.
+		nbl::core::deque<Framebuffer> m_fbCache;
+
+		const Framebuffer& getFramebuffer(nbl::video::ILogicalDevice* device,
+			ImageResource* const* colors, uint32_t colorCount, ImageResource* depth,
+			uint32_t width, uint32_t height);
 
 		refctd<nbl::video::IGPUGraphicsPipeline> createGfxPipeline(
 			nbl::video::ILogicalDevice* device,
@@ -27,8 +38,6 @@ namespace kris
 
 	using createPassResources_fptr_t = bool(*)(PassResources* resources,
 		nbl::video::ILogicalDevice* device,
-		ResourceAllocator* alctr,
-		ImageResource* colorimages[FramesInFlight],
-		ImageResource* depthimage,
-		uint32_t width, uint32_t height);
+		nbl::asset::E_FORMAT colorFormat,
+		nbl::asset::E_FORMAT depthFormat);
 }
\ No newline at end of file
@@ -0,0 +1,414 @@
+#include "render_graph.h"
+
+#include "renderer.h"
+
+namespace kris
+{
+	namespace
+	{
+		// only orders placement, so that the biggest image of a memory slot gets to own it
+		size_t estimateImageSize(const RenderGraph::ImageDesc& desc)
+		{
+			const size_t size = (size_t)desc.width * desc.height * desc.arrayLayers * nbl::asset::getTexelOrBlockBytesize(desc.format);
+			return desc.mipLevels > 1U ? size * 4ULL / 3ULL : size;
+		}
+
+		nbl::video::IGPUImage::SCreationParams makeCreationParams(const RenderGraph::ImageDesc& desc)
+		{
+			nbl::video::IGPUImage::SCreationParams ci = {};
+			ci.type = nbl::video::IGPUImage::ET_2D;
+			ci.samples = nbl::video::IGPUImage::ESCF_1_BIT;
+			ci.format = desc.format;
+			ci.extent = { desc.width, desc.height, 1U };
+			ci.mipLevels = desc.mipLevels;
+			ci.arrayLayers = desc.arrayLayers;
+			if (nbl::asset::isDepthOrStencilFormat(desc.format))
+				ci.depthUsage = desc.usage;
+			else
+				ci.usage = desc.usage;
+			return ci;
+		}
+	}
+
+	void RenderGraph::init(nbl::video::ILogicalDevice* device, ResourceAllocator* ra)
+	{
+		m_device = device;
+		m_ra = ra;
+		m_passes.reserve(MaxPasses);
+		m_resources.reserve(MaxResources);
+	}
+
+	void RenderGraph::reset()
+	{
+		m_passes.clear();
+		m_resources.clear();
+		m_compiled = false;
+		m_stats = {};
+
+		const uint64_t completed = m_ra->getCompletedFrame();
+		while (!m_retired.empty() && m_retired.front().frameVal <= completed)
+		{
+			m_retired.pop_front();
+		}
+	}
+
+	RenderGraph::ResourceId RenderGraph::importImage(ImageResource* image, nbl::video::IGPUImage::LAYOUT finalLayout)
+	{
+		for (uint32_t i = 0U; i < (uint32_t)m_resources.size(); ++i)
+		{
+			if (m_resources[i].imported == image)
+			{
+				m_resources[i].finalLayout = finalLayout;
+				return { i };
+			}
+		}
+
+		KRIS_ASSERT(m_resources.size() < MaxResources);
+		VirtualResource& res = m_resources.emplace_back();
+		res.imported = image;
+		res.finalLayout = finalLayout;
+		return { (uint32_t)m_resources.size() - 1U };
+	}
+
+	RenderGraph::ResourceId RenderGraph::importBuffer(BufferResource* buffer)
+	{
+		for (uint32_t i = 0U; i < (uint32_t)m_resources.size(); ++i)
+		{
+			if (m_resources[i].imported == buffer)
+				return { i };
+		}
+
+		KRIS_ASSERT(m_resources.size() < MaxResources);
+		VirtualResource& res = m_resources.emplace_back();
+		res.imported = buffer;
+		return { (uint32_t)m_resources.size() - 1U };
+	}
+
+	RenderGraph::ResourceId RenderGraph::createImage(const ImageDesc& desc)
+	{
+		KRIS_ASSERT(m_resources.size() < MaxResources);
+		KRIS_ASSERT(desc.format != nbl::asset::EF_UNKNOWN && desc.width && desc.height);
+
+		VirtualResource& res = m_resources.emplace_back();
+		res.desc = desc;
+		return { (uint32_t)m_resources.size() - 1U };
+	}
+
+	RenderGraph::PassBuilder RenderGraph::addPass(const char* name, EPass pass, execute_fn_t&& execute)
+	{
+		KRIS_ASSERT(!m_compiled);
+		KRIS_ASSERT(m_passes.size() < MaxPasses);
+
+		Pass& p = m_passes.emplace_back();
+		p.name = name;
+		p.pass = pass;
+		p.execute = std::move(execute);
+		return PassBuilder(this, (uint32_t)m_passes.size() - 1U);
+	}
+
+	void RenderGraph::addAccess(uint32_t passIx, ResourceId res, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages,
+		nbl::video::IGPUImage::LAYOUT layout, bool write)
+	{
+		KRIS_ASSERT(res.isValid() && res.index < m_resources.size());
+		// transients have no layout to keep
+		KRIS_ASSERT_MSG(m_resources[res.index].imported || layout != nbl::video::IGPUImage::LAYOUT::UNDEFINED, "Transient image access must specify layout!");
+
+		Pass& p = m_passes[passIx];
+		for (uint32_t i = 0U; i < p.accessCount; ++i)
+		{
+			Access& a = p.accesses[i];
+			if (a.resIx != res.index)
+				continue;
+
+			// one barrier per resource and pass, so the pass sees it in one layout
+			KRIS_ASSERT_MSG(a.layout == layout, "Pass %s accesses resource in two layouts!", p.name);
+			a.access |= access;
+			a.stages |= stages;
+			a.read |= !write;
+			a.write |= write;
+			return;
+		}
+
+		KRIS_ASSERT(p.accessCount < MaxAccessesPerPass);
+		p.accesses[p.accessCount++] = Access{
+			.resIx = res.index,
+			.access = access,
+			.stages = stages,
+			.layout = layout,
+			.read = !write,
+			.write = write
+		};
+	}
+
+	bool RenderGraph::compile()
+	{
+		KRIS_ASSERT(!m_compiled);
+
+		m_stats.passCount = (uint32_t)m_passes.size();
+		cull();
+
+		// lifetimes in surviving passes
+		for (uint32_t passIx = 0U; passIx < (uint32_t)m_passes.size(); ++passIx)
+		{
+			const Pass& p = m_passes[passIx];
+			if (p.culled)
+				continue;
+
+			for (uint32_t i = 0U; i < p.accessCount; ++i)
+			{
+				VirtualResource& res = m_resources[p.accesses[i].resIx];
+				if (res.firstPass == InvalidIx)
+					res.firstPass = passIx;
+				res.lastPass = passIx;
+			}
+		}
+
+		if (!placeTransients())
+			return false;
+
+		m_compiled = true;
+		return true;
+	}
+
+	// Backwards: pass survives if it has side effects or writes something a surviving pass after it reads (or an imported resource)
+	void RenderGraph::cull()
+	{
+		bool needed[MaxResources];
+		for (uint32_t i = 0U; i < (uint32_t)m_resources.size(); ++i)
+			needed[i] = (m_resources[i].imported != nullptr);
+
+		for (uint32_t passIx = (uint32_t)m_passes.size(); passIx-- > 0U;)
+		{
+			Pass& p = m_passes[passIx];
+
+			bool alive = p.sideEffects;
+			for (uint32_t i = 0U; i < p.accessCount && !alive; ++i)
+				alive = p.accesses[i].write && needed[p.accesses[i].resIx];
+
+			p.culled = !alive;
+			if (!alive)
+			{
+				m_stats.culledPassCount++;
+				continue;
+			}
+
+			for (uint32_t i = 0U; i < p.accessCount; ++i)
+			{
+				const Access& a = p.accesses[i];
+				// overwritten, whatever was written before doesn't matter
+				if (a.write && !a.read && !m_resources[a.resIx].imported)
+					needed[a.resIx] = false;
+			}
+			for (uint32_t i = 0U; i < p.accessCount; ++i)
+			{
+				const Access& a = p.accesses[i];
+				if (a.read)
+					needed[a.resIx] = true;
+			}
+		}
+	}
+
+	// Transients whose lifetimes don't overlap share memory. Placement is kept across frames as long as descriptions
+	// and lifetimes of all the transients stay the same, otherwise everything is placed anew.
+	bool RenderGraph::placeTransients()
+	{
+		nbl::core::vector<uint32_t> transients;
+		for (uint32_t i = 0U; i < (uint32_t)m_resources.size(); ++i)
+		{
+			if (!m_resources[i].imported && m_resources[i].firstPass != InvalidIx)
+				transients.push_back(i);
+		}
+		m_stats.transientCount = (uint32_t)transients.size();
+
+		bool reuse = (transients.size() == m_physical.size());
+		for (uint32_t i = 0U; i < (uint32_t)transients.size() && reuse; ++i)
+		{
+			const VirtualResource& res = m_resources[transients[i]];
+			const PhysicalImage& ph = m_physical[i];
+			reuse = (ph.desc == res.desc) && ph.firstPass == res.firstPass && ph.lastPass == res.lastPass;
+		}
+
+		if (!reuse)
+		{
+			retirePhysical();
+
+			m_physical.resize(transients.size());
+			for (uint32_t i = 0U; i < (uint32_t)transients.size(); ++i)
+			{
+				const VirtualResource& res = m_resources[transients[i]];
+				m_physical[i].desc = res.desc;
+				m_physical[i].firstPass = res.firstPass;
+				m_physical[i].lastPass = res.lastPass;
+				m_physical[i].slotIx = InvalidIx;
+			}
+
+			nbl::core::vector<uint32_t> order(transients.size());
+			for (uint32_t i = 0U; i < (uint32_t)order.size(); ++i)
+				order[i] = i;
+			std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+				{
+					return estimateImageSize(m_physical[a].desc) > estimateImageSize(m_physical[b].desc);
+				});
+
+			for (uint32_t phIx : order)
+			{
+				PhysicalImage& ph = m_physical[phIx];
+
+				for (uint32_t slotIx = 0U; slotIx < (uint32_t)m_slots.size() && !ph.image; ++slotIx)
+				{
+					bool overlaps = false;
+					for (const PhysicalImage& other : m_physical)
+					{
+						if (other.slotIx == slotIx && !(other.lastPass < ph.firstPass || ph.lastPass < other.firstPass))
+						{
+							overlaps = true;
+							break;
+						}
+					}
+					if (overlaps)
+						continue;
+
+					ph.image = m_ra->allocAliasedImage(m_device, makeCreationParams(ph.desc), m_slots[slotIx].owner.get());
+					if (ph.image)
+						ph.slotIx = slotIx;
+				}
+
+				if (!ph.image)
+				{
+					ph.image = m_ra->allocImage(m_device, makeCreationParams(ph.desc), m_device->getPhysicalDevice()->getDeviceLocalMemoryTypeBits(),
+						ResourceAllocator::AllocFlags::Aliasable);
+					if (!ph.image)
+						return false;
+
+					ph.slotIx = (uint32_t)m_slots.size();
+					m_slots.push_back({ .owner = ph.image, .lastUser = nullptr });
+				}
+			}
+		}
+
+		for (uint32_t i = 0U; i < (uint32_t)transients.size(); ++i)
+			m_resources[transients[i]].physicalIx = i;
+
+		m_stats.physicalImageCount = (uint32_t)m_slots.size();
+		for (const MemorySlot& slot : m_slots)
+			m_stats.transientBytes += slot.owner->getSize();
+
+		return true;
+	}
+
+	// Aliases are marked used through their owners, so owners tell when GPU is done with the whole slot
+	void RenderGraph::retirePhysical()
+	{
+		if (m_slots.empty())
+		{
+			m_physical.clear();
+			return;
+		}
+
+		Retired& r = m_retired.emplace_back();
+		r.frameVal = 0ULL;
+		for (const MemorySlot& slot : m_slots)
+			r.frameVal = std::max(r.frameVal, m_ra->getLastUsedFrame(slot.owner->getHandle()));
+		r.physical = std::move(m_physical);
+		r.slots = std::move(m_slots);
+
+		m_physical.clear();
+		m_slots.clear();
+	}
+
+	void RenderGraph::execute(Renderer* renderer)
+	{
+		KRIS_ASSERT(m_compiled);
+
+		for (uint32_t passIx = 0U; passIx < (uint32_t)m_passes.size(); ++passIx)
+		{
+			Pass& p = m_passes[passIx];
+			if (p.culled)
+				continue;
+
+			CommandRecorder cmdrec = renderer->createCommandRecorder(p.pass);
+			cmdrec.graphScope = ++m_lastScope;
+			// declared barriers are merged with the ones the pass pushes during its setup
+			cmdrec.beginSetup();
+
+			// barriers of all declared accesses at once
+			for (uint32_t i = 0U; i < p.accessCount; ++i)
+			{
+				const Access& a = p.accesses[i];
+				const VirtualResource& res = m_resources[a.resIx];
+
+				if (res.imported)
+				{
+					if (res.imported->isBuffer())
+						m_stats.barrierCount += cmdrec.declareAccess(static_cast<BufferResource*>(res.imported), a.access, a.stages);
+					else
+						m_stats.barrierCount += cmdrec.declareAccess(static_cast<ImageResource*>(res.imported), a.access, a.stages, a.layout);
+					continue;
+				}
+
+				const PhysicalImage& ph = m_physical[res.physicalIx];
+				MemorySlot& slot = m_slots[ph.slotIx];
+				ImageResource* const image = ph.image.get();
+				if (res.firstPass == passIx)
+				{
+					// contents are discarded, but the memory may still be accessed through image which used it before
+					ImageResource::SubresourceState state = { image->lastAccesses, image->lastStages, nbl::video::IGPUImage::LAYOUT::UNDEFINED };
+					if (slot.lastUser && slot.lastUser != image)
+					{
+						state.accesses = slot.lastUser->lastAccesses;
+						state.stages = slot.lastUser->lastStages;
+					}
+					image->setState(state);
+					slot.lastUser = image;
+				}
+				cmdrec.markUsed(slot.owner.get());
+				m_stats.barrierCount += cmdrec.declareAccess(image, a.access, a.stages, a.layout);
+			}
+
+			p.execute(cmdrec, *this);
+
+			// imported images leave the graph in requested layout
+			for (uint32_t i = 0U; i < p.accessCount; ++i)
+			{
+				const VirtualResource& res = m_resources[p.accesses[i].resIx];
+				if (res.imported && !res.imported->isBuffer() && res.lastPass == passIx &&
+					res.finalLayout != nbl::video::IGPUImage::LAYOUT::UNDEFINED)
+				{
+					cmdrec.transitionLayout(static_cast<ImageResource*>(res.imported), res.finalLayout);
+				}
+			}
+			cmdrec.endSetup();
+
+			p.barrierStats = cmdrec.barrierStats;
+			m_stats.barrierCommandCount += cmdrec.barrierStats.commands;
+			m_stats.barrierEntryCount += cmdrec.barrierStats.entries;
+			m_stats.coveredBarrierCount += cmdrec.barrierStats.coveredByGraph;
+			m_stats.gatheredCommandCount += cmdrec.barrierStats.gatheredCommands;
+
+			renderer->consumeAsPass(std::move(cmdrec));
+		}
+	}
+
+	ImageResource* RenderGraph::getImage(ResourceId res) const
+	{
+		KRIS_ASSERT(res.isValid() && res.index < m_resources.size());
+
+		const VirtualResource& vr = m_resources[res.index];
+		if (vr.imported)
+		{
+			KRIS_ASSERT(!vr.imported->isBuffer());
+			return static_cast<ImageResource*>(vr.imported);
+		}
+		KRIS_ASSERT(vr.physicalIx != InvalidIx);
+		return m_physical[vr.physicalIx].image.get();
+	}
+
+	BufferResource* RenderGraph::getBuffer(ResourceId res) const
+	{
+		KRIS_ASSERT(res.isValid() && res.index < m_resources.size());
+
+		const VirtualResource& vr = m_resources[res.index];
+		KRIS_ASSERT(vr.imported && vr.imported->isBuffer());
+		return static_cast<BufferResource*>(vr.imported);
+	}
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "kris_common.h"
+#include "resource_allocator.h"
+#include "cmd_recorder.h"
+
+namespace kris
+{
+	class Renderer;
+
+	// Frame graph: passes declare resources they read and write instead of finding barriers as their commands are recorded.
+	// compile() culls passes whose results nobody consumes and places transient images (created by the graph) into shared memory
+	// wherever their lifetimes within the frame don't overlap. execute() records every pass into its own command buffer, with
+	// barriers of all the pass's declared accesses gathered together with the ones of its setup and emitted in one command before
+	// its render pass or first dispatch/copy (see CommandRecorder::beginSetup()). Barriers pushed by the pass's own recording
+	// are skipped for declared resources (see CommandRecorder::graphScope).
+	// The graph is declared anew every frame (reset(), addPass()..., compile(), execute()), transient images survive
+	// as long as their descriptions and placement don't change.
+	// Passes run in declaration order, which is the order their dependencies are declared in.
+	class RenderGraph
+	{
+	public:
+		enum : uint32_t
+		{
+			MaxPasses = 32U,
+			MaxResources = 64U,
+			MaxAccessesPerPass = 16U,
+
+			InvalidIx = ~0U,
+		};
+
+		struct ResourceId
+		{
+			uint32_t index = InvalidIx;
+
+			bool isValid() const { return index != InvalidIx; }
+		};
+
+		// Transient image, contents are undefined at its first use in a frame
+		struct ImageDesc
+		{
+			nbl::asset::E_FORMAT format = nbl::asset::EF_UNKNOWN;
+			uint32_t width = 0U;
+			uint32_t height = 0U;
+			uint32_t mipLevels = 1U;
+			uint32_t arrayLayers = 1U;
+			nbl::core::bitflag<nbl::asset::IImage::E_USAGE_FLAGS> usage = nbl::asset::IImage::EUF_NONE;
+
+			bool operator==(const ImageDesc& rhs) const
+			{
+				return format == rhs.format && width == rhs.width && height == rhs.height &&
+					mipLevels == rhs.mipLevels && arrayLayers == rhs.arrayLayers && usage == rhs.usage;
+			}
+		};
+
+		struct Stats
+		{
+			uint32_t passCount = 0U; // declared
+			uint32_t culledPassCount = 0U;
+			uint32_t barrierCount = 0U; // barriers emitted for declared accesses
+			uint32_t barrierCommandCount = 0U; // pipeline barrier commands recorded by all passes
+			uint32_t barrierEntryCount = 0U; // barriers in them
+			// extra barriers and commands per-draw barriers would have recorded (see CommandRecorder::BarrierStats)
+			uint32_t coveredBarrierCount = 0U;
+			uint32_t gatheredCommandCount = 0U;
+			uint32_t transientCount = 0U;
+			uint32_t physicalImageCount = 0U; // memory owners of transient images
+			size_t transientBytes = 0ULL; // memory of transient images, aliases share it with owners
+		};
+
+		using execute_fn_t = std::function<void(CommandRecorder& cmdrec, const RenderGraph& graph)>;
+
+		// Declares accesses of the pass. Write without read means the pass overwrites the resource, previous contents don't matter then
+		// (render target with LOAD_OP::CLEAR), so passes writing it before aren't kept just for this pass. Attachments loaded or blended
+		// into must be declared as read as well.
+		class PassBuilder
+		{
+		public:
+			PassBuilder& reads(ResourceId res, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages,
+				nbl::video::IGPUImage::LAYOUT layout = nbl::video::IGPUImage::LAYOUT::UNDEFINED)
+			{
+				m_graph->addAccess(m_passIx, res, access, stages, layout, false);
+				return *this;
+			}
+			PassBuilder& writes(ResourceId res, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages,
+				nbl::video::IGPUImage::LAYOUT layout = nbl::video::IGPUImage::LAYOUT::UNDEFINED)
+			{
+				m_graph->addAccess(m_passIx, res, access, stages, layout, true);
+				return *this;
+			}
+			// Pass is never culled (e.g. readbacks, work whose results are consumed outside of resources known to the graph)
+			PassBuilder& sideEffects()
+			{
+				m_graph->m_passes[m_passIx].sideEffects = true;
+				return *this;
+			}
+
+		private:
+			friend class RenderGraph;
+
+			PassBuilder(RenderGraph* graph, uint32_t passIx) : m_graph(graph), m_passIx(passIx) {}
+
+			RenderGraph* m_graph;
+			uint32_t m_passIx;
+		};
+
+		RenderGraph() = default;
+
+		void init(nbl::video::ILogicalDevice* device, ResourceAllocator* ra);
+
+		// Drops declarations of previous frame, transient images are kept for reuse
+		void reset();
+
+		// Imported resources outlive the frame, so passes writing them are never culled.
+		// Image is transitioned to `finalLayout` (unless UNDEFINED) after the last pass using it, e.g. PRESENT_SRC.
+		ResourceId importImage(ImageResource* image, nbl::video::IGPUImage::LAYOUT finalLayout = nbl::video::IGPUImage::LAYOUT::UNDEFINED);
+		ResourceId importBuffer(BufferResource* buffer);
+		ResourceId createImage(const ImageDesc& desc);
+
+		// `pass` selects material pipelines and render pass the pass records with (see Renderer::createCommandRecorder())
+		PassBuilder addPass(const char* name, EPass pass, execute_fn_t&& execute);
+
+		// Orders and culls passes, places transient images. Returns false if transient image couldn't be created.
+		bool compile();
+		// Records passes which survived compile() and hands their command buffers to `renderer` in order
+		void execute(Renderer* renderer);
+
+		// Valid during execute() (in pass callbacks)
+		ImageResource* getImage(ResourceId res) const;
+		BufferResource* getBuffer(ResourceId res) const;
+
+		const Stats& getStats() const { return m_stats; }
+		// Per declared pass, valid after execute() (zero for culled passes)
+		uint32_t getPassCount() const { return (uint32_t)m_passes.size(); }
+		const char* getPassName(uint32_t passIx) const { return m_passes[passIx].name; }
+		const CommandRecorder::BarrierStats& getPassBarrierStats(uint32_t passIx) const { return m_passes[passIx].barrierStats; }
+
+	private:
+		struct Access
+		{
+			uint32_t resIx;
+			nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access;
+			nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages;
+			nbl::video::IGPUImage::LAYOUT layout;
+			bool read;
+			bool write;
+		};
+
+		struct Pass
+		{
+			const char* name;
+			EPass pass;
+			execute_fn_t execute;
+			Access accesses[MaxAccessesPerPass];
+			uint32_t accessCount = 0U;
+			bool sideEffects = false;
+			bool culled = false;
+			CommandRecorder::BarrierStats barrierStats;
+		};
+
+		struct VirtualResource
+		{
+			Resource* imported = nullptr; // null for transients
+			ImageDesc desc; // transients only
+			nbl::video::IGPUImage::LAYOUT finalLayout = nbl::video::IGPUImage::LAYOUT::UNDEFINED;
+			uint32_t firstPass = InvalidIx; // lifetime in surviving passes
+			uint32_t lastPass = InvalidIx;
+			uint32_t physicalIx = InvalidIx; // transients only, index into m_physical
+		};
+
+		// Transient image and the memory slot it lives in, images of one slot alias the slot owner's memory
+		struct PhysicalImage
+		{
+			ImageDesc desc;
+			uint32_t firstPass;
+			uint32_t lastPass;
+			uint32_t slotIx;
+			refctd<ImageResource> image;
+		};
+		struct MemorySlot
+		{
+			refctd<ImageResource> owner; // image whose memory the slot is
+			ImageResource* lastUser = nullptr; // image which used the memory last (possibly in previous frame)
+		};
+
+		struct Retired
+		{
+			uint64_t frameVal;
+			nbl::core::vector<PhysicalImage> physical;
+			nbl::core::vector<MemorySlot> slots;
+		};
+
+		void addAccess(uint32_t passIx, ResourceId res, nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> access, nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages,
+			nbl::video::IGPUImage::LAYOUT layout, bool write);
+
+		void cull();
+		bool placeTransients();
+		void retirePhysical();
+
+		nbl::video::ILogicalDevice* m_device = nullptr;
+		ResourceAllocator* m_ra = nullptr;
+
+		nbl::core::vector<Pass> m_passes;
+		nbl::core::vector<VirtualResource> m_resources;
+
+		nbl::core::vector<PhysicalImage> m_physical;
+		nbl::core::vector<MemorySlot> m_slots;
+		nbl::core::deque<Retired> m_retired;
+
+		uint64_t m_lastScope = 0ULL;
+		bool m_compiled = false;
+		Stats m_stats;
+	};
+}
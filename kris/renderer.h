@@ -6,6 +6,9 @@
 #include "mesh.h"
 #include "resource_allocator.h"
 #include "resource_utils.h"
+#include "frame_allocator.h"
+#include "render_graph.h"
+#include "job_system.h"
 #include "CCamera.hpp"
 
 #include "passes/pass_common.h"
@@ -27,7 +30,7 @@ namespace kris
 			MaxStorageTexelBufs = 0U,
 			MaxUniformBufs = 1000U,
 			MaxStorageBufs = 1000U,
-			MaxUniformBufsDyn = 0U,
+			MaxUniformBufsDyn = 16U,
 			MaxStorageBufsDyn = 0U,
 			MaxInputAttachments = 0U,
 			MaxAccStructs = 0U,
@@ -42,6 +45,11 @@ namespace kris
 		};
 
 	public:
+		enum : uint32_t
+		{
+			MaxRecordingThreads = 8U, // secondaries recorded in parallel, each with own command pool (see recordSecondaries())
+		};
+
 		ResourceMap resourceMap;
 
 		BufferResource* getDefaultBufferResource()
@@ -63,58 +71,39 @@ namespace kris
 
 		}
 
+		// `jobs` is used for parallel recording and uploads, may be null
 		void init(refctd<nbl::video::ILogicalDevice>&& dev, nbl::video::ISwapchain* sc, nbl::asset::E_FORMAT depthFormat,
-			uint32_t qFamIx, ResourceAllocator* ra, uint32_t defResourcesMemTypeBitsConstraints) 
+			uint32_t qFamIx, ResourceAllocator* ra, uint32_t defResourcesMemTypeBitsConstraints, JobSystem* jobs = nullptr) 
 		{
 			m_device = std::move(dev);
+			m_ra = ra;
+			m_jobs = jobs;
 
-			// init pass resources
+			// init pass resources, render targets come from RenderGraph
 			{
-				const auto& sharedParams = sc->getCreationParameters().sharedParams;
-				const uint32_t w = sharedParams.width;
-				const uint32_t h = sharedParams.height;
-
-				createPassResources_fptr_t createPassResources_table[NumPasses] = { };
-				createPassResources_table[BasePass] = &base_pass::createPassResources;
-
-				refctd<ImageResource> scimages_refctd[FramesInFlight];
-				ImageResource* scimages[FramesInFlight];
 				KRIS_ASSERT(sc->getImageCount() == FramesInFlight);
-
 				for (uint32_t i = 0U; i < FramesInFlight; ++i)
 				{
-					scimages_refctd[i] = ra->registerExternalImage(sc->createImage(i));
-					scimages[i] = scimages_refctd[i].get();
+					m_scImages[i] = ra->registerExternalImage(sc->createImage(i));
 				}
+				const nbl::asset::E_FORMAT colorFormat = m_scImages[0]->getImage()->getCreationParameters().format;
+				m_depthFormat = depthFormat;
 
-				// depth image
-				refctd<ImageResource> depthimage;
-				{
-					nbl::video::IGPUImage::SCreationParams ci = {};
-					ci.type = nbl::video::IGPUImage::ET_2D;
-					ci.samples = nbl::video::IGPUImage::ESCF_1_BIT;
-					ci.format = depthFormat;
-					ci.extent = { sharedParams.width,sharedParams.height,1 };
-					ci.mipLevels = 1U;
-					ci.arrayLayers = 1U;
-					ci.depthUsage = nbl::video::IGPUImage::EUF_RENDER_ATTACHMENT_BIT;
-
-					depthimage = ra->allocImage(m_device.get(), std::move(ci), m_device->getPhysicalDevice()->getDeviceLocalMemoryTypeBits());
-				}
+				createPassResources_fptr_t createPassResources_table[NumPasses] = { };
+				createPassResources_table[BasePass] = &base_pass::createPassResources;
 
 				for (uint32_t pass = 0U; pass < NumPasses; ++pass)
 				{
 					createPassResources_table[pass](m_passResources + pass,
 						m_device.get(),
-						ra,
-						scimages,
-						depthimage.get(),
-						w, h);
+						colorFormat,
+						depthFormat);
 				}
+
+				m_graph.init(m_device.get(), ra);
 			}
 
 			m_fence = m_device->createSemaphore(FenceInitialVal);
-			m_lifetimeTracker = std::make_unique<lifetime_tracker_t>(m_device.get());
 			// cmd pool
 
 			for (uint32_t i = 0U; i < FramesInFlight; ++i)
@@ -122,6 +111,12 @@ namespace kris
 				//cmd pools
 				m_cmdPool[i] = m_device->createCommandPool(qFamIx,
 					nbl::core::bitflag<nbl::video::IGPUCommandPool::CREATE_FLAGS>(nbl::video::IGPUCommandPool::CREATE_FLAGS::TRANSIENT_BIT));
+				// pools are externally synchronized, so every recording thread gets its own
+				for (uint32_t t = 0U; t < MaxRecordingThreads; ++t)
+				{
+					m_threadCmdPool[i][t] = m_device->createCommandPool(qFamIx,
+						nbl::core::bitflag<nbl::video::IGPUCommandPool::CREATE_FLAGS>(nbl::video::IGPUCommandPool::CREATE_FLAGS::TRANSIENT_BIT));
+				}
 
 				// desc pool
 				{
@@ -143,25 +138,15 @@ namespace kris
 
 					m_descPool[i] = m_device->createDescriptorPool(ci);
 				}
-
-				// resource utils
-				{
-					m_rsrcUtils[i] = std::make_unique<ResourceUtils>(m_device.get(), ra);
-				}
 			}
 
-			// Camera resources
-// cam data buffer
-			{
-				nbl::video::IGPUBuffer::SCreationParams ci = {};
-				ci.usage = nbl::core::bitflag(nbl::video::IGPUBuffer::EUF_UNIFORM_BUFFER_BIT) |
-					nbl::video::IGPUBuffer::EUF_TRANSFER_DST_BIT |
-					nbl::video::IGPUBuffer::EUF_INLINE_UPDATE_VIA_CMDBUF;
-				ci.size = sizeof(nbl::asset::SBasicViewParameters);
-				m_camResources.camDataBuffer = ra->allocBuffer(m_device.get(), std::move(ci), m_device->getPhysicalDevice()->getDeviceLocalMemoryTypeBits());
-				KRIS_ASSERT(m_camResources.camDataBuffer);
-			}
+			// resource utils, staging ring is shared by all frames in flight and recycled with frame timeline
+			m_rsrcUtils = std::make_unique<ResourceUtils>(m_device.get(), ra, m_fence.get(), jobs);
+
+			// transient per-frame data (camera, scene node transforms), bound with dynamic offsets
+			m_frameAlctr.init(m_device.get(), ra);
 
+			// Camera resources
 			// cam resources ds layout
 			{
 				nbl::video::IGPUDescriptorSetLayout::SBinding b;
@@ -171,7 +156,7 @@ namespace kris
 					b.immutableSamplers = nullptr;
 					b.stageFlags = nbl::hlsl::ESS_VERTEX;
 					b.createFlags = nbl::video::IGPUDescriptorSetLayout::SBinding::E_CREATE_FLAGS::ECF_NONE;
-					b.type = nbl::asset::IDescriptor::E_TYPE::ET_UNIFORM_BUFFER;
+					b.type = nbl::asset::IDescriptor::E_TYPE::ET_UNIFORM_BUFFER_DYNAMIC;
 				}
 				m_camResources.camDsl = m_device->createDescriptorSetLayout({ &b, 1 });
 				KRIS_ASSERT(m_camResources.camDsl);
@@ -185,8 +170,8 @@ namespace kris
 				nbl::video::IGPUDescriptorSet::SWriteDescriptorSet w;
 				nbl::video::IGPUDescriptorSet::SDescriptorInfo info;
 
-				info.desc = refctd<nbl::video::IGPUBuffer>(m_camResources.camDataBuffer->getBuffer());
-				info.info.buffer = { .offset = 0,.size = m_camResources.camDataBuffer->getSize() };
+				info.desc = refctd<nbl::video::IGPUBuffer>(m_frameAlctr.getBuffer()->getBuffer());
+				info.info.buffer = { .offset = m_frameAlctr.getBuffer()->getOffset(),.size = sizeof(nbl::asset::SBasicViewParameters) };
 				w = { .dstSet = m_camResources.camDs.get(), .binding = 0, .arrayElement = 0U, .count = 1U, .info = &info };
 
 				m_device->updateDescriptorSets({ &w, 1 }, {});
@@ -201,12 +186,22 @@ namespace kris
 					b.immutableSamplers = nullptr;
 					b.stageFlags = nbl::hlsl::ESS_VERTEX;
 					b.createFlags = nbl::video::IGPUDescriptorSetLayout::SBinding::E_CREATE_FLAGS::ECF_NONE;
-					b.type = nbl::asset::IDescriptor::E_TYPE::ET_UNIFORM_BUFFER;
+					b.type = nbl::asset::IDescriptor::E_TYPE::ET_UNIFORM_BUFFER_DYNAMIC;
 				}
 				m_sceneNodeDsl = m_device->createDescriptorSetLayout({ &b, 1 });
 				KRIS_ASSERT(m_sceneNodeDsl);
 			}
 
+			// mesh ds, shared by all scene nodes, each one's data is selected with dynamic offset
+			{
+				m_sceneNodeDs = createSceneNodeDescriptorSet();
+
+				nbl::video::IGPUDescriptorSet::SWriteDescriptorSet w;
+				nbl::video::IGPUDescriptorSet::SDescriptorInfo info;
+				m_sceneNodeDs.update(m_device.get(), &w, &info, 0U, m_frameAlctr.getBuffer(), 0ULL, sizeof(SceneNode::UBOData));
+				m_device->updateDescriptorSets({ &w, 1 }, {});
+			}
+
 			// material ds layout
 			{
 				nbl::video::IGPUDescriptorSetLayout::SBinding bindings[Material::BindingSlot::BindingSlotCount];
@@ -267,13 +262,24 @@ namespace kris
 
 		ResourceUtils* getResourceUtils()
 		{
-			return m_rsrcUtils[getCurrentFrameIx()].get();
+			return m_rsrcUtils.get();
 		}
 
-		const Framebuffer& getFramebuffer(uint32_t pass, uint32_t imgAcq)
+		ImageResource* getSwapchainImage(uint32_t imgAcq)
 		{
-			return m_passResources[pass].m_fb[imgAcq];
+			return m_scImages[imgAcq].get();
 		}
+		nbl::asset::E_FORMAT getDepthFormat() const { return m_depthFormat; }
+
+		// Framebuffer of pass's render pass with given attachments, sized as the first of them
+		const Framebuffer& getFramebuffer(EPass pass, ImageResource* const* colors, uint32_t colorCount, ImageResource* depth)
+		{
+			const auto& params = (colorCount ? colors[0] : depth)->getImage()->getCreationParameters();
+			return m_passResources[pass].getFramebuffer(m_device.get(), colors, colorCount, depth, params.extent.width, params.extent.height);
+		}
+
+		// Declared anew every frame, reset in beginFrame()
+		RenderGraph* getRenderGraph() { return &m_graph; }
 
 		MaterialDescriptorSet createDescriptorSetForMaterial()
 		{
@@ -286,8 +292,8 @@ namespace kris
 			for (uint32_t b = 0U; b < MaterialDescriptorSet::MaxBindings; ++b)
 			{
 				ds.m_resources[b] = Material::isTextureBindingSlot((Material::BindingSlot)b) ? 
-					refctd<Resource>(getDefaultImageResource()) : 
-					refctd<Resource>(getDefaultBufferResource());
+					getDefaultImageResource()->getHandle() : 
+					getDefaultBufferResource()->getHandle();
 			}
 
 			return ds;
@@ -364,27 +370,96 @@ namespace kris
 
 			if (pass != EPass::NumPasses)
 			{
-				cmdbuf->bindDescriptorSets(nbl::asset::EPBP_GRAPHICS, m_mtlPplnLayout.get(), CameraDescSetIndex, 1U, &m_camResources.camDs.get());
+				cmdbuf->bindDescriptorSets(nbl::asset::EPBP_GRAPHICS, m_mtlPplnLayout.get(), CameraDescSetIndex, 1U, &m_camResources.camDs.get(), 1U, &m_camResources.camDataOffset);
 			}
 
-			return CommandRecorder(getCurrentFrameIx(), pass, std::move(cmdbuf));
+			CommandRecorder cmdrec(getCurrentFrameIx(), m_currentFrameVal, pass, std::move(cmdbuf));
+			cmdrec.frameAlctr = &m_frameAlctr;
+			cmdrec.ra = m_ra;
+			return cmdrec;
+		}
+
+		// Secondary recorder continuing `fb`'s render pass (see CommandRecorder::secondary). Records into command pool
+		// `threadIx`, so no other thread may record with that index at the same time.
+		CommandRecorder createSecondaryRecorder(EPass pass, const Framebuffer& fb, uint32_t threadIx)
+		{
+			KRIS_ASSERT(pass != EPass::NumPasses && threadIx < MaxRecordingThreads);
+
+			refctd<nbl::video::IGPUCommandBuffer> cmdbuf;
+			m_threadCmdPool[getCurrentFrameIx()][threadIx]->createCommandBuffers(nbl::video::IGPUCommandPool::BUFFER_LEVEL::SECONDARY, 1U, &cmdbuf);
+
+			nbl::video::IGPUCommandBuffer::SInheritanceInfo inheritance = {};
+			inheritance.renderpass = fb.m_fb->getCreationParameters().renderpass.get();
+			inheritance.subpass = 0U;
+			inheritance.framebuffer = fb.m_fb.get();
+			cmdbuf->begin(nbl::core::bitflag(nbl::video::IGPUCommandBuffer::USAGE::ONE_TIME_SUBMIT_BIT) | nbl::video::IGPUCommandBuffer::USAGE::RENDER_PASS_CONTINUE_BIT,
+				&inheritance);
+
+			// bindings aren't inherited from primary cmdbuf
+			cmdbuf->bindDescriptorSets(nbl::asset::EPBP_GRAPHICS, m_mtlPplnLayout.get(), CameraDescSetIndex, 1U, &m_camResources.camDs.get(), 1U, &m_camResources.camDataOffset);
+
+			CommandRecorder cmdrec(getCurrentFrameIx(), m_currentFrameVal, pass, std::move(cmdbuf));
+			cmdrec.ra = m_ra;
+			cmdrec.secondary = true;
+			return cmdrec;
+		}
+
+		using record_slice_fn_t = std::function<void(CommandRecorder& cmdrec, uint32_t sliceIx)>;
+		// Records `sliceCount` slices of `primary`'s render pass into secondaries as jobs (slice i into command pool i, whichever
+		// worker runs it), and merges them into `primary` in slice order (see CommandRecorder::mergeSecondaries()).
+		// Draws must be set up by `primary` beforehand. Dynamic state (viewport, scissor) isn't inherited, `fn` must set it.
+		void recordSecondaries(CommandRecorder& primary, const Framebuffer& fb, uint32_t sliceCount, const record_slice_fn_t& fn)
+		{
+			KRIS_ASSERT(sliceCount <= MaxRecordingThreads);
+
+			CommandRecorder slices[MaxRecordingThreads];
+			for (uint32_t i = 0U; i < sliceCount; ++i)
+				slices[i] = createSecondaryRecorder(primary.pass, fb, i);
+
+			auto recordSlices = [&fn, &slices](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = begin; i < end; ++i)
+					fn(slices[i], i);
+			};
+			if (m_jobs)
+				m_jobs->parallelFor(sliceCount, 1U, recordSlices);
+			else
+				recordSlices(0U, sliceCount);
+
+			primary.mergeSecondaries(sliceCount, slices);
 		}
 
 		SceneNodeDescriptorSet createSceneNodeDescriptorSet()
 		{
 			return SceneNodeDescriptorSet(m_descPool[0]->createDescriptorSet(refctd(m_sceneNodeDsl)));
 		}
+		const SceneNodeDescriptorSet* getSceneNodeDescriptorSet() const { return &m_sceneNodeDs; }
+
+		FrameAllocator* getFrameAllocator() { return &m_frameAlctr; }
+
+		JobSystem* getJobSystem() { return m_jobs; }
+
+		ResourceAllocator* getResourceAllocator() { return m_ra; }
+
+		// Frame timeline, signalled with getCurrentFrameVal() once current frame is done on GPU
+		nbl::video::ISemaphore* getFrameTimeline() { return m_fence.get(); }
+		uint64_t getCurrentFrameVal() const { return m_currentFrameVal; }
+
+		// Extra semaphore wait for current frame's submission (e.g. see AsyncUploader::acquire())
+		void addFrameWait(const nbl::video::IQueue::SSubmitInfo::SSemaphoreInfo& wait)
+		{
+			m_frameWaits.push_back(wait);
+		}
 
 		void consumeAsTransfer(CommandRecorder&& cmdrec)
 		{
 			consume_common(m_cmdbuf_Transfer, std::move(cmdrec));
 		}
 
-		void consumeAsPass(EPass pass, CommandRecorder&& cmdrec)
+		// Passes are submitted in the order they're consumed (see RenderGraph::execute())
+		void consumeAsPass(CommandRecorder&& cmdrec)
 		{
-			KRIS_ASSERT(pass == cmdrec.pass);
-
-			consume_common(m_cmdbuf_Passes[pass], std::move(cmdrec));
+			consume_common(m_cmdbuf_Passes.emplace_back(), std::move(cmdrec));
 		}
 
 		bool beginFrame(const Camera* cam)
@@ -403,27 +478,29 @@ namespace kris
 			}
 
 			m_cmdPool[getCurrentFrameIx()]->reset();
+			m_secondaryCmdbufs[getCurrentFrameIx()].clear();
+			for (auto& pool : m_threadCmdPool[getCurrentFrameIx()])
+				pool->reset();
+			m_frameAlctr.beginFrame(getCurrentFrameIx());
+			m_cmdbuf_Passes.clear();
+			m_graph.reset();
 
 			// setup commands
 			{
 				auto cmdbuf = createCommandBuffer();
 				
-				// bind camera ds
-				{
-					cmdbuf->bindDescriptorSets(nbl::asset::EPBP_GRAPHICS, m_mtlPplnLayout.get(), CameraDescSetIndex, 1U, &m_camResources.camDs.get());
-				}
-
 				// camera
 				{
-					nbl::asset::SBasicViewParameters camdata;
+					FrameAllocator::Allocation camdata = m_frameAlctr.alloc(sizeof(nbl::asset::SBasicViewParameters));
+					KRIS_ASSERT(camdata.isValid());
 
-					getCamDataContents(cam, &camdata);
-
-					nbl::asset::SBufferRange<nbl::video::IGPUBuffer> range;
-					range.buffer = refctd<nbl::video::IGPUBuffer>(m_camResources.camDataBuffer->getBuffer());
-					range.size = range.buffer->getSize();
+					getCamDataContents(cam, reinterpret_cast<nbl::asset::SBasicViewParameters*>(camdata.ptr));
+					m_camResources.camDataOffset = camdata.offset;
+				}
 
-					cmdbuf->updateBuffer(range, &camdata);
+				// bind camera ds
+				{
+					cmdbuf->bindDescriptorSets(nbl::asset::EPBP_GRAPHICS, m_mtlPplnLayout.get(), CameraDescSetIndex, 1U, &m_camResources.camDs.get(), 1U, &m_camResources.camDataOffset);
 				}
 
 				cmdbuf->end();
@@ -437,51 +514,52 @@ namespace kris
 		{
 			constexpr uint32_t NumSetupCmdbufs = 1U;
 			constexpr uint32_t NumTransferCmdbufs = 1U;
-			constexpr uint32_t NumCmdbufs = NumSetupCmdbufs + NumTransferCmdbufs + NumPasses;
-			constexpr uint32_t NumNonPassCmdbufs = NumCmdbufs - NumPasses;
+			constexpr uint32_t NumNonPassCmdbufs = NumSetupCmdbufs + NumTransferCmdbufs;
+			constexpr uint32_t MaxCmdbufs = NumNonPassCmdbufs + RenderGraph::MaxPasses;
 
-			constexpr uint32_t SetupCmdbufIx = 0U;
-			constexpr uint32_t TransferCmdbufIx = 1U;
+			KRIS_ASSERT(m_cmdbuf_Passes.size() <= RenderGraph::MaxPasses);
 
-			nbl::video::IQueue::SSubmitInfo::SCommandBufferInfo cmdbufs[NumCmdbufs];
+			nbl::video::IQueue::SSubmitInfo::SCommandBufferInfo cmdbufs[MaxCmdbufs];
+			uint32_t cmdbufCount = 0U;
 			{
 				// setup
 				{
 					KRIS_ASSERT(m_cmdbuf_Setup);
-					cmdbufs[SetupCmdbufIx].cmdbuf = m_cmdbuf_Setup.get();
+					cmdbufs[cmdbufCount++].cmdbuf = m_cmdbuf_Setup.get();
 				}
 				// transfer
 				{
 					KRIS_ASSERT(m_cmdbuf_Transfer);
-					cmdbufs[TransferCmdbufIx].cmdbuf = m_cmdbuf_Transfer.get();
+					cmdbufs[cmdbufCount++].cmdbuf = m_cmdbuf_Transfer.get();
 				}
-				// passes
+				// passes, in consumption order
+				for (auto& cmdbuf : m_cmdbuf_Passes)
 				{
-					auto* passesInfo = cmdbufs + NumNonPassCmdbufs;
-					for (uint32_t i = 0U; i < NumPasses; ++i)
-					{
-						KRIS_ASSERT(m_cmdbuf_Passes[i]);
-						passesInfo[i].cmdbuf = m_cmdbuf_Passes[i].get();
-					}
+					cmdbufs[cmdbufCount++].cmdbuf = cmdbuf.get();
 				}
 			}
 
 			nbl::video::IQueue::SSubmitInfo submitInfos[1] = {};
-			submitInfos[0].commandBuffers = { cmdbufs, NumCmdbufs };
+			submitInfos[0].commandBuffers = { cmdbufs, cmdbufCount };
+			submitInfos[0].waitSemaphores = { m_frameWaits.data(), m_frameWaits.size() };
 			const nbl::video::IQueue::SSubmitInfo::SSemaphoreInfo signals[] = { 
 				{	.semaphore = m_fence.get(), 
 					.value = m_currentFrameVal,
 					.stageMask = flags} };
 			submitInfos[0].signalSemaphores = signals;
 
+			m_frameAlctr.flush();
 			cmdq->submit(submitInfos);
+			m_frameWaits.clear();
 
 			return signals[0];
 		}
 
 		bool endFrame()
 		{
-			m_lifetimeTracker->poll();
+			// memory of resources which died while still in use is freed once their last frame completes
+			m_ra->collectGarbage(m_fence->getCounterValue());
+			m_ra->endFrame(m_currentFrameVal);
 
 			m_currentFrameVal++;
 			return true;
@@ -504,12 +582,15 @@ namespace kris
 	private:
 		void consume_common(refctd<nbl::video::IGPUCommandBuffer>& dstcmdbuf, CommandRecorder&& cmdrec)
 		{
+			KRIS_ASSERT(cmdrec.frameVal == m_currentFrameVal);
+
 			CommandRecorder::Result result;
-			cmdrec.endAndObtainResources(result);
+			cmdrec.endAndObtainResult(result);
 
 			dstcmdbuf = std::move(result.cmdbuf);
-			nbl::video::ISemaphore::SWaitInfo wi;
-			m_lifetimeTracker->latch({ .semaphore = m_fence.get(), .value = m_currentFrameVal }, std::move(result.resources));
+			// secondaries must outlive execution of the primary cmdbuf
+			for (auto& sec : result.secondaries)
+				m_secondaryCmdbufs[getCurrentFrameIx()].push_back(std::move(sec));
 		}
 
 		void getCamDataContents(const Camera* cam, nbl::asset::SBasicViewParameters* camdata)
@@ -545,28 +626,37 @@ namespace kris
 		uint64_t m_currentFrameVal = FenceInitialVal + 1ULL;
 
 		refctd<nbl::video::ILogicalDevice> m_device;
+		ResourceAllocator* m_ra = nullptr;
+		JobSystem* m_jobs = nullptr;
 		PassResources m_passResources[NumPasses];
+		refctd<ImageResource> m_scImages[FramesInFlight];
+		nbl::asset::E_FORMAT m_depthFormat = nbl::asset::EF_UNKNOWN;
+		RenderGraph m_graph;
 
 		refctd<nbl::video::ISemaphore> m_fence;
 
 		refctd<nbl::video::IGPUCommandPool> m_cmdPool[FramesInFlight];
+		refctd<nbl::video::IGPUCommandPool> m_threadCmdPool[FramesInFlight][MaxRecordingThreads];
+		nbl::core::vector<refctd<nbl::video::IGPUCommandBuffer>> m_secondaryCmdbufs[FramesInFlight];
 		refctd<nbl::video::IDescriptorPool> m_descPool[FramesInFlight];
-		std::unique_ptr<ResourceUtils> m_rsrcUtils[FramesInFlight];
-		using lifetime_tracker_t = nbl::video::MultiTimelineEventHandlerST<DeferredAllocDeletion, false>;
-		std::unique_ptr<lifetime_tracker_t> m_lifetimeTracker;
+		std::unique_ptr<ResourceUtils> m_rsrcUtils;
 
 		refctd<nbl::video::IGPUCommandBuffer> m_cmdbuf_Setup;
 		refctd<nbl::video::IGPUCommandBuffer> m_cmdbuf_Transfer;
-		refctd<nbl::video::IGPUCommandBuffer> m_cmdbuf_Passes[NumPasses];
+		nbl::core::vector<refctd<nbl::video::IGPUCommandBuffer>> m_cmdbuf_Passes;
+		nbl::core::vector<nbl::video::IQueue::SSubmitInfo::SSemaphoreInfo> m_frameWaits;
 
 		// camera ds resources
 		struct {
-			refctd<BufferResource> camDataBuffer;
+			uint32_t camDataOffset = 0U; // dynamic offset of current frame's camera data within FrameAllocator's buffer
 			refctd<nbl::video::IGPUDescriptorSetLayout> camDsl;
 			refctd<nbl::video::IGPUDescriptorSet> camDs;
 		} m_camResources;
 
 		refctd<nbl::video::IGPUDescriptorSetLayout> m_sceneNodeDsl;
+		SceneNodeDescriptorSet m_sceneNodeDs;
+
+		FrameAllocator m_frameAlctr;
 
 		refctd<nbl::video::IGPUDescriptorSetLayout> m_mtlDsl;
 		refctd<nbl::video::IGPUPipelineLayout> m_mtlPplnLayout;
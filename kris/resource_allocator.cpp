@@ -6,3 +6,5 @@ uint64_t kris::ResourceAllocator::Allocation::static_getNewId()
 
     return id_gen++;
 }
+
+kris::ResourceAllocator::ViewCacheStats kris::ResourceAllocator::s_viewCacheStats;
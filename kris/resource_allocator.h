@@ -1,6 +1,7 @@
 #pragma once
 
 #include "kris_common.h"
+#include "tlsf_allocator.h"
 
 namespace kris
 {
@@ -23,28 +24,58 @@ namespace kris
 			InvalidOffset = ~0ULL,
 		};
 
-		explicit MemPool(nbl::video::ILogicalDevice* device, size_t size, uint32_t memTypeIx) :
-			m_addrAlctr_scratch(KRIS_MEM_ALLOC(addr_alctr_t::reserved_size(MaxRequestableAlignment, nbl::core::alignUp(size, BlockSize), BlockSize))),
-			m_addrAlctr(
-				m_addrAlctr_scratch
-				, 0U
-				, 0U
-				, MaxRequestableAlignment
-				, nbl::core::alignUp(size, BlockSize)
-				, BlockSize)
+		// Address allocator used for placing resources within the pool
+		enum class EBackend : uint32_t
+		{
+			GeneralPurpose, // nbl::core::GeneralpurposeAddressAllocator
+			TLSF, // O(1) alloc/free, see TLSFAddressAllocator
+		};
+
+		explicit MemPool(nbl::video::ILogicalDevice* device, size_t size, uint32_t memTypeIx, EBackend backend) :
+			m_backend(backend),
+			m_addrAlctr_scratch(backend == EBackend::GeneralPurpose ? 
+				KRIS_MEM_ALLOC(addr_alctr_t::reserved_size(MaxRequestableAlignment, nbl::core::alignUp(size, BlockSize), BlockSize)) : 
+				nullptr),
+			m_addrAlctr(backend == EBackend::GeneralPurpose ? 
+				addr_alctr_t(
+					m_addrAlctr_scratch
+					, 0U
+					, 0U
+					, MaxRequestableAlignment
+					, nbl::core::alignUp(size, BlockSize)
+					, BlockSize) : 
+				addr_alctr_t()),
+			m_tlsf(backend == EBackend::TLSF ? 
+				TLSFAddressAllocator((uint32_t)nbl::core::alignUp(size, BlockSize), BlockSize) : 
+				TLSFAddressAllocator())
 		{
 			nbl::video::IDeviceMemoryAllocator::SAllocateInfo ainfo = {};
-			ainfo.size = m_addrAlctr.get_total_size();
+			ainfo.size = getTotalSize();
 			ainfo.flags = nbl::video::IDeviceMemoryAllocation::EMAF_NONE;
 			ainfo.memoryTypeIndex = memTypeIx;
 			ainfo.dedication = nullptr;
 
 			m_mem = device->allocate(ainfo);
+
+			// host visible pools stay mapped for their whole lifetime, so that allocations within can be accessed independently
+			if (m_mem.memory->getMemoryPropertyFlags().hasFlags(nbl::video::IDeviceMemoryAllocation::EMPF_HOST_VISIBLE_BIT))
+			{
+				m_mem.memory->map({ m_mem.offset, getTotalSize() }, nbl::video::IDeviceMemoryAllocation::EMCAF_READ_AND_WRITE);
+				m_mappedPtr = reinterpret_cast<uint8_t*>(m_mem.memory->getMappedPointer());
+				KRIS_ASSERT_MSG(m_mappedPtr, "Failed to map host visible pool!");
+			}
 		}
 
 		~MemPool()
 		{
-			KRIS_MEM_FREE(m_addrAlctr_scratch);
+			if (m_mappedPtr)
+			{
+				m_mem.memory->unmap();
+			}
+			if (m_addrAlctr_scratch)
+			{
+				KRIS_MEM_FREE(m_addrAlctr_scratch);
+			}
 		}
 
 		nbl::video::IDeviceMemoryBacked::SMemoryBinding allocate(size_t size, uint32_t alignment)
@@ -76,31 +107,94 @@ namespace kris
 			return freeOffset(offset, size);
 		}
 
+		EBackend getBackend() const { return m_backend; }
+
+		// Pointer to the beginning of pool's memory object (i.e. binding offsets apply directly), null if not host visible
+		uint8_t* getMappedPtr() const { return m_mappedPtr; }
+
+		size_t getTotalSize() const
+		{
+			return (m_backend == EBackend::TLSF) ? m_tlsf.get_total_size() : m_addrAlctr.get_total_size();
+		}
+		size_t getFreeSize() const
+		{
+			return (m_backend == EBackend::TLSF) ? m_tlsf.get_free_size() : m_addrAlctr.get_free_size();
+		}
+		// Every allocation of size (including alignment padding) not greater than returned value will succeed.
+		// Only meaningful for TLSF backend, GP one gives no such guarantees and returns 0.
+		size_t getGuaranteedAllocSize() const
+		{
+			return (m_backend == EBackend::TLSF) ? m_tlsf.get_largest_free_block_lower_bound() : 0ULL;
+		}
+		// Size of the biggest free block, only TLSF backend can tell, GP one returns 0
+		size_t getLargestFreeBlockSize() const
+		{
+			return (m_backend == EBackend::TLSF) ? m_tlsf.get_largest_free_block() : 0ULL;
+		}
+
+		// MemHeap's free-list index bookkeeping
+		uint32_t m_heapBucket = ~0U;
+		uint32_t m_heapBucketPos = ~0U;
+		// MemHeap's retention bookkeeping, frame in which pool became empty
+		uint64_t m_emptySinceFrame = ~0ULL;
+
+		bool isRetainedEmpty() const { return m_emptySinceFrame != ~0ULL; }
+
+		// Set by MemDefragmenter, evacuating pools don't take any new allocations
+		enum class EEvacuation : uint32_t
+		{
+			None,
+			Evacuating,
+			Evacuated, // all live allocations moved out, waiting for retired ones to be freed
+		} m_evacuation = EEvacuation::None;
+
+		bool isEvacuating() const { return m_evacuation != EEvacuation::None; }
+
 	private:
 		size_t allocateOffset(size_t size, uint32_t alignment)
 		{
-			return (size_t)m_addrAlctr.alloc_addr((uint32_t)size, alignment);
+			if (m_backend == EBackend::TLSF)
+			{
+				const uint32_t addr = m_tlsf.alloc_addr((uint32_t)size, alignment);
+				return (addr == TLSFAddressAllocator::invalid_address) ? InvalidOffset : (size_t)addr;
+			}
+			const uint32_t addr = m_addrAlctr.alloc_addr((uint32_t)size, alignment);
+			return (addr == addr_alctr_t::invalid_address) ? InvalidOffset : (size_t)addr;
 		}
 		bool freeOffset(size_t offset, size_t size)
 		{
+			if (m_backend == EBackend::TLSF)
+			{
+				m_tlsf.free_addr((uint32_t)offset, (uint32_t)size);
+				return (m_tlsf.get_free_size() == m_tlsf.get_total_size());
+			}
 			m_addrAlctr.free_addr((uint32_t)offset, (uint32_t)size);
 			return (m_addrAlctr.get_free_size() == m_addrAlctr.get_total_size());
 		}
 
+		EBackend m_backend;
 		void* m_addrAlctr_scratch;
 		addr_alctr_t m_addrAlctr;
+		TLSFAddressAllocator m_tlsf;
 		nbl::video::IDeviceMemoryAllocator::SAllocation m_mem;
+		uint8_t* m_mappedPtr = nullptr;
 	};
 
 	class MemHeap
 	{
 		enum : uint32_t
 		{
-			PoolSizeLog2 = 26U,
-			PoolSize = 1U << PoolSizeLog2,
+			// shared pools grow geometrically with heap usage, between these bounds
+			MinPoolSizeLog2 = 24U,
+			MinPoolSize = 1U << MinPoolSizeLog2,
+			MaxPoolSizeLog2 = 28U,
+			MaxPoolSize = 1U << MaxPoolSizeLog2,
 
 			MaxPlacedAllocSizeLog2 = 23U,
 			MaxPlacedAllocSize = 1U << MaxPlacedAllocSizeLog2,
+
+			// free-list index buckets, pool lands in bucket floor(log2(guaranteed alloc size))
+			BucketCount = 32U,
 		};
 
 	public:
@@ -112,16 +206,38 @@ namespace kris
 			};
 
 			nbl::video::IDeviceMemoryBacked::SMemoryBinding binding;
-			MemPool* pool = nullptr;
+			MemPool* pool = nullptr; // null for dedicated allocations
+			// dedicated allocations own their memory object directly, without any pool or address allocator
+			refctd<nbl::video::IDeviceMemoryAllocation> dedicatedMemory;
+			// beginning of persistently mapped memory object (binding offset applies directly), null if not host visible
+			uint8_t* mappedBase = nullptr;
+			// memory taken from the pool (or size of dedicated memory), might be more than the resource's size
+			size_t memSize = 0ULL;
 			uint32_t memTypeIx = 32U;
 			bool dedicated = false;
 
 			bool isValid() const
 			{
-				return pool && binding.isValid() && memTypeIx < 32U;
+				return (pool || dedicatedMemory) && binding.isValid() && memTypeIx < 32U;
 			}
 		};
 
+		struct Stats
+		{
+			size_t reservedBytes = 0ULL; // device memory allocated by all the pools, dedicated ones included
+			size_t usedBytes = 0ULL; // sum of live allocation sizes
+			size_t dedicatedBytes = 0ULL;
+			uint32_t poolCount = 0U;
+			uint32_t dedicatedCount = 0U;
+			uint32_t emptyPoolCount = 0U; // retained empty pools, included in poolCount
+			// device memory allocations/frees done by the heap since its creation, dedicated ones included
+			uint32_t poolsCreated = 0U;
+			uint32_t poolsDestroyed = 0U;
+			// 1 - (sum of pools' biggest free blocks / sum of pools' free space) over shared pools,
+			// 0 if free space within every pool is contiguous. Only TLSF backend can tell the biggest free block, GP one always reports 0.
+			float fragmentation = 0.f;
+		};
+
 		void setMemTypeIx(uint32_t ix)
 		{
 			KRIS_ASSERT_MSG(m_memTypeIx >= 32U, "MemHeap: Can't set mem type index more than once!");
@@ -131,63 +247,361 @@ namespace kris
 			}
 		}
 
-		Allocation allocate(nbl::video::ILogicalDevice* device, size_t size, uint32_t alignment, bool forceDedicated)
+		void setBackend(MemPool::EBackend backend)
 		{
-			bool dedicated = forceDedicated | (size > MaxPlacedAllocSize);
+			KRIS_ASSERT_MSG(m_pools.empty() && m_dedicatedCount == 0U, "MemHeap: Can't change backend once pools are created!");
+			m_backend = backend;
+		}
 
-			Allocation al;
-			al.memTypeIx = m_memTypeIx;
-			al.dedicated = dedicated;
+		// Shared pools which become empty are kept for reuse, so that repeated load/unload doesn't hit the driver
+		struct RetentionPolicy
+		{
+			uint32_t maxEmptyPools = 2U; // empty pools kept at once
+			uint32_t maxEmptyFrames = 120U; // frames an empty pool survives without being allocated from
+		};
+
+		void setRetentionPolicy(const RetentionPolicy& policy) { m_retention = policy; }
+
+		// `size` is what's accounted as used, `memSize` is what's taken from memory, i.e. resource's VkMemoryRequirements::size
+		// (driver may pad it). `dedicateTo` is the resource which is going to be bound to dedicated memory (VK_KHR_dedicated_allocation), may be null
+		Allocation allocate(nbl::video::ILogicalDevice* device, size_t size, size_t memSize, uint32_t alignment, bool forceDedicated, nbl::video::IDeviceMemoryBacked* dedicateTo = nullptr)
+		{
+			bool dedicated = forceDedicated | (memSize > MaxPlacedAllocSize);
 
 			if (dedicated)
 			{
-				m_dedicated.push_back(KRIS_MEM_NEW MemPool(device, size, m_memTypeIx));
-				auto* pool = m_dedicated.back();
-				al.binding = pool->allocate(size, alignment);
-				al.pool = pool;
-				KRIS_ASSERT_MSG(al.binding.isValid(), "Dedicated pools should always be able to allocate!");
+				return allocateDedicated(device, size, memSize, dedicateTo);
+			}
+
+			Allocation al;
+			al.memTypeIx = m_memTypeIx;
+			al.memSize = memSize;
+			al.dedicated = false;
 
+			m_usedSize += size;
+
+			if (allocateFromExistingPools(memSize, alignment, al))
+			{
 				return al;
 			}
 
-			for (MemPool* pool : m_pools)
+			auto* pool = createPool(device, getNextPoolSize());
+			al.binding = pool->allocate(memSize, alignment);
+			al.pool = pool;
+			al.mappedBase = pool->getMappedPtr();
+			KRIS_ASSERT_MSG(al.binding.isValid(), "Brand new pool should always be able to allocate!");
+			updatePoolInIndex(pool);
+
+			return al;
+		}
+
+		// Never creates new pools, returned allocation is invalid if none of existing pools could fit it
+		Allocation allocatePlaced(size_t size, size_t memSize, uint32_t alignment)
+		{
+			Allocation al;
+			al.memTypeIx = m_memTypeIx;
+			al.memSize = memSize;
+			al.dedicated = false;
+
+			if (allocateFromExistingPools(memSize, alignment, al))
+			{
+				m_usedSize += size;
+			}
+
+			return al;
+		}
+
+		// Memory of dedicated allocation is freed once the last copy of `al` drops its dedicatedMemory reference
+		void deallocate(const Allocation& al, size_t size)
+		{
+			m_usedSize -= size;
+
+			if (al.dedicated)
+			{
+				const size_t memsize = al.dedicatedMemory->getAllocationSize();
+				if (al.mappedBase)
+				{
+					al.dedicatedMemory->unmap();
+				}
+				m_reservedSize -= memsize;
+				m_dedicatedSize -= memsize;
+				m_dedicatedCount--;
+				m_poolsDestroyed++;
+				return;
+			}
+
+			if (al.pool->deallocate(al.binding, al.memSize))
 			{
-				nbl::video::IDeviceMemoryBacked::SMemoryBinding binding = pool->allocate(size, alignment);
-				if (binding.isValid())
+				// evacuated pools are emptied on purpose, never keep them
+				const bool retain = !al.pool->isEvacuating() &&
+					m_emptyPoolCount < m_retention.maxEmptyPools && m_retention.maxEmptyFrames > 0U;
+				if (retain)
 				{
-					al.binding = binding;
-					al.pool = pool;
+					al.pool->m_emptySinceFrame = m_currentFrame;
+					m_emptyPoolCount++;
+					updatePoolInIndex(al.pool);
+				}
+				else
+				{
+					destroyPool(al.pool);
+				}
+			}
+			else
+			{
+				updatePoolInIndex(al.pool);
+			}
+		}
 
-					return al;
+		// Frees empty pools retained for longer than the policy allows
+		void endFrame(uint64_t frame)
+		{
+			m_currentFrame = frame;
+
+			for (size_t i = m_pools.size(); i > 0ULL; --i)
+			{
+				MemPool* pool = m_pools[i - 1ULL];
+				if (pool->isRetainedEmpty() && frame - pool->m_emptySinceFrame > m_retention.maxEmptyFrames)
+				{
+					destroyPool(pool);
 				}
 			}
+		}
 
-			m_pools.push_back(KRIS_MEM_NEW MemPool(device, PoolSize, m_memTypeIx));
-			auto* pool = m_pools.back();
-			al.binding = pool->allocate(size, alignment);
-			al.pool = pool;
-			KRIS_ASSERT_MSG(al.binding.isValid(), "Brand new pool should always be able to allocate!");
+		const nbl::core::vector<MemPool*>& getPools() const { return m_pools; }
+
+		size_t getReservedSize() const { return m_reservedSize; }
+
+		Stats getStats() const
+		{
+			Stats stats;
+			stats.reservedBytes = m_reservedSize;
+			stats.usedBytes = m_usedSize;
+			stats.dedicatedBytes = m_dedicatedSize;
+			stats.poolCount = (uint32_t)m_pools.size();
+			stats.dedicatedCount = m_dedicatedCount;
+			stats.emptyPoolCount = m_emptyPoolCount;
+			stats.poolsCreated = m_poolsCreated;
+			stats.poolsDestroyed = m_poolsDestroyed;
+
+			size_t freeSize = 0ULL;
+			size_t biggestFreeBlocks = 0ULL;
+			for (const MemPool* pool : m_pools)
+			{
+				freeSize += pool->getFreeSize();
+				biggestFreeBlocks += pool->getLargestFreeBlockSize();
+			}
+			if (freeSize && m_backend == MemPool::EBackend::TLSF)
+			{
+				stats.fragmentation = 1.f - (float)biggestFreeBlocks / (float)freeSize;
+			}
+
+			return stats;
+		}
+
+		void setPoolEvacuation(MemPool* pool, MemPool::EEvacuation state)
+		{
+			pool->m_evacuation = state;
+			if (pool->isEvacuating())
+				removePoolFromIndex(pool);
+			else
+				updatePoolInIndex(pool);
+		}
+
+	private:
+		// One memory object per resource, no address allocator involved
+		Allocation allocateDedicated(nbl::video::ILogicalDevice* device, size_t size, size_t memSize, nbl::video::IDeviceMemoryBacked* dedicateTo)
+		{
+			// must be exactly VkMemoryRequirements::size of the resource memory is dedicated to
+			nbl::video::IDeviceMemoryAllocator::SAllocateInfo ainfo = {};
+			ainfo.size = memSize;
+			ainfo.flags = nbl::video::IDeviceMemoryAllocation::EMAF_NONE;
+			ainfo.memoryTypeIndex = m_memTypeIx;
+			ainfo.dedication = dedicateTo;
+
+			nbl::video::IDeviceMemoryAllocator::SAllocation mem = device->allocate(ainfo);
+			KRIS_ASSERT_MSG(mem.isValid(), "Failed to allocate dedicated memory!");
+
+			Allocation al;
+			al.memTypeIx = m_memTypeIx;
+			al.dedicated = true;
+			al.binding.memory = mem.memory.get();
+			al.binding.offset = mem.offset;
+			al.memSize = memSize;
+			al.dedicatedMemory = std::move(mem.memory);
+			if (al.dedicatedMemory->getMemoryPropertyFlags().hasFlags(nbl::video::IDeviceMemoryAllocation::EMPF_HOST_VISIBLE_BIT))
+			{
+				al.dedicatedMemory->map({ al.binding.offset, memSize }, nbl::video::IDeviceMemoryAllocation::EMCAF_READ_AND_WRITE);
+				al.mappedBase = reinterpret_cast<uint8_t*>(al.dedicatedMemory->getMappedPointer());
+			}
+
+			const size_t memsize = al.dedicatedMemory->getAllocationSize();
+			m_usedSize += size;
+			m_reservedSize += memsize;
+			m_dedicatedSize += memsize;
+			m_dedicatedCount++;
+			m_poolsCreated++;
 
 			return al;
 		}
 
-		void deallocate(const Allocation& al, size_t size)
+		MemPool* createPool(nbl::video::ILogicalDevice* device, size_t size)
+		{
+			auto* pool = KRIS_MEM_NEW MemPool(device, size, m_memTypeIx, m_backend);
+			m_pools.push_back(pool);
+
+			m_reservedSize += pool->getTotalSize();
+			m_poolsCreated++;
+
+			return pool;
+		}
+
+		void destroyPool(MemPool* pool)
+		{
+			auto found_it = std::find(std::begin(m_pools), std::end(m_pools), pool);
+			KRIS_ASSERT_MSG(found_it != m_pools.end(), "Pool not found within all the pools!");
+			removePoolFromIndex(pool);
+			if (pool->isRetainedEmpty())
+				m_emptyPoolCount--;
+			m_reservedSize -= pool->getTotalSize();
+			m_poolsDestroyed++;
+			KRIS_MEM_DELETE(pool);
+			m_pools.erase(found_it);
+		}
+
+		// total size of shared pools rounded up to pow2, i.e. every new pool doubles heap capacity until MaxPoolSize is reached
+		size_t getNextPoolSize() const
+		{
+			const size_t shared = m_reservedSize - m_dedicatedSize;
+			const size_t size = nbl::core::roundUpToPoT(std::max<size_t>(shared, MinPoolSize));
+			return std::min<size_t>(size, MaxPoolSize);
+		}
+
+		void onPoolAllocated(MemPool* pool)
+		{
+			if (pool->isRetainedEmpty())
+			{
+				pool->m_emptySinceFrame = ~0ULL;
+				m_emptyPoolCount--;
+			}
+		}
+
+		bool allocateFromExistingPools(size_t size, uint32_t alignment, Allocation& al)
 		{
-			if (al.pool->deallocate(al.binding, size))
+			if (m_backend == MemPool::EBackend::TLSF)
 			{
-				auto& pools = al.dedicated ? m_dedicated : m_pools;
+				if (MemPool* pool = findPoolInIndex(size, alignment))
+				{
+					al.binding = pool->allocate(size, alignment);
+					KRIS_ASSERT_MSG(al.binding.isValid(), "Pool taken from free-list index should always be able to allocate!");
+					al.pool = pool;
+					al.mappedBase = pool->getMappedPtr();
+					updatePoolInIndex(pool);
+					onPoolAllocated(pool);
 
-				auto found_it = std::find(std::begin(pools), std::end(pools), al.pool);
-				KRIS_ASSERT_MSG(found_it != pools.end(), "Dedicated allocation pool not found within all the pools!");
-				KRIS_MEM_SAFE_DELETE(al.pool);
-				pools.erase(found_it);
+					return true;
+				}
+			}
+			else
+			{
+				for (MemPool* pool : m_pools)
+				{
+					if (pool->isEvacuating())
+						continue;
+
+					nbl::video::IDeviceMemoryBacked::SMemoryBinding binding = pool->allocate(size, alignment);
+					if (binding.isValid())
+					{
+						al.binding = binding;
+						al.pool = pool;
+						al.mappedBase = pool->getMappedPtr();
+						onPoolAllocated(pool);
+
+						return true;
+					}
+				}
 			}
+
+			return false;
+		}
+
+		static uint32_t getBucket(size_t guaranteedSize)
+		{
+			return guaranteedSize ? nbl::hlsl::findMSB((uint32_t)guaranteedSize) : ~0U;
+		}
+
+		MemPool* findPoolInIndex(size_t size, uint32_t alignment)
+		{
+			// worst case size including alignment padding, rounded up to pow2 so that any pool from found bucket fits
+			const size_t needed = nbl::core::alignUp(size, (size_t)MemPool::BlockSize) + (alignment > MemPool::BlockSize ? alignment - MemPool::BlockSize : 0U);
+			const uint32_t minBucket = nbl::hlsl::findMSB((uint32_t)nbl::core::roundUpToPoT(needed));
+			if (minBucket >= BucketCount)
+				return nullptr;
+
+			const uint32_t mask = m_bucketMask & (~0U << minBucket);
+			if (mask == 0U)
+				return nullptr;
+
+			return m_buckets[nbl::hlsl::findLSB(mask)].back();
+		}
+
+		void removePoolFromIndex(MemPool* pool)
+		{
+			if (pool->m_heapBucket >= BucketCount)
+				return;
+
+			auto& bucket = m_buckets[pool->m_heapBucket];
+			KRIS_ASSERT(bucket[pool->m_heapBucketPos] == pool);
+
+			MemPool* last = bucket.back();
+			bucket[pool->m_heapBucketPos] = last;
+			last->m_heapBucketPos = pool->m_heapBucketPos;
+			bucket.pop_back();
+			if (bucket.empty())
+				m_bucketMask &= ~(1U << pool->m_heapBucket);
+
+			pool->m_heapBucket = ~0U;
+			pool->m_heapBucketPos = ~0U;
+		}
+
+		void updatePoolInIndex(MemPool* pool)
+		{
+			if (pool->getBackend() != MemPool::EBackend::TLSF)
+				return;
+			if (pool->isEvacuating())
+				return;
+
+			const uint32_t newBucket = getBucket(pool->getGuaranteedAllocSize());
+			if (newBucket == pool->m_heapBucket)
+				return;
+
+			removePoolFromIndex(pool);
+			if (newBucket >= BucketCount) // pool is full
+				return;
+
+			auto& bucket = m_buckets[newBucket];
+			pool->m_heapBucket = newBucket;
+			pool->m_heapBucketPos = (uint32_t)bucket.size();
+			bucket.push_back(pool);
+			m_bucketMask |= (1U << newBucket);
 		}
 
-	private:
 		uint32_t m_memTypeIx = 32U;
+		MemPool::EBackend m_backend = MemPool::EBackend::TLSF;
+		size_t m_reservedSize = 0ULL;
+		size_t m_usedSize = 0ULL;
+		size_t m_dedicatedSize = 0ULL;
+
+		RetentionPolicy m_retention;
+		uint64_t m_currentFrame = 0ULL;
+		uint32_t m_emptyPoolCount = 0U;
+		uint32_t m_poolsCreated = 0U;
+		uint32_t m_poolsDestroyed = 0U;
 		nbl::core::vector<MemPool*> m_pools;
-		nbl::core::vector<MemPool*> m_dedicated;
+		uint32_t m_dedicatedCount = 0U;
+
+		// pools bucketed by the biggest allocation they can surely serve
+		nbl::core::vector<MemPool*> m_buckets[BucketCount];
+		uint32_t m_bucketMask = 0U;
 	};
 
 	class ResourceAllocator
@@ -195,6 +609,18 @@ namespace kris
 		enum : uint32_t
 		{
 			MaxHeaps = 32U, // Max mem types
+			MaxDeviceHeaps = 16U, // VK_MAX_MEMORY_HEAPS
+
+			// buffers not bigger than this are packed into slabs, see BufferSlab
+			MaxSlabAllocSize = 256U,
+			MinSlabStride = 64U,
+		};
+		enum : size_t
+		{
+			// resources the driver prefers dedicated memory for get it only from this size on, render attachments always
+			MinPreferredDedicatedSize = 4ULL << 20,
+			// frame regions of DirectWrite buffers start at multiples of this, the biggest min uniform/storage buffer offset alignment allowed
+			FrameRegionAlignment = 256ULL,
 		};
 
 	public:
@@ -202,6 +628,51 @@ namespace kris
 		{
 			None = 0U,
 			External = 1U << 1,
+			SubAllocated = 1U << 2, // buffer is a range of slab's backing buffer, internal
+			Pinned = 1U << 3, // never moved by MemDefragmenter
+			Retired = 1U << 4, // old placement of relocated resource, waiting for GPU to finish with it, internal
+			Dedicated = 1U << 5, // force own memory object (e.g. render targets), implies Pinned
+			// buffer in device local and host visible memory (persistently mapped), CPU writes straight into it (see ResourceUtils),
+			// implies Pinned. It has a region per frame in flight (see BufferAllocation::getFrameRegionCount()).
+			// Dropped if there's no such memory type or direct write budget is exhausted.
+			DirectWrite = 1U << 6,
+			// image whose memory is shared with images bound through allocAliasedImage(), so it's never dedicated
+			// to the image (it may still get memory object of its own), implies Pinned
+			Aliasable = 1U << 7,
+		};
+
+		// Weak reference to an allocation: index into ResourceAllocator's dense handle table and generation of the slot.
+		// Slot's generation is bumped once allocation dies, so stale handles resolve to nullptr.
+		// (not to be confused with Allocation::getGeneration() which counts relocations)
+		struct Handle
+		{
+			uint32_t index = ~0U;
+			uint32_t generation = 0U;
+
+			bool isValid() const { return index != ~0U; }
+			bool operator==(const Handle& rhs) const { return index == rhs.index && generation == rhs.generation; }
+			bool operator!=(const Handle& rhs) const { return !operator==(rhs); }
+		};
+
+		class BufferSlab;
+		struct Allocation;
+
+		// Engine-wide counters of per-resource view caches
+		struct ViewCacheStats
+		{
+			uint64_t hits = 0ULL;
+			uint64_t misses = 0ULL;
+			uint64_t evictions = 0ULL;
+		};
+		static const ViewCacheStats& getViewCacheStats() { return s_viewCacheStats; }
+		static void resetViewCacheStats() { s_viewCacheStats = {}; }
+
+		// Range (relative to allocation's memory binding) of host-visible allocation
+		struct MappedRange
+		{
+			Allocation* allocation;
+			size_t offset;
+			size_t size;
 		};
 
 		struct Allocation : public nbl::core::IReferenceCounted, public nbl::core::Uncopyable
@@ -216,8 +687,10 @@ namespace kris
 				resource(std::move(res)),
 				flags(_flags),
 				m_id(static_getNewId()),
+				m_maxViews(maxViews),
 				m_views(maxViews)
 			{
+				m_handle = alctr->createHandle(this);
 			}
 			virtual ~Allocation() = default;
 
@@ -231,33 +704,53 @@ namespace kris
 			}
 
 			virtual size_t getSize() const = 0;
+			// Bytes of memory the resource is bound to, more than getSize() only for buffers with frame regions
+			virtual size_t getBackingSize() const { return getSize(); }
+			virtual bool isBuffer() const = 0;
 
+			// Host visible pools and dedicated allocations are persistently mapped, so map()/unmap() only touch the driver for external allocations
 			void* map(const nbl::core::bitflag<nbl::video::IDeviceMemoryAllocation::E_MAPPING_CPU_ACCESS_FLAGS> flags)
 			{
-				void* ptr = allocation.binding.memory->map({ allocation.binding.offset, this->getSize() }, flags);
+				if (isPersistentlyMapped())
+					return getMappedPtr();
+
+				void* ptr = allocation.binding.memory->map({ allocation.binding.offset, this->getBackingSize() }, flags);
 				KRIS_ASSERT_MSG(ptr, "Failed to map!");
 				return getMappedPtr();
 			}
 			bool unmap()
 			{
+				if (isPersistentlyMapped())
+					return true;
 				return allocation.binding.memory->unmap();
 			}
 			void* getMappedPtr()
 			{
+				if (isPersistentlyMapped())
+					return allocation.mappedBase + allocation.binding.offset;
+
 				void* ptr = allocation.binding.memory->getMappedPointer();
 				if (!ptr)
 					return nullptr;
 				return reinterpret_cast<uint8_t*>(ptr) + allocation.binding.offset;
 			}
+			bool isPersistentlyMapped() const
+			{
+				return allocation.mappedBase != nullptr;
+			}
+			bool isDirectlyWritable() const
+			{
+				return flags.hasFlags(AllocFlags::DirectWrite) && isPersistentlyMapped();
+			}
 			bool invalidate(nbl::video::ILogicalDevice* device)
 			{
-				const nbl::video::ILogicalDevice::MappedMemoryRange memoryRange(
-					allocation.binding.memory,
-					allocation.binding.offset,
-					this->getSize());
-				if (!allocation.binding.memory->getMemoryPropertyFlags().hasFlags(nbl::video::IDeviceMemoryAllocation::EMPF_HOST_COHERENT_BIT))
-					return device->invalidateMappedMemoryRanges(1, &memoryRange);
-				return true;
+				const MappedRange range = { this, 0ULL, this->getBackingSize() };
+				return ResourceAllocator::invalidateMappedRanges(device, 1U, &range);
+			}
+			bool flush(nbl::video::ILogicalDevice* device)
+			{
+				const MappedRange range = { this, 0ULL, this->getBackingSize() };
+				return ResourceAllocator::flushMappedRanges(device, 1U, &range);
 			}
 
 			bool compareIds(Allocation* other)
@@ -265,6 +758,18 @@ namespace kris
 				return m_id == other->m_id;
 			}
 
+			Handle getHandle() const { return m_handle; }
+
+			// Bumped every time the resource is recreated at different memory location (or switches frame region, see BufferAllocation),
+			// anything caching the underlying resource object (descriptor sets) must be refreshed then.
+			uint32_t getGeneration() const { return m_generation; }
+
+			bool isMovable() const
+			{
+				return !flags.hasAnyFlag(nbl::core::bitflag(AllocFlags::External) | AllocFlags::SubAllocated | AllocFlags::Pinned | AllocFlags::Retired) &&
+					!allocation.dedicated;
+			}
+
 			ResourceAllocator* alctr;
 			MemHeap::Allocation allocation;
 			refctd<nbl::video::IBackendObject> resource;
@@ -273,19 +778,25 @@ namespace kris
 
 			nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> lastAccesses = nbl::asset::ACCESS_FLAGS::NONE;
 			nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> lastStages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE;
+			// RenderGraph pass whose declared accesses already synchronized this resource (see CommandRecorder::graphScope)
+			uint64_t graphScope = 0ULL;
+			// Held by AsyncUploader batches from upload (or release to transfer queue) till acquire, resource must stay in place meanwhile
+			uint32_t asyncUploadPins = 0U;
+
+			// Hashes of contents uploaded through ResourceUtils (buffer pages or image subresources), 0 means unknown.
+			// Must be invalidated whenever the resource is written on GPU by other means.
+			nbl::core::vector<uint64_t> contentHashes;
+			void invalidateContents() { contentHashes.clear(); }
 
 		protected:
 			void deallocateSelf()
 			{
-				KRIS_ASSERT_MSG(resource->getReferenceCount() == 1,
-					"Resource %s refcount in moment of memory deallocation is >1. Deallocating resource's memory before resource itself!",
-					resource->getDebugName());
-				size_t size = this->getSize();
-				resource = nullptr;
 				if (!flags.hasFlags(AllocFlags::External)) // do not deallocate external allocations
 				{
-					alctr->deallocate(this, size);
+					alctr->deallocate(this, this->getBackingSize());
 				}
+				resource = nullptr;
+				alctr->releaseHandle(m_handle);
 			}
 
 			struct View : public nbl::core::IReferenceCounted, public nbl::core::Uncopyable
@@ -303,20 +814,42 @@ namespace kris
 				auto* found = m_views.get(id);
 				if (found)
 				{
-					found->get();
+					s_viewCacheStats.hits++;
+					return found->get();
 				}
+				s_viewCacheStats.misses++;
 				return nullptr;
 			}
 
 			void addView(View::id_t id, refctd<View>&& v)
 			{
+				// LRU entry is dropped when cache is full
+				if (m_viewCount == m_maxViews)
+					s_viewCacheStats.evictions++;
+				else
+					m_viewCount++;
 				m_views.insert(std::move(id), std::move(v));
 			}
 
+			void onRelocated()
+			{
+				m_generation++;
+				// cached views are made of the old resource
+				m_views.clear();
+				m_viewCount = 0U;
+			}
+
 		private:
+			friend class ResourceAllocator;
+
 			static uint64_t static_getNewId();
 
 			uint64_t m_id;
+			Handle m_handle;
+			uint32_t m_generation = 0U;
+			uint32_t m_liveIx = ~0U; // index within ResourceAllocator's live allocations of its pool
+			uint32_t m_maxViews;
+			uint32_t m_viewCount = 0U;
 			nbl::core::LRUCache<View::id_t, refctd<View>> m_views;
 		};
 		struct BufferAllocation final : public Allocation
@@ -350,6 +883,16 @@ namespace kris
 		public:
 			BufferAllocation(ResourceAllocator* a, refctd<nbl::video::IGPUBuffer>&& buf, const MemHeap::Allocation& al, nbl::core::bitflag<AllocFlags> _flags) :
 				Allocation(a, al, std::move(buf), MaxBufferViews, _flags)
+			{
+				m_size = getBuffer()->getSize();
+			}
+			// sub-allocation of slab's backing buffer
+			BufferAllocation(ResourceAllocator* a, BufferSlab* slab, uint32_t slot, size_t offset, size_t size) :
+				Allocation(a, slab->getSubAllocation(offset), refctd<nbl::video::IGPUBuffer>(slab->getBuffer()), MaxBufferViews, AllocFlags::SubAllocated),
+				m_offset(offset),
+				m_size(size),
+				m_slab(slab),
+				m_slabSlot(slot)
 			{
 			}
 			virtual ~BufferAllocation()
@@ -359,6 +902,8 @@ namespace kris
 
 			refctd<nbl::video::IGPUBufferView> getView(nbl::video::ILogicalDevice* device, nbl::asset::E_FORMAT format, uint32_t offset, uint32_t size)
 			{
+				KRIS_ASSERT_MSG(format < (1U << 8) && offset < (1U << 24), "Buffer view description doesn't fit into cache key!");
+
 				BufferViewId id;
 				id.id = 0ULL;
 				id.format = format;
@@ -374,7 +919,7 @@ namespace kris
 				{
 					nbl::asset::SBufferRange<nbl::video::IGPUBuffer> range;
 					range.buffer = refctd<nbl::video::IGPUBuffer>(getBuffer());
-					range.offset = offset;
+					range.offset = getOffset() + offset;
 					range.size = size;
 					bufview = device->createBufferView(range, format);
 					addView(id.id, nbl::core::make_smart_refctd_ptr<BufferView>(id.id, refctd(bufview)));
@@ -383,7 +928,96 @@ namespace kris
 			}
 
 			nbl::video::IGPUBuffer* getBuffer() const { return static_cast<nbl::video::IGPUBuffer*>(resource.get()); }
-			size_t getSize() const override { return getBuffer()->getSize(); }
+			// offset of this resource within getBuffer(), non-zero only for sub-allocated buffers and frame regions other than first one
+			size_t getOffset() const { return m_offset + getFrameRegionOffset(); }
+			// size of one frame region
+			size_t getSize() const override { return m_size; }
+			size_t getBackingSize() const override { return (m_frameRegionCount > 1U) ? m_frameRegionStride * m_frameRegionCount : m_size; }
+			bool isBuffer() const override { return true; }
+
+			// DirectWrite buffers have a region per frame in flight, so CPU can write one while frames in flight read the others.
+			// Commands bind the current one (getOffset()), ResourceAllocator::acquireFrameRegion() switches it.
+			uint32_t getFrameRegionCount() const { return m_frameRegionCount; }
+			uint32_t getFrameRegion() const { return m_frameRegion; }
+			// relative to getMappedPtr(), which points at first region
+			size_t getFrameRegionOffset() const { return m_frameRegion * m_frameRegionStride; }
+			// GPU copies into current region must be done before it's carried over to the next one
+			void markFrameRegionCopied(uint64_t frameVal) { m_frameRegionCopyFrame = frameVal; }
+
+		private:
+			friend class ResourceAllocator;
+
+			size_t m_offset = 0ULL;
+			size_t m_size = 0ULL;
+			BufferSlab* m_slab = nullptr;
+			uint32_t m_slabSlot = ~0U;
+
+			uint32_t m_frameRegionCount = 1U;
+			uint32_t m_frameRegion = 0U;
+			size_t m_frameRegionStride = 0ULL;
+			uint64_t m_frameRegionAcquiredFrame = 0ULL; // frame in which current region was last acquired for writing
+			uint64_t m_frameRegionCopyFrame = 0ULL;
+			uint64_t m_frameRegionLastUse[FramesInFlight] = {}; // last frame which could read the region, for the ones not current
+		};
+
+		// Packs many small same-sized buffers into one backing IGPUBuffer.
+		// Handing out a slot is just popping a free-list, no driver calls involved.
+		class BufferSlab
+		{
+		public:
+			enum : uint32_t
+			{
+				SlabSizeLog2 = 16U,
+				SlabSize = 1U << SlabSizeLog2,
+			};
+
+			BufferSlab(refctd<BufferAllocation>&& backing, uint32_t stride, uint32_t classIx) :
+				m_backing(std::move(backing)),
+				m_stride(stride),
+				m_slotCount(SlabSize / stride),
+				m_classIx(classIx)
+			{
+				m_freeSlots.reserve(m_slotCount);
+				for (uint32_t i = m_slotCount; i > 0U; --i)
+				{
+					m_freeSlots.push_back(i - 1U);
+				}
+			}
+
+			bool isFull() const { return m_freeSlots.empty(); }
+			bool isEmpty() const { return m_freeSlots.size() == m_slotCount; }
+
+			uint32_t allocSlot()
+			{
+				KRIS_ASSERT(!isFull());
+				const uint32_t slot = m_freeSlots.back();
+				m_freeSlots.pop_back();
+				return slot;
+			}
+			void freeSlot(uint32_t slot)
+			{
+				KRIS_ASSERT(slot < m_slotCount);
+				m_freeSlots.push_back(slot);
+			}
+
+			size_t getSlotOffset(uint32_t slot) const { return (size_t)slot * m_stride; }
+			nbl::video::IGPUBuffer* getBuffer() const { return m_backing->getBuffer(); }
+			uint32_t getClassIx() const { return m_classIx; }
+
+			// backing memory binding moved by `offset`, so that mapping works for sub-allocations just like for any other
+			MemHeap::Allocation getSubAllocation(size_t offset) const
+			{
+				MemHeap::Allocation al = m_backing->allocation;
+				al.binding.offset += offset;
+				return al;
+			}
+
+		private:
+			refctd<BufferAllocation> m_backing;
+			uint32_t m_stride;
+			uint32_t m_slotCount;
+			uint32_t m_classIx;
+			nbl::core::vector<uint32_t> m_freeSlots;
 		};
 		struct ImageAllocation final : public Allocation
 		{
@@ -434,6 +1068,9 @@ namespace kris
 				uint32_t mipOffset, uint32_t mipCount,
 				uint32_t layerOffset, uint32_t layerCount)
 			{
+				KRIS_ASSERT_MSG(format < (1U << 8) && aspect.value < (1U << 4) && mipOffset < (1U << 5) && mipCount < (1U << 5) &&
+					layerOffset < (1U << 19) && layerCount < (1U << 20), "Image view description doesn't fit into cache key!");
+
 				ImageViewId id;
 				id.id = 0ULL;
 				id.viewtype = viewtype;
@@ -441,7 +1078,7 @@ namespace kris
 				id.aspect = aspect.value;
 				id.mipOffset = mipOffset;
 				id.mipCount = mipCount;
-				id.layerOffset = layerCount;
+				id.layerOffset = layerOffset;
 				id.layerCount = layerCount;
 
 				refctd<nbl::video::IGPUImageView> imgview = nullptr;
@@ -468,58 +1105,329 @@ namespace kris
 
 			nbl::video::IGPUImage* getImage() const { return static_cast<nbl::video::IGPUImage*>(resource.get()); }
 			size_t getSize() const override { return getImage()->getMemoryReqs().size; }
+			bool isBuffer() const override { return false; }
 
-			nbl::video::IGPUImage::LAYOUT layout = nbl::video::IGPUImage::LAYOUT::UNDEFINED;
-		};
-
-		ResourceAllocator()
-		{
-			for (uint32_t ix = 0U; ix < MaxHeaps; ++ix)
+			// all aspects of the image's format
+			nbl::core::bitflag<nbl::video::IGPUImage::E_ASPECT_FLAGS> getAspectFlags() const
 			{
-				m_heaps[ix].setMemTypeIx(ix);
+				const nbl::asset::E_FORMAT format = getImage()->getCreationParameters().format;
+				if (nbl::asset::isDepthOnlyFormat(format))
+					return nbl::video::IGPUImage::EAF_DEPTH_BIT;
+				else if (nbl::asset::isDepthOrStencilFormat(format))
+					return nbl::core::bitflag<nbl::video::IGPUImage::E_ASPECT_FLAGS>(nbl::video::IGPUImage::EAF_DEPTH_BIT) | nbl::video::IGPUImage::EAF_STENCIL_BIT;
+				return nbl::video::IGPUImage::EAF_COLOR_BIT;
 			}
-		}
 
-		refctd<BufferAllocation> allocBuffer(nbl::video::ILogicalDevice* device, nbl::video::IGPUBuffer::SCreationParams&& params, uint32_t memTypeBitsConstraints, nbl::core::bitflag<AllocFlags> flags = AllocFlags::None)
-		{
-			KRIS_ASSERT(flags == AllocFlags::None);
+			// State of one subresource (mip level of an array layer) as seen by CommandRecorder
+			struct SubresourceState
+			{
+				nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> accesses = nbl::asset::ACCESS_FLAGS::NONE;
+				nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> stages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE;
+				nbl::video::IGPUImage::LAYOUT layout = nbl::video::IGPUImage::LAYOUT::UNDEFINED;
 
-			const size_t size = params.size;
-			refctd<nbl::video::IGPUBuffer> buf = device->createBuffer(std::move(params));
+				bool operator==(const SubresourceState& rhs) const
+				{
+					return accesses == rhs.accesses && stages == rhs.stages && layout == rhs.layout;
+				}
+			};
 
-			nbl::video::IDeviceMemoryBacked::SDeviceMemoryRequirements req = buf->getMemoryReqs();
-			req.memoryTypeBits &= memTypeBitsConstraints;
+			// Usually the whole image is in one state (lastAccesses, lastStages and layout), per-subresource states are kept only
+			// once some subresources are accessed separately, until all of them are in the same state again.
+			// While split, lastAccesses and lastStages are union of all subresources' ones and layout is meaningless.
+			bool isUniform() const { return m_subresStates.empty(); }
+			// Never written (nor transitioned) since creation or relocation
+			bool isUndefined() const { return isUniform() && layout == nbl::video::IGPUImage::LAYOUT::UNDEFINED; }
 
-			const uint32_t memTypeIndex = nbl::hlsl::findLSB(req.memoryTypeBits);
-			MemHeap::Allocation al = m_heaps[memTypeIndex].allocate(device, size, 1U << req.alignmentLog2, false);
+			SubresourceState getState(uint32_t mip, uint32_t layer) const
 			{
-				nbl::video::ILogicalDevice::SBindBufferMemoryInfo info[1];
-				info[0].binding = al.binding;
-				info[0].buffer = buf.get();
-				device->bindBufferMemory(1U, info);
+				if (isUniform())
+					return { lastAccesses, lastStages, layout };
+				return m_subresStates[mip * getImage()->getCreationParameters().arrayLayers + layer];
 			}
+			// Returns false if subresources of the range are not all in the same state
+			bool getState(uint32_t baseMip, uint32_t mipCount, uint32_t baseLayer, uint32_t layerCount, SubresourceState& out_state) const
+			{
+				out_state = getState(baseMip, baseLayer);
+				if (isUniform())
+					return true;
 
-			return nbl::core::make_smart_refctd_ptr<BufferAllocation>(this, std::move(buf), al, flags);
-		}
+				for (uint32_t mip = baseMip; mip < baseMip + mipCount; ++mip)
+				{
+					for (uint32_t layer = baseLayer; layer < baseLayer + layerCount; ++layer)
+					{
+						if (!(getState(mip, layer) == out_state))
+							return false;
+					}
+				}
+				return true;
+			}
 
-		refctd<BufferAllocation> registerExternalBuffer(refctd<nbl::video::IGPUBuffer>&& buffer, nbl::core::bitflag<AllocFlags> flags = AllocFlags::None)
-		{
-			return nbl::core::make_smart_refctd_ptr<BufferAllocation>(this, std::move(buffer), MemHeap::Allocation{}, flags | AllocFlags::External);
-		}
+			void setState(const SubresourceState& state)
+			{
+				m_subresStates.clear();
+				lastAccesses = state.accesses;
+				lastStages = state.stages;
+				layout = state.layout;
+			}
+			void setState(uint32_t baseMip, uint32_t mipCount, uint32_t baseLayer, uint32_t layerCount, const SubresourceState& state)
+			{
+				const auto& params = getImage()->getCreationParameters();
+				KRIS_ASSERT(baseMip + mipCount <= params.mipLevels && baseLayer + layerCount <= params.arrayLayers);
+
+				if (mipCount == params.mipLevels && layerCount == params.arrayLayers)
+				{
+					setState(state);
+					return;
+				}
+				if (isUniform())
+				{
+					if (getState(0U, 0U) == state)
+						return;
+					m_subresStates.assign(params.mipLevels * params.arrayLayers, getState(0U, 0U));
+				}
+
+				for (uint32_t mip = baseMip; mip < baseMip + mipCount; ++mip)
+				{
+					std::fill_n(m_subresStates.begin() + mip * params.arrayLayers + baseLayer, layerCount, state);
+				}
+				lastAccesses |= state.accesses;
+				lastStages |= state.stages;
+
+				if (std::all_of(m_subresStates.begin(), m_subresStates.end(), [&state](const SubresourceState& s) { return s == state; }))
+				{
+					setState(state);
+				}
+			}
+
+			// Relocation (see ResourceAllocator::relocateImage()) hands the state over to the retired image
+			void moveStateTo(ImageAllocation* other)
+			{
+				other->lastAccesses = lastAccesses;
+				other->lastStages = lastStages;
+				other->layout = layout;
+				other->m_subresStates = std::move(m_subresStates);
+				setState(SubresourceState{});
+			}
+
+			nbl::video::IGPUImage::LAYOUT layout = nbl::video::IGPUImage::LAYOUT::UNDEFINED;
+
+		private:
+			nbl::core::vector<SubresourceState> m_subresStates; // mip-major, empty while uniform
+		};
+
+		// Accounting of physical device memory heap, aggregated over all memory types living in it
+		struct DeviceHeapStats
+		{
+			size_t size = 0ULL;
+			size_t softLimit = 0ULL;
+			size_t reservedBytes = 0ULL;
+			size_t usedBytes = 0ULL;
+			size_t dedicatedBytes = 0ULL;
+			uint32_t poolCount = 0U;
+			uint32_t poolsCreated = 0U;
+			uint32_t poolsDestroyed = 0U;
+		};
+		// Called once reserved memory of device heap crosses its soft limit, won't be called again until it drops below
+		using over_budget_callback_t = std::function<void(uint32_t deviceHeapIx, const DeviceHeapStats& stats)>;
+
+		explicit ResourceAllocator(MemPool::EBackend backend = MemPool::EBackend::TLSF)
+		{
+			for (uint32_t ix = 0U; ix < MaxHeaps; ++ix)
+			{
+				m_heaps[ix].setMemTypeIx(ix);
+				m_heaps[ix].setBackend(backend);
+			}
+		}
+
+		// Soft limit of each device heap is `budgetFraction` of its size.
+		// Without init() no budgeting is done and the first allowed memory type is always picked.
+		void init(nbl::video::ILogicalDevice* device, float budgetFraction = 0.8f)
+		{
+			const auto& memprops = device->getPhysicalDevice()->getMemoryProperties();
+
+			m_memTypeCount = memprops.memoryTypeCount;
+			for (uint32_t ix = 0U; ix < m_memTypeCount; ++ix)
+			{
+				m_memTypeHeapIx[ix] = memprops.memoryTypes[ix].heapIndex;
+			}
+			m_deviceHeapCount = memprops.memoryHeapCount;
+			for (uint32_t ix = 0U; ix < m_deviceHeapCount; ++ix)
+			{
+				auto& heap = m_deviceHeaps[ix];
+				heap.size = memprops.memoryHeaps[ix].size;
+				heap.softLimit = (size_t)((double)heap.size * budgetFraction);
+				heap.overBudget = false;
+			}
+
+			const auto* physDev = device->getPhysicalDevice();
+			m_directWriteMemTypeBits = physDev->getDeviceLocalMemoryTypeBits() & physDev->getHostVisibleMemoryTypeBits();
+		}
+
+		// Memory types usable for AllocFlags::DirectWrite, 0 if there are none (or before init())
+		uint32_t getDirectWriteMemTypeBits() const { return m_directWriteMemTypeBits; }
+		// Device local host visible memory is often small (256M BAR without resizable BAR), so direct write buffers
+		// are limited to `budget` bytes in total, the ones over it are placed as if the flag wasn't there.
+		void setDirectWriteBudget(size_t budget) { m_directWriteBudget = budget; }
+		size_t getDirectWriteBytes() const { return m_directWriteBytes; }
+
+		void setOverBudgetCallback(over_budget_callback_t&& cb) { m_overBudgetCb = std::move(cb); }
+
+		void setRetentionPolicy(const MemHeap::RetentionPolicy& policy)
+		{
+			for (auto& heap : m_heaps)
+			{
+				heap.setRetentionPolicy(policy);
+			}
+		}
+
+		// Must be called once per frame, `frame` being monotonically increasing frame counter
+		void endFrame(uint64_t frame)
+		{
+			for (uint32_t ix = 0U; ix < MaxHeaps; ++ix)
+			{
+				m_heaps[ix].endFrame(frame);
+				updateBudgetState(ix);
+			}
+		}
+
+		MemHeap::Stats getMemTypeStats(uint32_t memTypeIx) const { return m_heaps[memTypeIx].getStats(); }
+
+		DeviceHeapStats getDeviceHeapStats(uint32_t deviceHeapIx) const
+		{
+			KRIS_ASSERT(deviceHeapIx < m_deviceHeapCount);
+
+			DeviceHeapStats stats;
+			stats.size = m_deviceHeaps[deviceHeapIx].size;
+			stats.softLimit = m_deviceHeaps[deviceHeapIx].softLimit;
+			for (uint32_t ix = 0U; ix < m_memTypeCount; ++ix)
+			{
+				if (m_memTypeHeapIx[ix] != deviceHeapIx)
+					continue;
+
+				const MemHeap::Stats mt = m_heaps[ix].getStats();
+				stats.reservedBytes += mt.reservedBytes;
+				stats.usedBytes += mt.usedBytes;
+				stats.dedicatedBytes += mt.dedicatedBytes;
+				stats.poolCount += mt.poolCount + mt.dedicatedCount;
+				stats.poolsCreated += mt.poolsCreated;
+				stats.poolsDestroyed += mt.poolsDestroyed;
+			}
+			return stats;
+		}
+		uint32_t getDeviceHeapCount() const { return m_deviceHeapCount; }
+
+		// GPU must be idle by now
+		~ResourceAllocator()
+		{
+			// slabs' backing buffers must not end up pending either
+			m_completedFrame = ~0ULL;
+			collectGarbage(m_completedFrame);
+
+			for (auto& sc : m_slabClasses)
+			{
+				for (BufferSlab* slab : sc.slabs)
+				{
+					KRIS_ASSERT_MSG(slab->isEmpty(), "Destroying ResourceAllocator while sub-allocated buffers are still alive!");
+					KRIS_MEM_DELETE(slab);
+				}
+			}
+		}
+
+		refctd<BufferAllocation> allocBuffer(nbl::video::ILogicalDevice* device, nbl::video::IGPUBuffer::SCreationParams&& params, uint32_t memTypeBitsConstraints, nbl::core::bitflag<AllocFlags> flags = AllocFlags::None)
+		{
+			KRIS_ASSERT(!flags.hasAnyFlag(nbl::core::bitflag(AllocFlags::External) | AllocFlags::SubAllocated | AllocFlags::Retired));
+
+			if (flags.hasFlags(AllocFlags::DirectWrite))
+			{
+				const uint32_t directBits = memTypeBitsConstraints & m_directWriteMemTypeBits;
+				const size_t size = params.size;
+				const size_t stride = (size + FrameRegionAlignment - 1ULL) & ~(FrameRegionAlignment - 1ULL);
+				const size_t backingSize = stride * FramesInFlight;
+				if (directBits && m_directWriteBytes + backingSize <= m_directWriteBudget)
+				{
+					// never sub-allocated, slab's memory type is chosen by first buffer of its class
+					params.size = backingSize;
+					refctd<BufferAllocation> allocation = allocPlacedBuffer(device, std::move(params), directBits, flags | AllocFlags::Pinned);
+					if (allocation)
+					{
+						allocation->m_size = size;
+						allocation->m_frameRegionCount = FramesInFlight;
+						allocation->m_frameRegionStride = stride;
+						m_directWriteBytes += backingSize;
+					}
+					return allocation;
+				}
+				flags = static_cast<AllocFlags>(flags.value & ~AllocFlags::DirectWrite);
+			}
+
+			if (params.size <= MaxSlabAllocSize && !flags.hasFlags(AllocFlags::Dedicated))
+			{
+				return allocSlabBuffer(device, std::move(params), memTypeBitsConstraints);
+			}
+
+			return allocPlacedBuffer(device, std::move(params), memTypeBitsConstraints, flags);
+		}
+
+		refctd<BufferAllocation> registerExternalBuffer(refctd<nbl::video::IGPUBuffer>&& buffer, nbl::core::bitflag<AllocFlags> flags = AllocFlags::None)
+		{
+			return nbl::core::make_smart_refctd_ptr<BufferAllocation>(this, std::move(buffer), MemHeap::Allocation{}, flags | AllocFlags::External);
+		}
 
 		refctd<ImageAllocation> allocImage(nbl::video::ILogicalDevice* device, nbl::video::IGPUImage::SCreationParams&& params, uint32_t memTypeBitsConstraints, nbl::core::bitflag<AllocFlags> flags = AllocFlags::None)
 		{
-			KRIS_ASSERT(flags == AllocFlags::None);
+			KRIS_ASSERT(!flags.hasAnyFlag(nbl::core::bitflag(AllocFlags::External) | AllocFlags::SubAllocated | AllocFlags::Retired));
 
+			const auto usage = params.usage | params.depthUsage | params.stencilUsage;
 			refctd<nbl::video::IGPUImage> img = device->createImage(std::move(params));
 
 			nbl::video::IDeviceMemoryBacked::SDeviceMemoryRequirements req = img->getMemoryReqs();
 			req.memoryTypeBits &= memTypeBitsConstraints;
 
 			const size_t size = img->getMemoryReqs().size;
+			const bool dedicated = shouldBeDedicated(req, flags, size, usage.hasFlags(nbl::asset::IImage::EUF_RENDER_ATTACHMENT_BIT));
+
+			const bool aliasable = flags.hasFlags(AllocFlags::Aliasable);
+			KRIS_ASSERT_MSG(!(aliasable && req.requiresDedicatedAllocation), "Image requiring dedicated allocation can't share its memory!");
+			if (aliasable)
+				flags |= AllocFlags::Pinned;
+
+			const uint32_t memTypeIndex = chooseMemType(req.memoryTypeBits, size);
+			MemHeap::Allocation al = m_heaps[memTypeIndex].allocate(device, size, req.size, 1U << req.alignmentLog2, dedicated, aliasable ? nullptr : img.get());
+			updateBudgetState(memTypeIndex);
+			{
+				nbl::video::ILogicalDevice::SBindImageMemoryInfo info[1];
+				info[0].binding = al.binding;
+				info[0].image = img.get();
+				device->bindImageMemory(1U, info);
+			}
+
+			auto allocation = nbl::core::make_smart_refctd_ptr<ImageAllocation>(this, std::move(img), al, flags);
+			registerLive(allocation.get());
+
+			return allocation;
+		}
+
+		// Image bound to memory of `owner` (allocated with AllocFlags::Aliasable) instead of memory of its own,
+		// contents of both are undefined once either of them is written. The alias doesn't keep the memory alive,
+		// owner must outlive it and be marked used whenever the alias is.
+		// Returns null if the image's memory requirements don't fit into owner's memory.
+		refctd<ImageAllocation> allocAliasedImage(nbl::video::ILogicalDevice* device, nbl::video::IGPUImage::SCreationParams&& params, ImageAllocation* owner)
+		{
+			KRIS_ASSERT(owner->flags.hasFlags(AllocFlags::Aliasable));
+
+			refctd<nbl::video::IGPUImage> img = device->createImage(std::move(params));
+			if (!img)
+				return nullptr;
+
+			const nbl::video::IDeviceMemoryBacked::SDeviceMemoryRequirements req = img->getMemoryReqs();
+			const MemHeap::Allocation& al = owner->allocation;
+			const bool fits = (req.memoryTypeBits & (1U << al.memTypeIx)) &&
+				!req.requiresDedicatedAllocation &&
+				req.size <= owner->getSize() &&
+				(al.binding.offset & ((1ULL << req.alignmentLog2) - 1ULL)) == 0ULL;
+			if (!fits)
+				return nullptr;
 
-			const uint32_t memTypeIndex = nbl::hlsl::findLSB(req.memoryTypeBits);
-			MemHeap::Allocation al = m_heaps[memTypeIndex].allocate(device, size, 1U << req.alignmentLog2, false);
 			{
 				nbl::video::ILogicalDevice::SBindImageMemoryInfo info[1];
 				info[0].binding = al.binding;
@@ -527,7 +1435,7 @@ namespace kris
 				device->bindImageMemory(1U, info);
 			}
 
-			return nbl::core::make_smart_refctd_ptr<ImageAllocation>(this, std::move(img), al, flags);
+			return nbl::core::make_smart_refctd_ptr<ImageAllocation>(this, std::move(img), MemHeap::Allocation{}, nbl::core::bitflag(AllocFlags::External) | AllocFlags::Pinned);
 		}
 
 		refctd<ImageAllocation> registerExternalImage(refctd<nbl::video::IGPUImage>&& image, nbl::core::bitflag<AllocFlags> flags = AllocFlags::None)
@@ -535,23 +1443,556 @@ namespace kris
 			return nbl::core::make_smart_refctd_ptr<ImageAllocation>(this, std::move(image), MemHeap::Allocation{}, flags | AllocFlags::External);
 		}
 
+		// Memory (and resource object) is released right away only if GPU is done with the last frame which used `al`,
+		// otherwise it's kept pending until collectGarbage() learns that frame has completed.
 		void deallocate(Allocation* al, size_t size)
 		{
 			KRIS_ASSERT(al != nullptr);
 			KRIS_ASSERT(al->isValidForDeallocation());
 
-			m_heaps[al->allocation.memTypeIx].deallocate(al->allocation, size);
+			if (al->m_liveIx != ~0U)
+			{
+				unregisterLive(al);
+			}
+
+			if (al->flags.hasFlags(AllocFlags::DirectWrite))
+			{
+				KRIS_ASSERT(m_directWriteBytes >= size);
+				m_directWriteBytes -= size;
+			}
+
+			PendingFree pf;
+			pf.frame = m_handleSlots[al->m_handle.index].lastUsedFrame;
+			pf.resource = std::move(al->resource);
+			pf.allocation = al->allocation;
+			pf.size = size;
+			if (al->flags.hasFlags(AllocFlags::SubAllocated))
+			{
+				BufferAllocation* const buf = static_cast<BufferAllocation*>(al);
+				pf.slab = buf->m_slab;
+				pf.slabSlot = buf->m_slabSlot;
+				buf->m_slab = nullptr;
+			}
+
+			if (pf.frame > m_completedFrame)
+			{
+				m_pendingFrees.push_back(std::move(pf));
+			}
+			else
+			{
+				// sub-allocated buffers share backing buffer with its slab and other sub-allocations,
+				// retired ones may still be referenced by descriptor sets which are patched lazily
+				KRIS_ASSERT_MSG(al->flags.hasAnyFlag(nbl::core::bitflag(AllocFlags::SubAllocated) | AllocFlags::Retired) || pf.resource->getReferenceCount() == 1,
+					"Resource %s refcount in moment of memory deallocation is >1. Deallocating resource's memory before resource itself!",
+					pf.resource->getDebugName());
+				freePending(pf);
+			}
+
 			al->allocation.binding.memory = nullptr;
 			al->allocation.pool = nullptr;
+			al->allocation.dedicatedMemory = nullptr;
+			al->allocation.mappedBase = nullptr;
 			al->allocation.memTypeIx = 32U;
 		}
 
+		// Flushes/invalidates all the ranges with one driver call, ranges in host coherent memory are skipped.
+		// Ranges are expanded to nonCoherentAtomSize as required by Vulkan.
+		static bool flushMappedRanges(nbl::video::ILogicalDevice* device, uint32_t count, const MappedRange* ranges)
+		{
+			nbl::core::vector<nbl::video::ILogicalDevice::MappedMemoryRange> memranges;
+			if (!getNonCoherentRanges(device, count, ranges, memranges))
+				return true;
+			return device->flushMappedMemoryRanges((uint32_t)memranges.size(), memranges.data());
+		}
+		static bool invalidateMappedRanges(nbl::video::ILogicalDevice* device, uint32_t count, const MappedRange* ranges)
+		{
+			nbl::core::vector<nbl::video::ILogicalDevice::MappedMemoryRange> memranges;
+			if (!getNonCoherentRanges(device, count, ranges, memranges))
+				return true;
+			return device->invalidateMappedMemoryRanges((uint32_t)memranges.size(), memranges.data());
+		}
+
+		// Frees everything whose last use was in frame not newer than `completedFrame`,
+		// i.e. value the GPU has already signalled on Renderer's frame timeline.
+		void collectGarbage(uint64_t completedFrame)
+		{
+			m_completedFrame = completedFrame;
+			for (size_t i = 0ULL; i < m_pendingFrees.size();)
+			{
+				if (m_pendingFrees[i].frame <= completedFrame)
+				{
+					freePending(m_pendingFrees[i]);
+					m_pendingFrees[i] = std::move(m_pendingFrees.back());
+					m_pendingFrees.pop_back();
+				}
+				else
+				{
+					++i;
+				}
+			}
+		}
+
+		// nullptr if allocation the handle refers to is already dead
+		Allocation* resolve(Handle h) const
+		{
+			if (h.index >= (uint32_t)m_handleSlots.size())
+				return nullptr;
+			const HandleSlot& slot = m_handleSlots[h.index];
+			return (slot.generation == h.generation) ? slot.allocation : nullptr;
+		}
+		// Records that GPU accesses the allocation in `frame` (Renderer's frame timeline value).
+		// Hot path of command recording: just a store into the dense table, no refcounting. Stale handles are ignored.
+		void markUsed(Handle h, uint64_t frame)
+		{
+			KRIS_ASSERT(h.index < (uint32_t)m_handleSlots.size());
+			HandleSlot& slot = m_handleSlots[h.index];
+			if (slot.generation == h.generation)
+				slot.lastUsedFrame = frame;
+		}
+		uint64_t getLastUsedFrame(Handle h) const
+		{
+			KRIS_ASSERT(resolve(h));
+			return m_handleSlots[h.index].lastUsedFrame;
+		}
+
+		// Makes current the frame region of DirectWrite buffer CPU can write in frame `frameVal` without racing frames in flight:
+		// current one if none of them reads it, otherwise one which isn't read anymore. Then content of the previous region
+		// is copied to the new one if `keepContent`, and the generation is bumped so that descriptor sets pick the new offset up,
+		// hence it must be called before the frame binds the buffer. Later calls in the same frame keep the region.
+		// Returns false if every region may still be in use by GPU.
+		bool acquireFrameRegion(BufferAllocation* buf, uint64_t frameVal, bool keepContent)
+		{
+			KRIS_ASSERT(buf->isDirectlyWritable() && buf->m_frameRegionCount > 1U);
+
+			const uint64_t lastUsed = getLastUsedFrame(buf->getHandle());
+			if (buf->m_frameRegionAcquiredFrame == frameVal || lastUsed <= m_completedFrame)
+			{
+				buf->m_frameRegionAcquiredFrame = frameVal;
+				return true;
+			}
+			if (keepContent && buf->m_frameRegionCopyFrame > m_completedFrame)
+				return false;
+
+			for (uint32_t i = 1U; i < buf->m_frameRegionCount; ++i)
+			{
+				const uint32_t region = (buf->m_frameRegion + i) % buf->m_frameRegionCount;
+				if (buf->m_frameRegionLastUse[region] > m_completedFrame)
+					continue;
+
+				if (keepContent)
+				{
+					uint8_t* const base = reinterpret_cast<uint8_t*>(buf->getMappedPtr());
+					memcpy(base + region * buf->m_frameRegionStride, base + buf->getFrameRegionOffset(), buf->getSize());
+				}
+				buf->m_frameRegionLastUse[buf->m_frameRegion] = lastUsed;
+				buf->m_frameRegion = region;
+				buf->m_frameRegionAcquiredFrame = frameVal;
+				buf->onRelocated();
+				return true;
+			}
+			return false;
+		}
+		uint32_t getPendingFreeCount() const { return (uint32_t)m_pendingFrees.size(); }
+		// Last frame GPU is known to be done with, as of the last collectGarbage()
+		uint64_t getCompletedFrame() const { return m_completedFrame; }
+
+		// Heap-placed (non-external, non-sub-allocated) allocations living in `pool`, null pool gives dedicated ones
+		const nbl::core::vector<Allocation*>& getLiveAllocations(const MemPool* pool) const
+		{
+			static const nbl::core::vector<Allocation*> none;
+			auto found = m_liveAllocs.find(pool);
+			return (found != m_liveAllocs.end()) ? found->second : none;
+		}
+
+		// Recreates movable buffer in other memory of the same heap (only existing pools are considered, evacuating ones skipped).
+		// `buf` keeps its identity, but gets new IGPUBuffer and memory. The old ones are returned as Retired allocation
+		// which inherits last use frame of `buf`, so its memory outlives the frames in flight. Returns nullptr if there was no space.
+		refctd<BufferAllocation> relocateBuffer(nbl::video::ILogicalDevice* device, BufferAllocation* buf)
+		{
+			KRIS_ASSERT(buf->isMovable());
+
+			nbl::video::IGPUBuffer* const oldbuf = buf->getBuffer();
+
+			nbl::video::IGPUBuffer::SCreationParams params = {};
+			params.size = oldbuf->getSize();
+			params.usage = oldbuf->getCreationParams().usage;
+			refctd<nbl::video::IGPUBuffer> newbuf = device->createBuffer(std::move(params));
+			newbuf->setObjectDebugName(oldbuf->getDebugName());
+
+			const auto req = newbuf->getMemoryReqs();
+			KRIS_ASSERT(req.memoryTypeBits & (1U << buf->allocation.memTypeIx));
+			MemHeap::Allocation al = m_heaps[buf->allocation.memTypeIx].allocatePlaced(buf->getSize(), req.size, 1U << req.alignmentLog2);
+			if (!al.isValid())
+			{
+				return nullptr;
+			}
+			updateBudgetState(al.memTypeIx);
+			{
+				nbl::video::ILogicalDevice::SBindBufferMemoryInfo info[1];
+				info[0].binding = al.binding;
+				info[0].buffer = newbuf.get();
+				device->bindBufferMemory(1U, info);
+			}
+
+			auto retired = nbl::core::make_smart_refctd_ptr<BufferAllocation>(this, 
+				nbl::core::smart_refctd_ptr_static_cast<nbl::video::IGPUBuffer>(std::move(buf->resource)), buf->allocation, AllocFlags::Retired);
+			retired->lastAccesses = buf->lastAccesses;
+			retired->lastStages = buf->lastStages;
+			m_handleSlots[retired->m_handle.index].lastUsedFrame = m_handleSlots[buf->m_handle.index].lastUsedFrame;
+
+			unregisterLive(buf);
+			buf->resource = std::move(newbuf);
+			buf->allocation = al;
+			registerLive(buf);
+			buf->lastAccesses = nbl::asset::ACCESS_FLAGS::NONE;
+			buf->lastStages = nbl::asset::PIPELINE_STAGE_FLAGS::NONE;
+			buf->onRelocated();
+
+			return retired;
+		}
+
+		// Same as relocateBuffer(), new image starts in UNDEFINED layout
+		refctd<ImageAllocation> relocateImage(nbl::video::ILogicalDevice* device, ImageAllocation* img)
+		{
+			KRIS_ASSERT(img->isMovable());
+
+			nbl::video::IGPUImage* const oldimg = img->getImage();
+
+			nbl::video::IGPUImage::SCreationParams params = {};
+			static_cast<nbl::asset::IImage::SCreationParams&>(params) = oldimg->getCreationParameters();
+			refctd<nbl::video::IGPUImage> newimg = device->createImage(std::move(params));
+			newimg->setObjectDebugName(oldimg->getDebugName());
+
+			const auto req = newimg->getMemoryReqs();
+			KRIS_ASSERT(req.memoryTypeBits & (1U << img->allocation.memTypeIx));
+			MemHeap::Allocation al = m_heaps[img->allocation.memTypeIx].allocatePlaced(req.size, req.size, 1U << req.alignmentLog2);
+			if (!al.isValid())
+			{
+				return nullptr;
+			}
+			updateBudgetState(al.memTypeIx);
+			{
+				nbl::video::ILogicalDevice::SBindImageMemoryInfo info[1];
+				info[0].binding = al.binding;
+				info[0].image = newimg.get();
+				device->bindImageMemory(1U, info);
+			}
+
+			auto retired = nbl::core::make_smart_refctd_ptr<ImageAllocation>(this, 
+				nbl::core::smart_refctd_ptr_static_cast<nbl::video::IGPUImage>(std::move(img->resource)), img->allocation, AllocFlags::Retired);
+			img->moveStateTo(retired.get());
+			m_handleSlots[retired->m_handle.index].lastUsedFrame = m_handleSlots[img->m_handle.index].lastUsedFrame;
+
+			unregisterLive(img);
+			img->resource = std::move(newimg);
+			img->allocation = al;
+			registerLive(img);
+			img->onRelocated();
+
+			return retired;
+		}
+
 		std::array<MemHeap, MaxHeaps> m_heaps;
+
+	private:
+		// returns false if there's nothing to flush/invalidate
+		static bool getNonCoherentRanges(nbl::video::ILogicalDevice* device, uint32_t count, const MappedRange* ranges, nbl::core::vector<nbl::video::ILogicalDevice::MappedMemoryRange>& out)
+		{
+			const size_t atom = device->getPhysicalDevice()->getLimits().nonCoherentAtomSize;
+
+			out.reserve(count);
+			for (uint32_t i = 0U; i < count; ++i)
+			{
+				const MappedRange& r = ranges[i];
+				nbl::video::IDeviceMemoryAllocation* const mem = r.allocation->allocation.binding.memory;
+				if (mem->getMemoryPropertyFlags().hasFlags(nbl::video::IDeviceMemoryAllocation::EMPF_HOST_COHERENT_BIT))
+					continue;
+
+				const size_t begin = nbl::core::alignDown(r.allocation->allocation.binding.offset + r.offset, atom);
+				const size_t end = std::min<size_t>(nbl::core::alignUp(r.allocation->allocation.binding.offset + r.offset + r.size, atom), mem->getAllocationSize());
+				out.emplace_back(mem, begin, end - begin);
+			}
+			return !out.empty();
+		}
+
+		struct DeviceHeap
+		{
+			size_t size = 0ULL;
+			size_t softLimit = 0ULL;
+			bool overBudget = false;
+		};
+
+		static bool shouldBeDedicated(const nbl::video::IDeviceMemoryBacked::SDeviceMemoryRequirements& req, nbl::core::bitflag<AllocFlags> flags, size_t size, bool isRenderAttachment)
+		{
+			if (flags.hasFlags(AllocFlags::Dedicated) || req.requiresDedicatedAllocation)
+				return true;
+			return req.prefersDedicatedAllocation && (isRenderAttachment || size >= MinPreferredDedicatedSize);
+		}
+
+		size_t getDeviceHeapReservedSize(uint32_t deviceHeapIx) const
+		{
+			size_t reserved = 0ULL;
+			for (uint32_t ix = 0U; ix < m_memTypeCount; ++ix)
+			{
+				if (m_memTypeHeapIx[ix] == deviceHeapIx)
+					reserved += m_heaps[ix].getReservedSize();
+			}
+			return reserved;
+		}
+
+		// First allowed memory type whose device heap stays within soft limit, 
+		// if all of them are over budget, the first one anyway and let the driver decide.
+		uint32_t chooseMemType(uint32_t memTypeBits, size_t size) const
+		{
+			KRIS_ASSERT_MSG(memTypeBits, "No memory type satisfies both resource requirements and constraints!");
+
+			for (uint32_t bits = memTypeBits; bits && m_deviceHeapCount; bits &= bits - 1U)
+			{
+				const uint32_t ix = nbl::hlsl::findLSB(bits);
+				const uint32_t heapIx = m_memTypeHeapIx[ix];
+				if (getDeviceHeapReservedSize(heapIx) + size <= m_deviceHeaps[heapIx].softLimit)
+				{
+					return ix;
+				}
+			}
+			return nbl::hlsl::findLSB(memTypeBits);
+		}
+
+		void updateBudgetState(uint32_t memTypeIx)
+		{
+			if (memTypeIx >= m_memTypeCount)
+				return;
+
+			const uint32_t heapIx = m_memTypeHeapIx[memTypeIx];
+			auto& heap = m_deviceHeaps[heapIx];
+			const bool overBudget = getDeviceHeapReservedSize(heapIx) > heap.softLimit;
+			if (overBudget && !heap.overBudget && m_overBudgetCb)
+			{
+				m_overBudgetCb(heapIx, getDeviceHeapStats(heapIx));
+			}
+			heap.overBudget = overBudget;
+		}
+
+		struct HandleSlot
+		{
+			Allocation* allocation = nullptr;
+			uint32_t generation = 0U;
+			uint64_t lastUsedFrame = 0ULL;
+		};
+
+		Handle createHandle(Allocation* al)
+		{
+			uint32_t ix;
+			if (!m_freeHandleSlots.empty())
+			{
+				ix = m_freeHandleSlots.back();
+				m_freeHandleSlots.pop_back();
+			}
+			else
+			{
+				ix = (uint32_t)m_handleSlots.size();
+				m_handleSlots.emplace_back();
+			}
+
+			HandleSlot& slot = m_handleSlots[ix];
+			slot.allocation = al;
+			slot.lastUsedFrame = 0ULL;
+			return { ix, slot.generation };
+		}
+		void releaseHandle(Handle h)
+		{
+			KRIS_ASSERT(resolve(h));
+			HandleSlot& slot = m_handleSlots[h.index];
+			slot.allocation = nullptr;
+			slot.generation++;
+			m_freeHandleSlots.push_back(h.index);
+		}
+
+		// Memory of dead allocation still possibly accessed by GPU
+		struct PendingFree
+		{
+			uint64_t frame = 0ULL;
+			refctd<nbl::video::IBackendObject> resource;
+			MemHeap::Allocation allocation;
+			size_t size = 0ULL;
+			BufferSlab* slab = nullptr; // only for sub-allocated buffers
+			uint32_t slabSlot = ~0U;
+		};
+
+		void freePending(PendingFree& pf)
+		{
+			pf.resource = nullptr;
+			if (pf.slab)
+			{
+				freeSlabSlot(pf.slab, pf.slabSlot);
+			}
+			else
+			{
+				const uint32_t memTypeIx = pf.allocation.memTypeIx;
+				m_heaps[memTypeIx].deallocate(pf.allocation, pf.size);
+				updateBudgetState(memTypeIx);
+			}
+			pf.allocation = {};
+		}
+
+		void registerLive(Allocation* al)
+		{
+			auto& live = m_liveAllocs[al->allocation.pool];
+			al->m_liveIx = (uint32_t)live.size();
+			live.push_back(al);
+		}
+		void unregisterLive(Allocation* al)
+		{
+			auto found = m_liveAllocs.find(al->allocation.pool);
+			KRIS_ASSERT(found != m_liveAllocs.end());
+			auto& live = found->second;
+			KRIS_ASSERT(live[al->m_liveIx] == al);
+			Allocation* last = live.back();
+			live[al->m_liveIx] = last;
+			last->m_liveIx = al->m_liveIx;
+			live.pop_back();
+			al->m_liveIx = ~0U;
+			// pool might be destroyed and its address reused
+			if (live.empty())
+				m_liveAllocs.erase(found);
+		}
+
+		struct SlabClass
+		{
+			nbl::core::bitflag<nbl::asset::IBuffer::E_USAGE_FLAGS> usage;
+			uint32_t memTypeBitsConstraints;
+			uint32_t stride;
+			nbl::core::vector<BufferSlab*> slabs;
+		};
+
+		static uint32_t getSlabStride(nbl::video::ILogicalDevice* device, size_t size, nbl::core::bitflag<nbl::asset::IBuffer::E_USAGE_FLAGS> usage)
+		{
+			const auto& limits = device->getPhysicalDevice()->getLimits();
+
+			uint32_t stride = std::max<uint32_t>(nbl::core::roundUpToPoT((uint32_t)size), MinSlabStride);
+			// sub-allocations must be usable as descriptor offsets
+			if (usage.hasFlags(nbl::asset::IBuffer::EUF_UNIFORM_BUFFER_BIT))
+				stride = std::max<uint32_t>(stride, limits.minUBOAlignment);
+			if (usage.hasFlags(nbl::asset::IBuffer::EUF_STORAGE_BUFFER_BIT))
+				stride = std::max<uint32_t>(stride, limits.minSSBOAlignment);
+			if (usage.hasAnyFlag(nbl::core::bitflag(nbl::asset::IBuffer::EUF_UNIFORM_TEXEL_BUFFER_BIT) | nbl::asset::IBuffer::EUF_STORAGE_TEXEL_BUFFER_BIT))
+				stride = std::max<uint32_t>(stride, limits.minTexelBufferOffsetAlignment);
+
+			return stride;
+		}
+
+		refctd<BufferAllocation> allocSlabBuffer(nbl::video::ILogicalDevice* device, nbl::video::IGPUBuffer::SCreationParams&& params, uint32_t memTypeBitsConstraints)
+		{
+			const size_t size = params.size;
+			const uint32_t stride = getSlabStride(device, size, params.usage);
+
+			uint32_t classIx = 0U;
+			for (; classIx < (uint32_t)m_slabClasses.size(); ++classIx)
+			{
+				const auto& sc = m_slabClasses[classIx];
+				if (sc.usage == params.usage && sc.memTypeBitsConstraints == memTypeBitsConstraints && sc.stride == stride)
+					break;
+			}
+			if (classIx == (uint32_t)m_slabClasses.size())
+			{
+				m_slabClasses.push_back({ .usage = params.usage, .memTypeBitsConstraints = memTypeBitsConstraints, .stride = stride });
+			}
+			auto& sc = m_slabClasses[classIx];
+
+			BufferSlab* slab = nullptr;
+			for (BufferSlab* s : sc.slabs)
+			{
+				if (!s->isFull())
+				{
+					slab = s;
+					break;
+				}
+			}
+			if (!slab)
+			{
+				params.size = BufferSlab::SlabSize;
+				// sub-allocations keep pointers to backing buffer, so it can never be moved
+				auto backing = allocPlacedBuffer(device, std::move(params), memTypeBitsConstraints, AllocFlags::Pinned);
+				slab = KRIS_MEM_NEW BufferSlab(std::move(backing), stride, classIx);
+				sc.slabs.push_back(slab);
+			}
+
+			const uint32_t slot = slab->allocSlot();
+			return nbl::core::make_smart_refctd_ptr<BufferAllocation>(this, slab, slot, slab->getSlotOffset(slot), size);
+		}
+
+		void freeSlabSlot(BufferSlab* slab, uint32_t slot)
+		{
+			slab->freeSlot(slot);
+
+			// keep at least one slab per class around, so that alloc/free ping-pong doesn't hit the driver
+			auto& sc = m_slabClasses[slab->getClassIx()];
+			if (slab->isEmpty() && sc.slabs.size() > 1U)
+			{
+				auto found_it = std::find(sc.slabs.begin(), sc.slabs.end(), slab);
+				KRIS_ASSERT(found_it != sc.slabs.end());
+				sc.slabs.erase(found_it);
+				KRIS_MEM_DELETE(slab);
+			}
+		}
+
+		refctd<BufferAllocation> allocPlacedBuffer(nbl::video::ILogicalDevice* device, nbl::video::IGPUBuffer::SCreationParams&& params, uint32_t memTypeBitsConstraints, nbl::core::bitflag<AllocFlags> flags)
+		{
+			const size_t size = params.size;
+			refctd<nbl::video::IGPUBuffer> buf = device->createBuffer(std::move(params));
+			if (!buf)
+				return nullptr;
+
+			nbl::video::IDeviceMemoryBacked::SDeviceMemoryRequirements req = buf->getMemoryReqs();
+			req.memoryTypeBits &= memTypeBitsConstraints;
+
+			// buffer's size is what counts as used, memory requirements' one (possibly padded by the driver) is what gets allocated
+			const bool dedicated = shouldBeDedicated(req, flags, req.size, false);
+
+			const uint32_t memTypeIndex = chooseMemType(req.memoryTypeBits, req.size);
+			MemHeap::Allocation al = m_heaps[memTypeIndex].allocate(device, size, req.size, 1U << req.alignmentLog2, dedicated, buf.get());
+			updateBudgetState(memTypeIndex);
+			{
+				nbl::video::ILogicalDevice::SBindBufferMemoryInfo info[1];
+				info[0].binding = al.binding;
+				info[0].buffer = buf.get();
+				device->bindBufferMemory(1U, info);
+			}
+
+			auto allocation = nbl::core::make_smart_refctd_ptr<BufferAllocation>(this, std::move(buf), al, flags);
+			registerLive(allocation.get());
+
+			return allocation;
+		}
+
+		static ViewCacheStats s_viewCacheStats;
+
+		nbl::core::vector<SlabClass> m_slabClasses;
+		// per pool, so that defragmenter doesn't have to go through all of them
+		nbl::core::unordered_map<const MemPool*, nbl::core::vector<Allocation*>> m_liveAllocs;
+
+		nbl::core::vector<HandleSlot> m_handleSlots;
+		nbl::core::vector<uint32_t> m_freeHandleSlots;
+		nbl::core::vector<PendingFree> m_pendingFrees;
+		uint64_t m_completedFrame = 0ULL;
+
+		uint32_t m_directWriteMemTypeBits = 0U;
+		size_t m_directWriteBudget = 64ULL << 20;
+		size_t m_directWriteBytes = 0ULL;
+
+		uint32_t m_memTypeCount = 0U;
+		uint32_t m_memTypeHeapIx[MaxHeaps] = {};
+		uint32_t m_deviceHeapCount = 0U;
+		DeviceHeap m_deviceHeaps[MaxDeviceHeaps];
+		over_budget_callback_t m_overBudgetCb;
 	};
 
 	using Resource = ResourceAllocator::Allocation;
 	using BufferResource = ResourceAllocator::BufferAllocation;
 	using ImageResource = ResourceAllocator::ImageAllocation;
+	using ResourceHandle = ResourceAllocator::Handle;
+
+	using OwnershipOp = nbl::video::IGPUCommandBuffer::SOwnershipTransferBarrier::OWNERSHIP_OP;
 
 	struct BufferBarrier
 	{
@@ -560,6 +2001,14 @@ namespace kris
 		nbl::core::bitflag<nbl::asset::ACCESS_FLAGS> dstaccess;
 		nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> srcstages;
 		nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> dststages;
+		// queue family ownership transfer
+		OwnershipOp ownershipOp = OwnershipOp::NONE;
+		uint32_t otherQueueFamilyIx = 0U;
+		// range within the resource, 0 size means all of it
+		size_t offset = 0ULL;
+		size_t size = 0ULL;
+
+		bool isPartial() const { return size != 0ULL; }
 	};
 	struct ImageBarrier
 	{
@@ -570,6 +2019,29 @@ namespace kris
 		nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS> dststages;
 		nbl::video::IGPUImage::LAYOUT srclayout;
 		nbl::video::IGPUImage::LAYOUT dstlayout;
+		// queue family ownership transfer
+		OwnershipOp ownershipOp = OwnershipOp::NONE;
+		uint32_t otherQueueFamilyIx = 0U;
+		// subresources, 0 mip count means all of them (layer count is ignored then)
+		uint32_t baseMip = 0U;
+		uint32_t mipCount = 0U;
+		uint32_t baseLayer = 0U;
+		uint32_t layerCount = 0U;
+
+		bool isPartial() const { return mipCount != 0U; }
+		bool isSameRange(const ImageBarrier& other) const
+		{
+			if (!isPartial() || !other.isPartial())
+				return isPartial() == other.isPartial();
+			return baseMip == other.baseMip && mipCount == other.mipCount && baseLayer == other.baseLayer && layerCount == other.layerCount;
+		}
+		bool overlaps(const ImageBarrier& other) const
+		{
+			if (!isPartial() || !other.isPartial())
+				return true;
+			return baseMip < other.baseMip + other.mipCount && other.baseMip < baseMip + mipCount &&
+				baseLayer < other.baseLayer + other.layerCount && other.baseLayer < baseLayer + layerCount;
+		}
 	};
 
 	struct BarrierCounts
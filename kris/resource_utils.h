@@ -2,108 +2,1097 @@
 
 #include "resource_allocator.h"
 #include "cmd_recorder.h"
+#include "staging_writer.h"
+
+#include <numeric>
 
 namespace kris
 {
+    // Uploads go through one staging ring buffer shared by all frames in flight, written with non-temporal stores (see StagingWriter).
+    // Ring space written in a frame is reclaimed once Renderer's frame timeline semaphore reaches that frame's value.
+    // Uploads which don't fit into free space are split into chunks (buffer ranges, image rows), whatever doesn't fit
+    // in the current transfer pass is deferred to the following ones. Uploads are always recorded in submission order.
+    // Contents of uploaded buffer pages and image subresources are hashed (see Resource::contentHashes),
+    // parts which GPU copy already holds are skipped, so re-uploading partially changed data only copies dirty ranges.
+    // Copies are gathered per destination and recorded all at once when the result is obtained: one copy command
+    // per destination and barriers of all destinations emitted together (see CommandRecorder::copyBatched()).
+    // Dynamic contents (atlases, tiled updates) can be uploaded as lists of buffer ranges and image subrectangles,
+    // packed tightly into staging memory (see uploadBufferRanges(), uploadImageRegions()).
+    // Buffers allocated with ResourceAllocator::AllocFlags::DirectWrite are written by CPU straight into their device local memory,
+    // with no copy or barrier, into the frame region no frame in flight reads (see ResourceAllocator::acquireFrameRegion()),
+    // so they must be written before the frame binds them. If no region is free or a copy into them is pending, they're staged as usual.
+    // Images can get their mip chains generated from mip 0 once the upload is recorded (see setMipGenerator()),
+    // mips are generated after all the copies of the pass, in getResult().
+    // Readbacks go through separate host cached ring, their callbacks are called from pollReadbacks() once GPU is done,
+    // the frame loop never waits for them.
     class ResourceUtils final
     {
         enum : uint32_t
         {
-            StagingBufSize = 1U << 24U // 16M
+            StagingRingSize = 1U << 25U, // 32M
+            ReadbackRingSize = 1U << 23U, // 8M, allocated on first readback
+            StagingAlignment = 64U,
+            ContentPageSize = 1U << 12U, // 4K, granularity of buffer content tracking
+
+            InvalidOffset = ~0U,
         };
-        enum : uint64_t
+
+    public:
+        enum class EBackPressure : uint32_t
         {
-            FenceInitialValue = 0ULL
+            Block, // wait for GPU to finish older frames if the ring is full, defer only what current frame alone can't fit
+            Defer, // never wait, defer whatever doesn't fit right away
         };
 
-        uint32_t allocSpace(uint32_t size)
+        // Per transfer pass
+        struct UploadStats
         {
-            uint32_t srcOffset = m_addrAlctr.alloc_addr(size, 64U);
-            KRIS_ASSERT(srcOffset != m_addrAlctr.invalid_address);
-            return srcOffset;
-        }
-        void* getSpacePtr(uint32_t offset)
+            size_t uploadedBytes = 0ULL; // copied to staging, including deferred parts of previous passes
+            size_t skippedBytes = 0ULL; // already held by GPU copy
+            size_t directBytes = 0ULL; // written straight into device local memory (not included in uploadedBytes)
+            uint32_t copyCommands = 0U;
+        };
+
+        // Range of uploadBufferRanges()
+        struct BufferRange
         {
-            void* ptr = reinterpret_cast<uint8_t*>(m_stagingResource->getMappedPtr()) + offset;
-            return ptr;
-        }
+            size_t dstOffset; // within the buffer resource
+            size_t srcOffset; // within source data
+            size_t size;
+        };
+        // Subrectangle of one mip level and array layer, for uploadImageRegions().
+        // Offset and extent are in texels, multiples of block dimensions for compressed formats (extent may reach the mip's edge instead).
+        struct ImageSubRect
+        {
+            uint32_t mipLevel = 0U;
+            uint32_t arrayLayer = 0U;
+            VkOffset3D offset = { 0, 0, 0 };
+            VkExtent3D extent = { 0U, 0U, 1U };
+            size_t srcOffset = 0ULL; // of the first texel block within source data
+            uint32_t srcRowLength = 0U; // in texels, 0 means rows are tightly packed
+            uint32_t srcImageHeight = 0U; // in texels, 0 means depth slices are tightly packed
+        };
 
-    public:
-        ResourceUtils(nbl::video::ILogicalDevice* device, ResourceAllocator* ra) :
+        // Called with readback data, which is only valid for the duration of the call
+        using ReadbackCallback = std::function<void(const void* data, size_t size)>;
+
+        // `jobs` parallelizes large staging copies, may be null
+        ResourceUtils(nbl::video::ILogicalDevice* device, ResourceAllocator* ra, nbl::video::ISemaphore* frameTimeline, JobSystem* jobs = nullptr) :
             m_device(device),
-            m_addrAlctrScratch(KRIS_MEM_ALLOC(addr_alctr_t::reserved_size(64U, StagingBufSize, 64U))),
-            m_addrAlctr(m_addrAlctrScratch, 0U, 0U, 64U, StagingBufSize, 64U)
+            m_ra(ra),
+            m_frameTimeline(frameTimeline),
+            m_stagingWriter(jobs)
         {
             nbl::video::IGPUBuffer::SCreationParams ci = {};
-            ci.size = StagingBufSize;
+            ci.size = StagingRingSize;
             ci.usage = nbl::video::IGPUBuffer::EUF_TRANSFER_SRC_BIT;
-            m_stagingResource = ra->allocBuffer(device, std::move(ci), device->getPhysicalDevice()->getHostVisibleMemoryTypeBits());
-            m_stagingResource->map(nbl::video::IDeviceMemoryAllocation::EMCAF_WRITE);
-        }
-        ~ResourceUtils()
-        {
-            KRIS_MEM_FREE(m_addrAlctrScratch);
+            m_stagingResource = ra->allocBuffer(device, std::move(ci), device->getPhysicalDevice()->getHostVisibleMemoryTypeBits(), ResourceAllocator::AllocFlags::Pinned);
+            m_stagingPtr = reinterpret_cast<uint8_t*>(m_stagingResource->map(nbl::video::IDeviceMemoryAllocation::EMCAF_WRITE));
+            m_stagingResource->getBuffer()->setObjectDebugName("ResourceUtils staging ring");
         }
 
+        void setBackPressure(EBackPressure bp) { m_backPressure = bp; }
+        // Needed for uploads with `generateMips`, cmdrec of transfer passes must be then on a compute capable queue
+        void setMipGenerator(MipGenerator* mipgen) { m_mipGen = mipgen; }
+
         void beginTransferPass(CommandRecorder&& cmdrec)
         {
+            const uint64_t frameVal = cmdrec.frameVal;
+            beginTransferPass(std::move(cmdrec), frameVal);
+        }
+        // `signalVal` is the value `frameTimeline` passed in constructor gets signalled with once commands recorded to `cmdrec` are done
+        void beginTransferPass(CommandRecorder&& cmdrec, uint64_t signalVal)
+        {
+            KRIS_ASSERT_MSG(m_bufCopies.empty() && m_imgCopies.empty(), "Previous transfer pass' result was never obtained!");
+
             m_cmdrec = std::move(cmdrec);
-            m_addrAlctr.reset();
+            m_signalVal = signalVal;
+            m_writtenRanges.clear();
+            m_stats = {};
+
+            reclaim(m_frameTimeline->getCounterValue());
+            pollReadbacks();
+            recordDeferred();
         }
 
+        // Returns false if (part of) the upload got deferred to following transfer passes
         bool uploadBufferData(BufferResource* bufferResource, size_t offset, size_t size, const void* data)
         {
-            uint32_t srcOffset = allocSpace((uint32_t) size);
-            memcpy(getSpacePtr(srcOffset), data, size);
+            const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(data);
+            const size_t bufSize = bufferResource->getSize();
+            const size_t end = offset + size;
+            KRIS_ASSERT(end <= bufSize);
+
+            auto& hashes = bufferResource->contentHashes;
+            hashes.resize((bufSize + ContentPageSize - 1U) / ContentPageSize, 0ULL);
+
+            // uploads consecutive dirty pages at once
+            bool recorded = true;
+            size_t dirtyBegin = end;
+            for (size_t pageBegin = offset / ContentPageSize * ContentPageSize; pageBegin < end; pageBegin += ContentPageSize)
+            {
+                const size_t pageEnd = std::min<size_t>(pageBegin + ContentPageSize, bufSize);
+                const size_t b = std::max(pageBegin, offset);
+                const size_t e = std::min(pageEnd, end);
+                uint64_t& pageHash = hashes[pageBegin / ContentPageSize];
+
+                bool dirty = true;
+                if (b == pageBegin && e == pageEnd)
+                {
+                    const uint64_t h = hashBytes(bytes + (b - offset), e - b, ContentHashSeed);
+                    dirty = (h != pageHash);
+                    pageHash = h;
+                }
+                else
+                {
+                    // partially written page, whole page content is unknown from now on
+                    pageHash = 0ULL;
+                }
+
+                if (dirty)
+                {
+                    if (dirtyBegin == end)
+                        dirtyBegin = b;
+                    continue;
+                }
+
+                m_stats.skippedBytes += e - b;
+                if (dirtyBegin != end)
+                {
+                    recorded &= uploadBufferRange(bufferResource, dirtyBegin, b - dirtyBegin, bytes + (dirtyBegin - offset));
+                    dirtyBegin = end;
+                }
+            }
+            if (dirtyBegin != end)
+            {
+                recorded &= uploadBufferRange(bufferResource, dirtyBegin, end - dirtyBegin, bytes + (dirtyBegin - offset));
+            }
+
+            return recorded;
+        }
+
+        // Scattered ranges of one buffer in one call, packed tightly one after another into staging memory.
+        // Ranges must not overlap, empty ones are ignored. Content of touched pages isn't tracked, so no unchanged data is skipped.
+        // Returns false if (part of) the upload got deferred to following transfer passes.
+        bool uploadBufferRanges(BufferResource* bufferResource, uint32_t rangeCount, const BufferRange* ranges, const void* data)
+        {
+            const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(data);
+
+            auto& hashes = bufferResource->contentHashes;
+            size_t remaining = 0ULL;
+            for (uint32_t i = 0U; i < rangeCount; ++i)
+            {
+                KRIS_ASSERT(ranges[i].dstOffset + ranges[i].size <= bufferResource->getSize());
+                remaining += ranges[i].size;
+
+                if (!hashes.empty() && ranges[i].size != 0ULL)
+                {
+                    const size_t lastPage = (ranges[i].dstOffset + ranges[i].size - 1U) / ContentPageSize;
+                    for (size_t page = ranges[i].dstOffset / ContentPageSize; page <= lastPage; ++page)
+                        hashes[page] = 0ULL;
+                }
+            }
+            if (remaining == 0ULL)
+                return true;
+
+            if (canWriteDirectly(bufferResource, true))
+            {
+                for (uint32_t i = 0U; i < rangeCount; ++i)
+                {
+                    if (ranges[i].size != 0ULL)
+                        writeDirectly(bufferResource, ranges[i].dstOffset, ranges[i].size, bytes + ranges[i].srcOffset);
+                }
+                return true;
+            }
+
+            // as many of the remaining ranges as fit go into one allocation, at least the next one
+            uint32_t i = 0U;
+            while (m_deferred.empty() && i < rangeCount && ranges[i].size <= StagingRingSize)
+            {
+                uint32_t size = 0U;
+                const uint32_t stagingOffset = allocSpace(remaining, std::max<size_t>(ranges[i].size, 1U), StagingAlignment, size);
+                if (stagingOffset == InvalidOffset)
+                    break;
+
+                size_t packed = 0ULL;
+                for (; i < rangeCount && packed + ranges[i].size <= size; ++i)
+                {
+                    const BufferRange& r = ranges[i];
+                    // zero-size copy region is invalid
+                    if (r.size == 0ULL)
+                        continue;
+
+                    m_stagingWriter.write(m_stagingPtr + stagingOffset + packed, bytes + r.srcOffset, r.size);
+
+                    nbl::video::IGPUCommandBuffer::SBufferCopy region;
+                    region.dstOffset = bufferResource->getOffset() + r.dstOffset;
+                    region.srcOffset = m_stagingResource->getOffset() + stagingOffset + packed;
+                    region.size = r.size;
+                    addBufferCopy(bufferResource, region);
+
+                    packed += r.size;
+                }
+                addWrittenRange(stagingOffset, packed);
+                m_stats.uploadedBytes += packed;
+                remaining -= packed;
+            }
+
+            // the rest (or range bigger than the ring) goes in chunks, deferred if needed
+            bool recorded = true;
+            for (; i < rangeCount; ++i)
+            {
+                if (ranges[i].size != 0ULL)
+                    recorded &= uploadBufferRange(bufferResource, ranges[i].dstOffset, ranges[i].size, bytes + ranges[i].srcOffset);
+            }
+
+            return recorded;
+        }
+
+        // Subrectangles of any mips and layers in one call (e.g. tiles of atlas), rows of texel blocks are packed tightly into staging memory,
+        // so only the rectangles are copied even if they're cut out of bigger source image. Each rectangle starts at a multiple of 4 and of texel block size. Rectangles must not overlap, empty ones are skipped.
+        // Whole image content is unknown afterwards (see Resource::contentHashes).
+        // Returns false if (part of) the upload got deferred to following transfer passes.
+        bool uploadImageRegions(ImageResource* imageResource, uint32_t rectCount, const ImageSubRect* rects, const void* data)
+        {
+            const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(data);
+            const nbl::asset::E_FORMAT format = imageResource->getImage()->getCreationParameters().format;
+            const auto blockDim = nbl::asset::getBlockDimensions(format);
+            const uint32_t blockBytes = nbl::asset::getTexelOrBlockBytesize(format);
+
+            imageResource->invalidateContents();
+
+            auto packedRowBytes = [&](const ImageSubRect& r) { return (size_t)((r.extent.width + blockDim.x - 1U) / blockDim.x) * blockBytes; };
+            auto packedRows = [&](const ImageSubRect& r) { return (size_t)((r.extent.height + blockDim.y - 1U) / blockDim.y); };
+            auto packedSize = [&](const ImageSubRect& r) { return packedRowBytes(r) * packedRows(r) * r.extent.depth; };
+            // including padding to the next rectangle, copy's buffer offset must be aligned
+            const size_t rectAlignment = std::lcm((size_t)4U, (size_t)blockBytes);
+            auto paddedSize = [&](const ImageSubRect& r) { return (packedSize(r) + rectAlignment - 1ULL) / rectAlignment * rectAlignment; };
+
+            // rows are gathered from source with its pitches
+            auto packRect = [&](uint8_t* dst, const ImageSubRect& r, bool toStaging)
+            {
+                const size_t rowBytes = packedRowBytes(r);
+                const size_t rows = packedRows(r);
+                const size_t srcRowBytes = r.srcRowLength ? (size_t)((r.srcRowLength + blockDim.x - 1U) / blockDim.x) * blockBytes : rowBytes;
+                const size_t srcRows = r.srcImageHeight ? (size_t)((r.srcImageHeight + blockDim.y - 1U) / blockDim.y) : rows;
+
+                for (uint32_t z = 0U; z < r.extent.depth; ++z)
+                {
+                    const uint8_t* const srcSlice = bytes + r.srcOffset + z * srcRows * srcRowBytes;
+                    uint8_t* const dstSlice = dst + z * rows * rowBytes;
+                    // tightly packed slice at once
+                    const size_t runs = (srcRowBytes == rowBytes) ? 1ULL : rows;
+                    const size_t runBytes = (srcRowBytes == rowBytes) ? rows * rowBytes : rowBytes;
+                    for (size_t y = 0ULL; y < runs; ++y)
+                    {
+                        if (toStaging)
+                            m_stagingWriter.write(dstSlice + y * rowBytes, srcSlice + y * srcRowBytes, runBytes);
+                        else
+                            memcpy(dstSlice + y * rowBytes, srcSlice + y * srcRowBytes, runBytes);
+                    }
+                }
+            };
+            auto makeRegion = [](const ImageSubRect& r, size_t bufferOffset)
+            {
+                nbl::video::IGPUImage::SBufferCopy region = {};
+                region.bufferOffset = bufferOffset;
+                region.bufferRowLength = 0U;
+                region.bufferImageHeight = 0U;
+                region.imageSubresource.aspectMask = nbl::asset::IImage::EAF_COLOR_BIT;
+                region.imageSubresource.mipLevel = r.mipLevel;
+                region.imageSubresource.baseArrayLayer = r.arrayLayer;
+                region.imageSubresource.layerCount = 1U;
+                region.imageOffset = { r.offset.x, r.offset.y, r.offset.z };
+                region.imageExtent = { r.extent.width, r.extent.height, r.extent.depth };
+                return region;
+            };
+
+            // empty rects (any extent 0) have no packed size, they're skipped as zero-extent copy region is invalid
+            size_t remaining = 0ULL;
+            for (uint32_t i = 0U; i < rectCount; ++i)
+                remaining += paddedSize(rects[i]);
+            if (remaining == 0ULL)
+                return true;
+
+            // as many of the remaining rects as fit go into one allocation, at least the next one
+            uint32_t i = 0U;
+            if (m_deferred.empty())
+            {
+                // previous copies into the image must be done first
+                if (m_imgCopyIx.find(imageResource) != m_imgCopyIx.end())
+                    flushCopies();
+
+                while (i < rectCount && paddedSize(rects[i]) <= StagingRingSize)
+                {
+                    uint32_t size = 0U;
+                    const uint32_t stagingOffset = allocSpace(remaining, std::max<size_t>(paddedSize(rects[i]), 1U), getImageStagingAlignment(format), size);
+                    if (stagingOffset == InvalidOffset)
+                        break;
+
+                    auto& regions = getImageCopyRegions(imageResource);
+                    size_t packed = 0ULL;
+                    for (; i < rectCount && packed + paddedSize(rects[i]) <= size; ++i)
+                    {
+                        if (packedSize(rects[i]) == 0ULL)
+                            continue;
+
+                        packRect(m_stagingPtr + stagingOffset + packed, rects[i], true);
+                        regions.push_back(makeRegion(rects[i], m_stagingResource->getOffset() + stagingOffset + packed));
+                        packed += paddedSize(rects[i]);
+                    }
+                    addWrittenRange(stagingOffset, packed);
+                    m_stats.uploadedBytes += packed;
+                    remaining -= packed;
+                }
+                if (remaining == 0ULL)
+                    return true;
+            }
+
+            // the rest is packed into memory owned by the upload, which is continued the usual way (split into rows if needed)
+            PendingUpload up;
+            up.image = refctd<ImageResource>(imageResource);
+            up.format = format;
+            up.data.resize(remaining);
+            for (size_t packed = 0ULL; i < rectCount; ++i)
+            {
+                if (packedSize(rects[i]) == 0ULL)
+                    continue;
+
+                packRect(up.data.data() + packed, rects[i], false);
+                up.srcRegions.push_back(makeRegion(rects[i], packed));
+                packed += paddedSize(rects[i]);
+            }
+            up.srcdata = up.data.data(); // vector's storage stays the same when upload is moved
+            up.cleanLayers.assign(up.srcRegions.size(), false);
+
+            if (m_deferred.empty() && recordImageUpload(up))
+                return true;
+
+            m_deferred.push_back(std::move(up));
+            return false;
+        }
+
+        // Returns false if (part of) the upload got deferred to following transfer passes.
+        // With `generateMips` mips 1.. are generated from uploaded mip 0 (image must be supported by MipGenerator),
+        // source regions of those mips are pointless then.
+        bool uploadImageData(ImageResource* imageResource, nbl::asset::ICPUImage* srcimg, bool generateMips = false)
+        {
+            const auto srcregions = srcimg->getRegions();
+            return uploadImageData(imageResource, srcimg->getCreationParameters().format,
+                (uint32_t)srcregions.size(), &srcregions.begin()[0], srcimg->getBuffer()->getPointer(), refctd<nbl::core::IReferenceCounted>(srcimg), generateMips);
+        }
+        // Upload straight from any memory (e.g. mapped file, see TextureStreamer), region buffer offsets are relative to `data`.
+        // `srcOwner` (owner of `data`) is kept alive until the whole upload is recorded.
+        bool uploadImageData(ImageResource* imageResource, nbl::asset::E_FORMAT format,
+            uint32_t regionCount, const nbl::asset::IImage::SBufferCopy* regions, const void* data, refctd<nbl::core::IReferenceCounted>&& srcOwner,
+            bool generateMips = false)
+        {
+            KRIS_ASSERT_MSG(!generateMips || m_mipGen, "Mip generation needs MipGenerator, see setMipGenerator()!");
+
+            PendingUpload up;
+            up.image = refctd<ImageResource>(imageResource);
+            up.srcOwner = std::move(srcOwner);
+            up.srcdata = reinterpret_cast<const uint8_t*>(data);
+            up.format = format;
+            up.srcRegions.assign(regions, regions + regionCount);
+            up.generateMips = generateMips;
+
+            // one hash per array layer of every source region
+            const auto& srcregions = up.srcRegions;
+            const auto blockDim = nbl::asset::getBlockDimensions(format);
+            const uint32_t blockBytes = nbl::asset::getTexelOrBlockBytesize(format);
+            const uint8_t* const srcdata = up.srcdata;
+
+            uint32_t layerTotal = 0U;
+            for (const auto& r : srcregions)
+                layerTotal += r.imageSubresource.layerCount;
+
+            auto& hashes = imageResource->contentHashes;
+            if (hashes.size() != layerTotal)
+                hashes.assign(layerTotal, 0ULL);
+            up.cleanLayers.assign(layerTotal, false);
+
+            bool anyDirty = false;
+            uint32_t hashIx = 0U;
+            for (const auto& r : srcregions)
+            {
+                const uint32_t rowLength = r.bufferRowLength ? r.bufferRowLength : r.imageExtent.width;
+                const uint32_t imageHeight = r.bufferImageHeight ? r.bufferImageHeight : r.imageExtent.height;
+                const size_t rowBytes = (size_t)((rowLength + blockDim.x - 1U) / blockDim.x) * blockBytes;
+                const size_t layerBytes = (size_t)r.imageExtent.depth * ((imageHeight + blockDim.y - 1U) / blockDim.y) * rowBytes;
+
+                for (uint32_t layer = 0U; layer < r.imageSubresource.layerCount; ++layer, ++hashIx)
+                {
+                    // subresource placement goes into the hash, so that equal data of different subresources doesn't match
+                    const uint64_t seed = hashBytes(reinterpret_cast<const uint8_t*>(&r), sizeof(r), ContentHashSeed + layer);
+                    const uint64_t h = hashBytes(srcdata + r.bufferOffset + layer * layerBytes, layerBytes, seed);
+                    if (h == hashes[hashIx])
+                    {
+                        up.cleanLayers[hashIx] = true;
+                        m_stats.skippedBytes += layerBytes;
+                    }
+                    else
+                    {
+                        anyDirty = true;
+                        hashes[hashIx] = h;
+                    }
+                }
+            }
+            if (!anyDirty)
+                return true;
+
+            if (m_deferred.empty() && recordImageUpload(up))
+            {
+                onImageUploadRecorded(up);
+                return true;
+            }
+
+            m_deferred.push_back(std::move(up));
+            return false;
+        }
+
+        uint32_t getDeferredUploadCount() const { return (uint32_t)m_deferred.size(); }
+        size_t getStagingUsedSize() const { return (size_t)(m_headPos - m_tailPos); }
+        const UploadStats& getUploadStats() const { return m_stats; }
+
+        // Records copy of the range into `cmdrec` (any pass, outside of render pass), `callback` is called once frame timeline
+        // reaches `cmdrec.frameVal`. Source buffer must have transfer src usage.
+        // Returns false if the readback ring is full at the moment, never waits for space.
+        bool readbackBufferData(CommandRecorder& cmdrec, BufferResource* bufferResource, size_t offset, size_t size, ReadbackCallback&& callback)
+        {
+            KRIS_ASSERT(offset + size <= bufferResource->getSize());
+
+            const uint32_t dstOffset = allocReadbackSpace(size, StagingAlignment);
+            if (dstOffset == InvalidOffset)
+                return false;
 
             nbl::video::IGPUCommandBuffer::SBufferCopy region;
-            region.dstOffset = offset;
-            region.srcOffset = srcOffset;
+            region.srcOffset = bufferResource->getOffset() + offset;
+            region.dstOffset = m_readbackResource->getOffset() + dstOffset;
             region.size = size;
+            cmdrec.copyBuffer(bufferResource, m_readbackResource.get(), 1U, &region);
 
-            m_cmdrec.copyBuffer(m_stagingResource.get(), bufferResource, 1U, &region);
+            addReadback(cmdrec, dstOffset, size, std::move(callback));
+            return true;
+        }
+
+        // Reads all array layers of one mip level, data is tightly packed (layer by layer, depth slice by slice, row by row of texel blocks).
+        // Image must have single aspect and transfer src usage, same semantics as readbackBufferData() otherwise.
+        bool readbackImageData(CommandRecorder& cmdrec, ImageResource* imageResource, uint32_t mipLevel, ReadbackCallback&& callback)
+        {
+            const auto& params = imageResource->getImage()->getCreationParameters();
+            const auto blockDim = nbl::asset::getBlockDimensions(params.format);
+            const uint32_t blockBytes = nbl::asset::getTexelOrBlockBytesize(params.format);
 
+            nbl::video::IGPUImage::SBufferCopy region = {};
+            region.imageSubresource.aspectMask = imageResource->getAspectFlags();
+            region.imageSubresource.mipLevel = mipLevel;
+            region.imageSubresource.baseArrayLayer = 0U;
+            region.imageSubresource.layerCount = params.arrayLayers;
+            region.imageOffset = { 0, 0, 0 };
+            region.imageExtent = {
+                std::max(params.extent.width >> mipLevel, 1U),
+                std::max(params.extent.height >> mipLevel, 1U),
+                std::max(params.extent.depth >> mipLevel, 1U)
+            };
+
+            const size_t rowBytes = (size_t)((region.imageExtent.width + blockDim.x - 1U) / blockDim.x) * blockBytes;
+            const size_t rows = (region.imageExtent.height + blockDim.y - 1U) / blockDim.y;
+            const size_t size = rowBytes * rows * region.imageExtent.depth * params.arrayLayers;
+
+            const uint32_t dstOffset = allocReadbackSpace(size, getImageStagingAlignment(params.format));
+            if (dstOffset == InvalidOffset)
+                return false;
+
+            region.bufferOffset = m_readbackResource->getOffset() + dstOffset;
+            region.bufferRowLength = 0U;
+            region.bufferImageHeight = 0U;
+            cmdrec.copyImageToBuffer(imageResource, m_readbackResource.get(), 1U, &region);
+
+            addReadback(cmdrec, dstOffset, size, std::move(callback));
             return true;
         }
 
-        bool uploadImageData(ImageResource* imageResource, nbl::asset::ICPUImage* srcimg)
+        // Calls callbacks of finished readbacks, in order of recording. Also done in beginTransferPass().
+        void pollReadbacks()
         {
-            constexpr uint32_t MaxRegions = 16U;
+            if (m_readbacks.empty())
+                return;
+
+            const uint64_t completed = m_frameTimeline->getCounterValue();
+            while (!m_readbacks.empty() && m_readbacks.front().frameVal <= completed)
+            {
+                PendingReadback& rb = m_readbacks.front();
+
+                const ResourceAllocator::MappedRange range = { m_readbackResource.get(), rb.offset, rb.size };
+                ResourceAllocator::invalidateMappedRanges(m_device, 1U, &range);
+                rb.callback(m_readbackPtr + rb.offset, rb.size);
+
+                m_readbackTailPos = rb.endPos;
+                m_readbacks.pop_front();
+            }
+        }
+        uint32_t getPendingReadbackCount() const { return (uint32_t)m_readbacks.size(); }
 
-            nbl::video::IGPUImage::SBufferCopy regions[MaxRegions];
-            uint32_t mipcount = 0U;
+        // Recorder of the current transfer pass as is, copies gathered so far are not recorded yet
+        CommandRecorder& getRecorder() { return m_cmdrec; }
+
+        // Records gathered copies and mip generation, makes all staging writes visible to the device, so must be called once all uploads are done
+        CommandRecorder& getResult()
+        {
+            flushCopies();
+            for (auto& img : m_mipGenImages)
+            {
+                const bool generated = m_cmdrec.generateMips(m_mipGen, img.get());
+                KRIS_ASSERT_MSG(generated, "Mips of uploaded image couldn't be generated!");
+                KRIS_UNUSED_PARAM(generated);
+            }
+            m_mipGenImages.clear();
+            if (!m_writtenRanges.empty())
+            {
+                ResourceAllocator::flushMappedRanges(m_device, (uint32_t)m_writtenRanges.size(), m_writtenRanges.data());
+                m_writtenRanges.clear();
+            }
+            if (m_headPos != m_recordedHeadPos)
             {
-                auto srcregions = srcimg->getRegions();
-                mipcount = srcregions.size();
-                KRIS_ASSERT(mipcount <= MaxRegions);
-                std::copy(srcregions.begin(), srcregions.end(), regions);
+                m_inflight.push_back({ m_signalVal, m_headPos });
+                m_recordedHeadPos = m_headPos;
             }
-            
-            const size_t size = srcimg->getImageDataSizeInBytes();
-            uint32_t srcOffset = allocSpace((uint32_t) size);
+            return m_cmdrec;
+        }
+
+    private:
+        static inline constexpr uint64_t ContentHashSeed = 0xcbf29ce484222325ULL;
 
-            memcpy(getSpacePtr(srcOffset), srcimg->getBuffer()->getPointer(), size);
+        // Not cryptographic, just cheap enough to run over all uploaded data. Never returns 0 (unknown content).
+        static uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t h)
+        {
+            constexpr uint64_t Mul = 0x9e3779b97f4a7c15ULL;
 
-            for (uint32_t mip = 0U; mip < mipcount; ++mip)
+            size_t i = 0ULL;
+            for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
             {
-                regions[mip].bufferOffset += srcOffset;
+                uint64_t v;
+                memcpy(&v, data + i, sizeof(v));
+                h = (h ^ v) * Mul;
+                h ^= h >> 29;
             }
-            
-            m_cmdrec.copyBufferToImage(m_stagingResource.get(), imageResource, mipcount, regions);
+            for (; i < size; ++i)
+            {
+                h = (h ^ data[i]) * Mul;
+            }
+            h ^= h >> 32;
+
+            return h ? h : 1ULL;
+        }
 
+        // A copy recorded earlier in this pass would overwrite the buffer afterwards. Otherwise acquires frame region
+        // no frame in flight reads, with content of the previous one unless the whole buffer is about to be written.
+        bool canWriteDirectly(BufferResource* bufferResource, bool keepContent)
+        {
+            if (!bufferResource->isDirectlyWritable())
+                return false;
+            if (m_bufCopyIx.find(bufferResource) != m_bufCopyIx.end())
+                return false;
+            for (const PendingUpload& up : m_deferred)
+            {
+                if (up.buffer.get() == bufferResource)
+                    return false;
+            }
+            const uint32_t prevRegion = bufferResource->getFrameRegion();
+            if (!m_ra->acquireFrameRegion(bufferResource, m_cmdrec.frameVal, keepContent))
+                return false;
+            // carried over content must be flushed too
+            if (keepContent && bufferResource->getFrameRegion() != prevRegion)
+                m_writtenRanges.push_back({ bufferResource, bufferResource->getFrameRegionOffset(), bufferResource->getSize() });
             return true;
         }
 
-        CommandRecorder& getResult() { return m_cmdrec; }
+        // Host writes are made visible to the device by queue submission, so only non-coherent memory needs flushing
+        void writeDirectly(BufferResource* bufferResource, size_t offset, size_t size, const uint8_t* bytes)
+        {
+            const size_t regionOffset = bufferResource->getFrameRegionOffset();
+            uint8_t* const dst = reinterpret_cast<uint8_t*>(bufferResource->getMappedPtr()) + regionOffset;
+            m_stagingWriter.write(dst + offset, bytes, size);
+            m_writtenRanges.push_back({ bufferResource, regionOffset + offset, size });
+            m_stats.directBytes += size;
+        }
+
+        bool uploadBufferRange(BufferResource* bufferResource, size_t offset, size_t size, const uint8_t* bytes)
+        {
+            if (canWriteDirectly(bufferResource, offset != 0ULL || size != bufferResource->getSize()))
+            {
+                writeDirectly(bufferResource, offset, size, bytes);
+                return true;
+            }
+
+            const size_t done = m_deferred.empty() ? recordBufferUpload(bufferResource, offset, size, bytes) : 0ULL;
+            if (done == size)
+                return true;
+
+            PendingUpload& up = m_deferred.emplace_back();
+            up.buffer = refctd<BufferResource>(bufferResource);
+            up.dstOffset = offset + done;
+            up.data.assign(bytes + done, bytes + size);
+            return false;
+        }
+
+        struct PendingUpload
+        {
+            // buffer upload, remaining part of source data is kept here (also packed image rects, see uploadImageRegions())
+            refctd<BufferResource> buffer;
+            size_t dstOffset = 0ULL;
+            nbl::core::vector<uint8_t> data;
+            size_t done = 0ULL;
+
+            // image upload, progress in source regions (rows are counted in texel blocks)
+            refctd<ImageResource> image;
+            refctd<nbl::core::IReferenceCounted> srcOwner; // keeps `srcdata` alive
+            const uint8_t* srcdata = nullptr;
+            nbl::asset::E_FORMAT format = nbl::asset::EF_UNKNOWN;
+            nbl::core::vector<nbl::asset::IImage::SBufferCopy> srcRegions;
+            uint32_t region = 0U;
+            uint32_t layer = 0U;
+            uint32_t slice = 0U;
+            uint32_t row = 0U;
+            // per array layer of every region, layers already held by GPU copy are skipped
+            nbl::core::vector<bool> cleanLayers;
+            uint32_t regionLayerBase = 0U;
+            bool generateMips = false;
+        };
+
+        struct BufferCopies
+        {
+            refctd<BufferResource> dst;
+            nbl::core::vector<nbl::video::IGPUCommandBuffer::SBufferCopy> regions;
+            // bounds of all the regions within underlying IGPUBuffer
+            size_t begin;
+            size_t end;
+        };
+        struct ImageCopies
+        {
+            refctd<ImageResource> dst;
+            nbl::core::vector<nbl::video::IGPUImage::SBufferCopy> regions;
+        };
+
+        struct PendingReadback
+        {
+            uint64_t frameVal;
+            uint32_t offset;
+            size_t size;
+            uint64_t endPos; // ring position past readback's space
+            ReadbackCallback callback;
+        };
+
+        // Ring space written in frames up to `frameVal` ends at `headPos`
+        struct InflightRange
+        {
+            uint64_t frameVal;
+            uint64_t headPos;
+        };
+
+        void reclaim(uint64_t completedFrameVal)
+        {
+            while (!m_inflight.empty() && m_inflight.front().frameVal <= completedFrameVal)
+            {
+                m_tailPos = std::max(m_tailPos, m_inflight.front().headPos);
+                m_inflight.pop_front();
+            }
+        }
+
+        // Allocates contiguous space of at most `desired` bytes, multiple of `granularity` unless it's all of `desired`.
+        // Offset is a multiple of `alignment`, which doesn't have to be power of two (see getImageStagingAlignment()).
+        // Returns InvalidOffset if not even `granularity` bytes are available.
+        static uint32_t tryAllocRingSpace(uint64_t& headPos, uint64_t& tailPos, size_t ringSize, size_t desired, size_t granularity, size_t alignment, uint32_t& outSize)
+        {
+            // empty ring, start over from the beginning to get the most of contiguous space
+            if (headPos == tailPos)
+            {
+                headPos = tailPos = nbl::core::alignUp(headPos, (uint64_t)ringSize);
+            }
+
+            const size_t freeSize = ringSize - (size_t)(headPos - tailPos);
+            const size_t head = (size_t)(headPos % ringSize);
+
+            size_t offset = (head + alignment - 1ULL) / alignment * alignment;
+            size_t padding = offset - head;
+            // not enough space till the end of the ring, wrap around
+            if (offset + granularity > ringSize)
+            {
+                offset = 0ULL;
+                padding = ringSize - head;
+            }
+            if (padding + granularity > freeSize)
+            {
+                return InvalidOffset;
+            }
+
+            size_t size = std::min(freeSize - padding, ringSize - offset);
+            size = (desired <= size) ? desired : (size / granularity * granularity);
+
+            headPos += padding + size;
+            outSize = (uint32_t)size;
+            return (uint32_t)offset;
+        }
+        uint32_t tryAllocSpace(size_t desired, size_t granularity, size_t alignment, uint32_t& outSize)
+        {
+            return tryAllocRingSpace(m_headPos, m_tailPos, StagingRingSize, desired, granularity, alignment, outSize);
+        }
+
+        // Image copy's buffer offset must be a multiple of texel block size (12 bytes for RGB32 formats) and of 4
+        static size_t getImageStagingAlignment(nbl::asset::E_FORMAT format)
+        {
+            return std::lcm((size_t)StagingAlignment, (size_t)nbl::asset::getTexelOrBlockBytesize(format));
+        }
+
+        uint32_t allocReadbackSpace(size_t size, size_t alignment)
+        {
+            KRIS_ASSERT_MSG(size <= ReadbackRingSize, "Readback doesn't fit into the ring!");
+
+            if (!m_readbackResource)
+            {
+                const auto* pd = m_device->getPhysicalDevice();
+                const uint32_t hostVisibleBits = pd->getHostVisibleMemoryTypeBits();
+                // reading uncached memory on CPU is very slow
+                const uint32_t cachedBits = hostVisibleBits & pd->getMemoryTypeBitsFromMemoryTypeFlags(nbl::video::IDeviceMemoryAllocation::EMPF_HOST_CACHED_BIT);
+
+                nbl::video::IGPUBuffer::SCreationParams ci = {};
+                ci.size = ReadbackRingSize;
+                ci.usage = nbl::video::IGPUBuffer::EUF_TRANSFER_DST_BIT;
+                m_readbackResource = m_ra->allocBuffer(m_device, std::move(ci), cachedBits ? cachedBits : hostVisibleBits, ResourceAllocator::AllocFlags::Pinned);
+                m_readbackPtr = reinterpret_cast<const uint8_t*>(m_readbackResource->map(nbl::video::IDeviceMemoryAllocation::EMCAF_READ));
+                m_readbackResource->getBuffer()->setObjectDebugName("ResourceUtils readback ring");
+            }
+
+            uint32_t outSize = 0U;
+            return tryAllocRingSpace(m_readbackHeadPos, m_readbackTailPos, ReadbackRingSize, size, size, alignment, outSize);
+        }
+        void addReadback(CommandRecorder& cmdrec, uint32_t offset, size_t size, ReadbackCallback&& callback)
+        {
+            // copy results must be made visible to host reads
+            cmdrec.makeHostReadable(m_readbackResource.get());
+
+            PendingReadback& rb = m_readbacks.emplace_back();
+            rb.frameVal = cmdrec.frameVal;
+            rb.offset = offset;
+            rb.size = size;
+            rb.endPos = m_readbackHeadPos;
+            rb.callback = std::move(callback);
+        }
+        uint32_t allocSpace(size_t desired, size_t granularity, size_t alignment, uint32_t& outSize)
+        {
+            KRIS_ASSERT(granularity <= StagingRingSize);
+
+            for (;;)
+            {
+                const uint32_t offset = tryAllocSpace(desired, granularity, alignment, outSize);
+                if (offset != InvalidOffset)
+                    return offset;
+
+                // space written in current frame can't be reclaimed before it's submitted
+                if (m_backPressure != EBackPressure::Block || m_inflight.empty() || m_inflight.front().frameVal >= m_signalVal)
+                    return InvalidOffset;
+
+                const nbl::video::ISemaphore::SWaitInfo wi[1] = { {
+                    .semaphore = m_frameTimeline,
+                    .value = m_inflight.front().frameVal
+                } };
+                if (m_device->blockForSemaphores(wi) != nbl::video::ISemaphore::WAIT_RESULT::SUCCESS)
+                    return InvalidOffset;
+                reclaim(m_inflight.front().frameVal);
+            }
+        }
+
+        void addWrittenRange(uint32_t offset, size_t size)
+        {
+            m_writtenRanges.push_back({ m_stagingResource.get(), offset, size });
+        }
+
+        void addBufferCopy(BufferResource* dst, const nbl::video::IGPUCommandBuffer::SBufferCopy& region)
+        {
+            const size_t regionEnd = region.dstOffset + region.size;
+            if (dst->getFrameRegionCount() > 1U)
+                dst->markFrameRegionCopied(m_signalVal);
+
+            auto found = m_bufCopyIx.find(dst);
+            if (found != m_bufCopyIx.end())
+            {
+                BufferCopies& copies = m_bufCopies[found->second];
+
+                bool overlaps = false;
+                if (region.dstOffset < copies.end && regionEnd > copies.begin)
+                {
+                    for (const auto& r : copies.regions)
+                        overlaps = overlaps || (region.dstOffset < r.dstOffset + r.size && regionEnd > r.dstOffset);
+                }
+
+                if (!overlaps)
+                {
+                    // continuous in both staging and destination, just extend previous region
+                    auto& last = copies.regions.back();
+                    if (last.srcOffset + last.size == region.srcOffset && last.dstOffset + last.size == region.dstOffset)
+                        last.size += region.size;
+                    else
+                        copies.regions.push_back(region);
+                    copies.begin = std::min<size_t>(copies.begin, region.dstOffset);
+                    copies.end = std::max(copies.end, regionEnd);
+                    return;
+                }
+
+                // order of writes to the same range within one copy command is undefined
+                flushCopies();
+            }
+
+            m_bufCopyIx.insert({ dst, (uint32_t)m_bufCopies.size() });
+            BufferCopies& copies = m_bufCopies.emplace_back();
+            copies.dst = refctd<BufferResource>(dst);
+            copies.regions.push_back(region);
+            copies.begin = region.dstOffset;
+            copies.end = regionEnd;
+        }
+
+        // Regions of one image upload never overlap, `dst` must be already in m_imgCopyIx if it's not a new upload
+        nbl::core::vector<nbl::video::IGPUImage::SBufferCopy>& getImageCopyRegions(ImageResource* dst)
+        {
+            auto found = m_imgCopyIx.find(dst);
+            if (found != m_imgCopyIx.end())
+                return m_imgCopies[found->second].regions;
+
+            m_imgCopyIx.insert({ dst, (uint32_t)m_imgCopies.size() });
+            ImageCopies& copies = m_imgCopies.emplace_back();
+            copies.dst = refctd<ImageResource>(dst);
+            return copies.regions;
+        }
+
+        void flushCopies()
+        {
+            if (m_bufCopies.empty() && m_imgCopies.empty())
+                return;
+
+            m_bufCopyCmds.clear();
+            for (const auto& c : m_bufCopies)
+                m_bufCopyCmds.push_back({ c.dst.get(), (uint32_t)c.regions.size(), c.regions.data() });
+            m_imgCopyCmds.clear();
+            for (const auto& c : m_imgCopies)
+            {
+                if (!c.regions.empty())
+                    m_imgCopyCmds.push_back({ c.dst.get(), (uint32_t)c.regions.size(), c.regions.data() });
+            }
+
+            m_cmdrec.copyBatched(m_stagingResource.get(),
+                (uint32_t)m_bufCopyCmds.size(), m_bufCopyCmds.data(),
+                (uint32_t)m_imgCopyCmds.size(), m_imgCopyCmds.data());
+            m_stats.copyCommands += (uint32_t)(m_bufCopyCmds.size() + m_imgCopyCmds.size());
+
+            m_bufCopies.clear();
+            m_bufCopyIx.clear();
+            m_imgCopies.clear();
+            m_imgCopyIx.clear();
+        }
+
+        // Returns number of bytes recorded, the rest didn't fit
+        size_t recordBufferUpload(BufferResource* bufferResource, size_t offset, size_t size, const uint8_t* data)
+        {
+            size_t done = 0ULL;
+            while (done < size)
+            {
+                uint32_t chunk = 0U;
+                const uint32_t srcOffset = allocSpace(size - done, std::min<size_t>(size - done, StagingAlignment), StagingAlignment, chunk);
+                if (srcOffset == InvalidOffset)
+                    break;
+
+                m_stagingWriter.write(m_stagingPtr + srcOffset, data + done, chunk);
+                addWrittenRange(srcOffset, chunk);
+                m_stats.uploadedBytes += chunk;
+
+                nbl::video::IGPUCommandBuffer::SBufferCopy region;
+                region.dstOffset = bufferResource->getOffset() + offset + done;
+                region.srcOffset = m_stagingResource->getOffset() + srcOffset;
+                region.size = chunk;
+                addBufferCopy(bufferResource, region);
+
+                done += chunk;
+            }
+
+            return done;
+        }
+
+        // Returns true once the whole image is recorded. Region fitting in free space is copied at once,
+        // otherwise (or if some of its layers are clean) it's split into bands of rows, one array layer and depth slice at a time.
+        bool recordImageUpload(PendingUpload& up)
+        {
+            // new upload of an image already written in this pass, previous copies must be done first
+            if (up.region == 0U && up.layer == 0U && up.slice == 0U && up.row == 0U && m_imgCopyIx.find(up.image.get()) != m_imgCopyIx.end())
+                flushCopies();
+            auto& regions = getImageCopyRegions(up.image.get());
+
+            auto nextRegion = [&up](uint32_t layerCount)
+            {
+                up.layer = 0U;
+                up.regionLayerBase += layerCount;
+                up.region++;
+            };
+
+            const auto& srcregions = up.srcRegions;
+            const nbl::asset::E_FORMAT format = up.format;
+            const auto blockDim = nbl::asset::getBlockDimensions(format);
+            const uint32_t blockBytes = nbl::asset::getTexelOrBlockBytesize(format);
+            const size_t alignment = getImageStagingAlignment(format);
+            const uint8_t* const srcdata = up.srcdata;
+
+            while (up.region < (uint32_t)srcregions.size())
+            {
+                const auto& r = srcregions.begin()[up.region];
+
+                const uint32_t rowLength = r.bufferRowLength ? r.bufferRowLength : r.imageExtent.width;
+                const uint32_t imageHeight = r.bufferImageHeight ? r.bufferImageHeight : r.imageExtent.height;
+                const size_t rowBytes = (size_t)((rowLength + blockDim.x - 1U) / blockDim.x) * blockBytes;
+                const uint32_t rowsPerSlice = (imageHeight + blockDim.y - 1U) / blockDim.y;
+                const uint32_t rowCount = (r.imageExtent.height + blockDim.y - 1U) / blockDim.y;
+                const uint32_t layerCount = r.imageSubresource.layerCount;
+                const uint32_t depth = r.imageExtent.depth;
+
+                uint32_t size = 0U;
+                uint32_t srcOffset = InvalidOffset;
+
+                const auto cleanBegin = up.cleanLayers.begin() + up.regionLayerBase;
+                if (up.slice == 0U && up.row == 0U && cleanBegin[up.layer])
+                {
+                    if (++up.layer == layerCount)
+                        nextRegion(layerCount);
+                    continue;
+                }
+
+                // whole region
+                if (up.layer == 0U && up.slice == 0U && up.row == 0U && std::find(cleanBegin, cleanBegin + layerCount, true) == cleanBegin + layerCount)
+                {
+                    const size_t regionBytes = (size_t)layerCount * depth * rowsPerSlice * rowBytes;
+                    if (regionBytes <= StagingRingSize)
+                        srcOffset = allocSpace(regionBytes, regionBytes, alignment, size);
+                    if (srcOffset != InvalidOffset)
+                    {
+                        m_stagingWriter.write(m_stagingPtr + srcOffset, srcdata + r.bufferOffset, regionBytes);
+                        addWrittenRange(srcOffset, regionBytes);
+                        m_stats.uploadedBytes += regionBytes;
+
+                        nbl::video::IGPUImage::SBufferCopy& region = regions.emplace_back(r);
+                        region.bufferOffset = m_stagingResource->getOffset() + srcOffset;
+
+                        nextRegion(layerCount);
+                        continue;
+                    }
+                }
+
+                // band of rows of one layer and slice
+                srcOffset = allocSpace((rowCount - up.row) * rowBytes, rowBytes, alignment, size);
+                if (srcOffset == InvalidOffset)
+                    break;
+
+                const uint32_t rows = (uint32_t)(size / rowBytes);
+                const size_t srcdataOffset = r.bufferOffset + (((size_t)up.layer * depth + up.slice) * rowsPerSlice + up.row) * rowBytes;
+                m_stagingWriter.write(m_stagingPtr + srcOffset, srcdata + srcdataOffset, size);
+                addWrittenRange(srcOffset, size);
+                m_stats.uploadedBytes += size;
+
+                nbl::video::IGPUImage::SBufferCopy& region = regions.emplace_back(r);
+                region.bufferOffset = m_stagingResource->getOffset() + srcOffset;
+                region.bufferRowLength = rowLength;
+                region.bufferImageHeight = 0U;
+                region.imageSubresource.baseArrayLayer = r.imageSubresource.baseArrayLayer + up.layer;
+                region.imageSubresource.layerCount = 1U;
+                region.imageOffset.y = r.imageOffset.y + up.row * blockDim.y;
+                region.imageOffset.z = r.imageOffset.z + up.slice;
+                region.imageExtent.height = std::min(rows * blockDim.y, r.imageExtent.height - up.row * blockDim.y);
+                region.imageExtent.depth = 1U;
+
+                up.row += rows;
+                if (up.row == rowCount)
+                {
+                    up.row = 0U;
+                    if (++up.slice == depth)
+                    {
+                        up.slice = 0U;
+                        if (++up.layer == layerCount)
+                            nextRegion(layerCount);
+                    }
+                }
+            }
+
+            return up.region == (uint32_t)srcregions.size();
+        }
+
+        void onImageUploadRecorded(const PendingUpload& up)
+        {
+            if (!up.generateMips)
+                return;
+            for (const auto& img : m_mipGenImages)
+            {
+                if (img == up.image)
+                    return;
+            }
+            m_mipGenImages.push_back(up.image);
+        }
+
+        void recordDeferred()
+        {
+            while (!m_deferred.empty())
+            {
+                PendingUpload& up = m_deferred.front();
+
+                bool finished;
+                if (up.image)
+                {
+                    finished = recordImageUpload(up);
+                    if (finished)
+                        onImageUploadRecorded(up);
+                }
+                else
+                {
+                    up.done += recordBufferUpload(up.buffer.get(), up.dstOffset + up.done, up.data.size() - up.done, up.data.data() + up.done);
+                    finished = (up.done == up.data.size());
+                }
+
+                if (!finished)
+                    break;
+                m_deferred.pop_front();
+            }
+        }
 
-    private:
         nbl::video::ILogicalDevice* m_device;
+        ResourceAllocator* m_ra;
+        nbl::video::ISemaphore* m_frameTimeline;
+        EBackPressure m_backPressure = EBackPressure::Block;
+        uint64_t m_signalVal = 0ULL;
 
         refctd<BufferResource> m_stagingResource;
-        using addr_alctr_t = nbl::core::GeneralpurposeAddressAllocator<uint32_t>;
-        void* m_addrAlctrScratch = nullptr;
-        addr_alctr_t m_addrAlctr;
+        uint8_t* m_stagingPtr = nullptr;
+        StagingWriter m_stagingWriter;
+        // monotonic byte positions, physical offset within the ring is position % StagingRingSize
+        uint64_t m_headPos = 0ULL;
+        uint64_t m_tailPos = 0ULL;
+        uint64_t m_recordedHeadPos = 0ULL;
+        nbl::core::deque<InflightRange> m_inflight;
+
+        nbl::core::deque<PendingUpload> m_deferred;
+
+        nbl::core::vector<BufferCopies> m_bufCopies;
+        nbl::core::unordered_map<BufferResource*, uint32_t> m_bufCopyIx;
+        nbl::core::vector<ImageCopies> m_imgCopies;
+        nbl::core::unordered_map<ImageResource*, uint32_t> m_imgCopyIx;
+        nbl::core::vector<CommandRecorder::BufferCopies> m_bufCopyCmds;
+        nbl::core::vector<CommandRecorder::BufferToImageCopies> m_imgCopyCmds;
+
+        MipGenerator* m_mipGen = nullptr;
+        nbl::core::vector<refctd<ImageResource>> m_mipGenImages; // uploads recorded in current pass
 
         CommandRecorder m_cmdrec;
+        nbl::core::vector<ResourceAllocator::MappedRange> m_writtenRanges;
+        UploadStats m_stats;
+
+        refctd<BufferResource> m_readbackResource;
+        const uint8_t* m_readbackPtr = nullptr;
+        uint64_t m_readbackHeadPos = 0ULL;
+        uint64_t m_readbackTailPos = 0ULL;
+        nbl::core::deque<PendingReadback> m_readbacks;
     };
-}
\ No newline at end of file
+}
@@ -3,24 +3,51 @@
 
 namespace kris
 {
-    refctd<SceneNode> Scene::createMeshSceneNode(nbl::video::ILogicalDevice* device, ResourceAllocator* ra, Mesh* mesh)
+    refctd<SceneNode> Scene::createMeshSceneNode(Mesh* mesh)
     {
+        // node's UBO data lives in Renderer's FrameAllocator, written every frame in CommandRecorder::setupDrawSceneNode
         auto node = nbl::core::make_smart_refctd_ptr<SceneNode>();
         node->m_mesh = refctd<Mesh>(mesh);
-        node->m_ds = m_renderer->createSceneNodeDescriptorSet();
 
-        nbl::video::IGPUBuffer::SCreationParams ci = {};
-        ci.usage = nbl::core::bitflag<nbl::asset::IBuffer::E_USAGE_FLAGS>(nbl::asset::IBuffer::EUF_UNIFORM_BUFFER_BIT) |
-            nbl::asset::IBuffer::EUF_TRANSFER_DST_BIT |
-            nbl::asset::IBuffer::EUF_INLINE_UPDATE_VIA_CMDBUF;
-        ci.size = sizeof(SceneNode::UBOData);
-        auto ubo = ra->allocBuffer(device, std::move(ci), device->getPhysicalDevice()->getDeviceLocalMemoryTypeBits());
+        return node;
+    }
 
-        nbl::video::IGPUDescriptorSet::SWriteDescriptorSet w;
-        nbl::video::IGPUDescriptorSet::SDescriptorInfo info;
-        node->m_ds.update(device, &w, &info, 0U, ubo.get());
-        device->updateDescriptorSets({ &w, 1 }, {});
+    void SceneNode::updateTransformTree(JobSystem* jobs, const transform_t& parentTform)
+    {
+        enum : uint32_t
+        {
+            ParallelChildCount = 64U, // fewer children are updated on calling thread
+            ChildrenPerJob = 16U,
+        };
 
-        return node;
+        m_data.worldMatrix = transform_t::concatenateBFollowedByA(getLocalTransform(), parentTform);
+
+        if (!jobs || m_children.size() < ParallelChildCount)
+        {
+            for (auto& child : m_children)
+            {
+                child->updateTransformTree(jobs, getGlobalTransform());
+            }
+            return;
+        }
+
+        nbl::core::vector<SceneNode*> children;
+        children.reserve(m_children.size());
+        for (auto& child : m_children)
+        {
+            children.push_back(child.get());
+        }
+        jobs->parallelFor(static_cast<uint32_t>(children.size()), ChildrenPerJob, [this, jobs, &children](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    children[i]->updateTransformTree(jobs, getGlobalTransform());
+                }
+            });
+    }
+
+    void Scene::updateTransforms(SceneNode* root)
+    {
+        root->updateTransformTree(m_renderer->getJobSystem());
     }
 }
\ No newline at end of file
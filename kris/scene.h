@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mesh.h"
+#include "job_system.h"
 
 namespace kris
 {
@@ -23,8 +24,9 @@ namespace kris
         };
 
         refctd<Mesh> m_mesh;
-        SceneNodeDescriptorSet m_ds;
         UBOData m_data;
+        // dynamic offset of m_data within FrameAllocator's buffer, valid only in the frame it was set up
+        uint32_t m_uboOffset = 0U;
         transform_t m_localTform;
         nbl::core::list<refctd<SceneNode>> m_children;
 
@@ -46,11 +48,23 @@ namespace kris
                 child->updateTransformTree(getGlobalTransform());
             }
         }
+        // Same, but children of nodes having many of them are updated as jobs
+        void updateTransformTree(JobSystem* jobs, const transform_t& parentTform = transform_t());
 
         void addChild(refctd<SceneNode>&& child)
         {
             m_children.push_back(std::move(child));
         }
+
+        // Nodes of the subtree in pre-order, e.g. for splitting draws into slices recorded in parallel
+        void flatten(nbl::core::vector<SceneNode*>& out)
+        {
+            out.push_back(this);
+            for (auto& child : m_children)
+            {
+                child->flatten(out);
+            }
+        }
     };
 
     class Scene
@@ -61,7 +75,10 @@ namespace kris
             m_renderer = rend;
         }
 
-        refctd<SceneNode> createMeshSceneNode(nbl::video::ILogicalDevice* device, ResourceAllocator* ra, Mesh* mesh);
+        refctd<SceneNode> createMeshSceneNode(Mesh* mesh);
+
+        // World transforms of the whole tree, in parallel with Renderer's job system if it has one
+        void updateTransforms(SceneNode* root);
 
         Renderer* m_renderer;
     };
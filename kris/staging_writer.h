@@ -0,0 +1,122 @@
+#pragma once
+
+#include "kris_common.h"
+#include "job_system.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KRIS_STAGING_WRITER_AVX2 1
+#define KRIS_STAGING_WRITER_SSE2 0
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KRIS_STAGING_WRITER_AVX2 0
+#define KRIS_STAGING_WRITER_SSE2 1
+#else
+#define KRIS_STAGING_WRITER_AVX2 0
+#define KRIS_STAGING_WRITER_SSE2 0
+#endif
+
+namespace kris
+{
+	// Copies into staging memory, which is usually write-combined: non-temporal stores bypass the cache (no reads
+	// of destination lines, no pollution of caches with data CPU never reads again). Large copies are split into chunks
+	// processed as jobs (see JobSystem::parallelFor()) together with the calling thread.
+	// Not thread-safe, one write at a time.
+	class StagingWriter
+	{
+	public:
+		enum : uint32_t
+		{
+			ParallelThreshold = 1U << 22, // 4M, smaller copies are done on calling thread alone
+			ChunkSize = 1U << 20, // 1M
+		};
+
+		// Without job system all copies are done on calling thread
+		explicit StagingWriter(JobSystem* jobs = nullptr) : m_jobs(jobs) {}
+
+		StagingWriter(const StagingWriter&) = delete;
+		StagingWriter& operator=(const StagingWriter&) = delete;
+
+		void write(void* dst, const void* src, size_t size)
+		{
+			if (size < ParallelThreshold || !m_jobs || m_jobs->getWorkerCount() < 2U)
+			{
+				streamCopy(reinterpret_cast<uint8_t*>(dst), reinterpret_cast<const uint8_t*>(src), size);
+				return;
+			}
+
+			const uint32_t chunkCount = (uint32_t)((size + ChunkSize - 1U) / ChunkSize);
+			m_jobs->parallelFor(chunkCount, 1U, [dst, src, size](uint32_t begin, uint32_t end)
+				{
+					const size_t offset = (size_t)begin * ChunkSize;
+					streamCopy(reinterpret_cast<uint8_t*>(dst) + offset, reinterpret_cast<const uint8_t*>(src) + offset,
+						std::min<size_t>((size_t)(end - begin) * ChunkSize, size - offset));
+				});
+		}
+
+		// Falls back to plain memcpy without SSE2
+		static void streamCopy(uint8_t* dst, const uint8_t* src, size_t size)
+		{
+#if KRIS_STAGING_WRITER_AVX2 || KRIS_STAGING_WRITER_SSE2
+#if KRIS_STAGING_WRITER_AVX2
+			using vec_t = __m256i;
+#else
+			using vec_t = __m128i;
+#endif
+			constexpr size_t VecSize = sizeof(vec_t);
+			constexpr size_t Unroll = 4ULL;
+
+			// streaming stores need aligned destination
+			const size_t head = std::min<size_t>(size, (VecSize - ((uintptr_t)dst & (VecSize - 1U))) & (VecSize - 1U));
+			memcpy(dst, src, head);
+			dst += head;
+			src += head;
+			size -= head;
+
+			vec_t* d = reinterpret_cast<vec_t*>(dst);
+			const vec_t* s = reinterpret_cast<const vec_t*>(src);
+			const size_t vecCount = size / VecSize;
+			size_t i = 0ULL;
+			for (; i + Unroll <= vecCount; i += Unroll)
+			{
+#if KRIS_STAGING_WRITER_AVX2
+				const vec_t v0 = _mm256_loadu_si256(s + i);
+				const vec_t v1 = _mm256_loadu_si256(s + i + 1);
+				const vec_t v2 = _mm256_loadu_si256(s + i + 2);
+				const vec_t v3 = _mm256_loadu_si256(s + i + 3);
+				_mm256_stream_si256(d + i, v0);
+				_mm256_stream_si256(d + i + 1, v1);
+				_mm256_stream_si256(d + i + 2, v2);
+				_mm256_stream_si256(d + i + 3, v3);
+#else
+				const vec_t v0 = _mm_loadu_si128(s + i);
+				const vec_t v1 = _mm_loadu_si128(s + i + 1);
+				const vec_t v2 = _mm_loadu_si128(s + i + 2);
+				const vec_t v3 = _mm_loadu_si128(s + i + 3);
+				_mm_stream_si128(d + i, v0);
+				_mm_stream_si128(d + i + 1, v1);
+				_mm_stream_si128(d + i + 2, v2);
+				_mm_stream_si128(d + i + 3, v3);
+#endif
+			}
+			for (; i < vecCount; ++i)
+			{
+#if KRIS_STAGING_WRITER_AVX2
+				_mm256_stream_si256(d + i, _mm256_loadu_si256(s + i));
+#else
+				_mm_stream_si128(d + i, _mm_loadu_si128(s + i));
+#endif
+			}
+			// non-temporal stores are weakly ordered, make them globally visible before anything else (e.g. queue submission)
+			_mm_sfence();
+
+			memcpy(dst + vecCount * VecSize, src + vecCount * VecSize, size - vecCount * VecSize);
+#else
+			memcpy(dst, src, size);
+#endif
+		}
+
+	private:
+		JobSystem* m_jobs;
+	};
+}
@@ -0,0 +1,274 @@
+#include "texture_streamer.h"
+
+namespace kris
+{
+	namespace
+	{
+		constexpr uint32_t makeFourCC(char a, char b, char c, char d)
+		{
+			return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+		}
+
+		enum : uint32_t
+		{
+			DDS_Magic = makeFourCC('D', 'D', 'S', ' '),
+
+			DDSD_MipMapCount = 0x20000U,
+			DDSD_Depth = 0x800000U,
+
+			DDPF_FourCC = 0x4U,
+			DDPF_RGB = 0x40U,
+
+			DDSCaps2_Cubemap = 0x200U,
+			DDSCaps2_Volume = 0x200000U,
+
+			DX10_Dimension_Texture1D = 2U,
+			DX10_Dimension_Texture3D = 4U,
+			DX10_Misc_TextureCube = 0x4U,
+		};
+
+		struct DDSPixelFormat
+		{
+			uint32_t size;
+			uint32_t flags;
+			uint32_t fourCC;
+			uint32_t rgbBitCount;
+			uint32_t rMask;
+			uint32_t gMask;
+			uint32_t bMask;
+			uint32_t aMask;
+		};
+		struct DDSHeader
+		{
+			uint32_t size;
+			uint32_t flags;
+			uint32_t height;
+			uint32_t width;
+			uint32_t pitchOrLinearSize;
+			uint32_t depth;
+			uint32_t mipMapCount;
+			uint32_t reserved1[11];
+			DDSPixelFormat pf;
+			uint32_t caps;
+			uint32_t caps2;
+			uint32_t caps3;
+			uint32_t caps4;
+			uint32_t reserved2;
+		};
+		struct DDSHeaderDX10
+		{
+			uint32_t dxgiFormat;
+			uint32_t resourceDimension;
+			uint32_t miscFlag;
+			uint32_t arraySize;
+			uint32_t miscFlags2;
+		};
+		static_assert(sizeof(DDSHeader) == 124U && sizeof(DDSHeaderDX10) == 20U);
+
+		nbl::asset::E_FORMAT formatFromDXGI(uint32_t dxgi)
+		{
+			switch (dxgi)
+			{
+			case 2U: return nbl::asset::EF_R32G32B32A32_SFLOAT;
+			case 10U: return nbl::asset::EF_R16G16B16A16_SFLOAT;
+			case 28U: return nbl::asset::EF_R8G8B8A8_UNORM;
+			case 29U: return nbl::asset::EF_R8G8B8A8_SRGB;
+			case 49U: return nbl::asset::EF_R8G8_UNORM;
+			case 61U: return nbl::asset::EF_R8_UNORM;
+			case 71U: return nbl::asset::EF_BC1_RGBA_UNORM_BLOCK;
+			case 72U: return nbl::asset::EF_BC1_RGBA_SRGB_BLOCK;
+			case 74U: return nbl::asset::EF_BC2_UNORM_BLOCK;
+			case 75U: return nbl::asset::EF_BC2_SRGB_BLOCK;
+			case 77U: return nbl::asset::EF_BC3_UNORM_BLOCK;
+			case 78U: return nbl::asset::EF_BC3_SRGB_BLOCK;
+			case 80U: return nbl::asset::EF_BC4_UNORM_BLOCK;
+			case 81U: return nbl::asset::EF_BC4_SNORM_BLOCK;
+			case 83U: return nbl::asset::EF_BC5_UNORM_BLOCK;
+			case 84U: return nbl::asset::EF_BC5_SNORM_BLOCK;
+			case 87U: return nbl::asset::EF_B8G8R8A8_UNORM;
+			case 91U: return nbl::asset::EF_B8G8R8A8_SRGB;
+			case 95U: return nbl::asset::EF_BC6H_UFLOAT_BLOCK;
+			case 96U: return nbl::asset::EF_BC6H_SFLOAT_BLOCK;
+			case 98U: return nbl::asset::EF_BC7_UNORM_BLOCK;
+			case 99U: return nbl::asset::EF_BC7_SRGB_BLOCK;
+			default: return nbl::asset::EF_UNKNOWN;
+			}
+		}
+
+		nbl::asset::E_FORMAT formatFromLegacy(const DDSPixelFormat& pf)
+		{
+			if (pf.flags & DDPF_FourCC)
+			{
+				switch (pf.fourCC)
+				{
+				case makeFourCC('D', 'X', 'T', '1'): return nbl::asset::EF_BC1_RGBA_UNORM_BLOCK;
+				case makeFourCC('D', 'X', 'T', '3'): return nbl::asset::EF_BC2_UNORM_BLOCK;
+				case makeFourCC('D', 'X', 'T', '5'): return nbl::asset::EF_BC3_UNORM_BLOCK;
+				case makeFourCC('A', 'T', 'I', '1'): [[fallthrough]];
+				case makeFourCC('B', 'C', '4', 'U'): return nbl::asset::EF_BC4_UNORM_BLOCK;
+				case makeFourCC('A', 'T', 'I', '2'): [[fallthrough]];
+				case makeFourCC('B', 'C', '5', 'U'): return nbl::asset::EF_BC5_UNORM_BLOCK;
+				default: return nbl::asset::EF_UNKNOWN;
+				}
+			}
+			if ((pf.flags & DDPF_RGB) && pf.rgbBitCount == 32U)
+			{
+				if (pf.rMask == 0x000000ffU && pf.gMask == 0x0000ff00U && pf.bMask == 0x00ff0000U)
+					return nbl::asset::EF_R8G8B8A8_UNORM;
+				if (pf.rMask == 0x00ff0000U && pf.gMask == 0x0000ff00U && pf.bMask == 0x000000ffU)
+					return nbl::asset::EF_B8G8R8A8_UNORM;
+			}
+			return nbl::asset::EF_UNKNOWN;
+		}
+	}
+
+	refctd<StreamedImage> StreamedImage::loadDDS(nbl::system::ISystem* system, const nbl::system::path& path)
+	{
+		refctd<StreamedImage> img(KRIS_MEM_NEW StreamedImage(path), nbl::core::dont_grab);
+
+		nbl::system::ISystem::future_t<refctd<nbl::system::IFile>> future;
+		system->createFile(future, path, nbl::core::bitflag(nbl::system::IFileBase::ECF_READ) | nbl::system::IFileBase::ECF_MAPPABLE);
+		if (auto file = future.acquire())
+			file.move_into(img->m_file);
+		if (!img->m_file)
+			return img;
+
+		const size_t fileSize = img->m_file->getSize();
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(img->m_file->getMappedPointer());
+		if (!data)
+		{
+			img->m_data.resize(fileSize);
+
+			nbl::system::IFile::success_t success;
+			img->m_file->read(success, img->m_data.data(), 0ULL, fileSize);
+			if (!success)
+				return img;
+
+			data = img->m_data.data();
+			img->m_file = nullptr;
+		}
+
+		if (!img->parseDDS(data, fileSize))
+		{
+			img->m_payload = nullptr;
+			img->m_data.clear();
+			img->m_file = nullptr;
+		}
+
+		return img;
+	}
+
+	void StreamedImage::prefault() const
+	{
+		enum : uint32_t
+		{
+			// smallest page size of supported platforms, touching more often than needed is cheap compared to the reads
+			PageSize = 4096U,
+		};
+
+		if (!isValid() || !m_payloadSize)
+			return;
+
+		// volatile keeps the reads from being optimized out
+		const volatile uint8_t* p = m_payload;
+		uint8_t sink = 0U;
+		for (size_t offset = 0ULL; offset < m_payloadSize; offset += PageSize)
+			sink ^= p[offset];
+		sink ^= p[m_payloadSize - 1ULL];
+		(void)sink;
+	}
+
+	bool StreamedImage::parseDDS(const uint8_t* file, size_t fileSize)
+	{
+		size_t offset = sizeof(uint32_t) + sizeof(DDSHeader);
+		if (fileSize < offset)
+			return false;
+
+		uint32_t magic;
+		memcpy(&magic, file, sizeof(magic));
+		DDSHeader hdr;
+		memcpy(&hdr, file + sizeof(magic), sizeof(hdr));
+		if (magic != DDS_Magic || hdr.size != sizeof(DDSHeader))
+			return false;
+
+		nbl::asset::E_FORMAT format;
+		nbl::asset::IImage::E_TYPE type = nbl::asset::IImage::ET_2D;
+		uint32_t layers = 1U;
+		bool cube = false;
+		if ((hdr.pf.flags & DDPF_FourCC) && hdr.pf.fourCC == makeFourCC('D', 'X', '1', '0'))
+		{
+			if (fileSize < offset + sizeof(DDSHeaderDX10))
+				return false;
+
+			DDSHeaderDX10 hdr10;
+			memcpy(&hdr10, file + offset, sizeof(hdr10));
+			offset += sizeof(hdr10);
+
+			format = formatFromDXGI(hdr10.dxgiFormat);
+			if (hdr10.resourceDimension == DX10_Dimension_Texture1D)
+				type = nbl::asset::IImage::ET_1D;
+			else if (hdr10.resourceDimension == DX10_Dimension_Texture3D)
+				type = nbl::asset::IImage::ET_3D;
+			cube = (hdr10.miscFlag & DX10_Misc_TextureCube) != 0U;
+			layers = std::max(hdr10.arraySize, 1U) * (cube ? 6U : 1U);
+		}
+		else
+		{
+			format = formatFromLegacy(hdr.pf);
+			if (hdr.caps2 & DDSCaps2_Volume)
+				type = nbl::asset::IImage::ET_3D;
+			// partial cubemaps are not supported
+			cube = (hdr.caps2 & DDSCaps2_Cubemap) != 0U;
+			layers = cube ? 6U : 1U;
+		}
+		if (format == nbl::asset::EF_UNKNOWN)
+			return false;
+
+		m_params.type = type;
+		m_params.samples = nbl::asset::IImage::ESCF_1_BIT;
+		m_params.format = format;
+		m_params.extent = {
+			std::max(hdr.width, 1U),
+			std::max(hdr.height, 1U),
+			(type == nbl::asset::IImage::ET_3D && (hdr.flags & DDSD_Depth)) ? std::max(hdr.depth, 1U) : 1U
+		};
+		m_params.mipLevels = (hdr.flags & DDSD_MipMapCount) ? std::max(hdr.mipMapCount, 1U) : 1U;
+		m_params.arrayLayers = layers;
+		m_params.flags = cube ? nbl::asset::IImage::ECF_CUBE_COMPATIBLE_BIT : nbl::asset::IImage::ECF_NONE;
+		m_params.usage = nbl::core::bitflag(nbl::asset::IImage::EUF_TRANSFER_DST_BIT) | nbl::asset::IImage::EUF_SAMPLED_BIT;
+
+		// payload is all the mips of first layer, then all the mips of second one and so on, each mip tightly packed
+		const auto blockDim = nbl::asset::getBlockDimensions(format);
+		const uint32_t blockBytes = nbl::asset::getTexelOrBlockBytesize(format);
+		size_t payloadSize = 0ULL;
+		m_regions.clear();
+		for (uint32_t layer = 0U; layer < layers; ++layer)
+		{
+			for (uint32_t mip = 0U; mip < m_params.mipLevels; ++mip)
+			{
+				const uint32_t w = std::max(m_params.extent.width >> mip, 1U);
+				const uint32_t h = std::max(m_params.extent.height >> mip, 1U);
+				const uint32_t d = std::max(m_params.extent.depth >> mip, 1U);
+
+				nbl::asset::IImage::SBufferCopy& r = m_regions.emplace_back();
+				r.bufferOffset = payloadSize;
+				r.bufferRowLength = 0U;
+				r.bufferImageHeight = 0U;
+				r.imageSubresource.aspectMask = nbl::asset::IImage::EAF_COLOR_BIT;
+				r.imageSubresource.mipLevel = mip;
+				r.imageSubresource.baseArrayLayer = layer;
+				r.imageSubresource.layerCount = 1U;
+				r.imageOffset = { 0, 0, 0 };
+				r.imageExtent = { w, h, d };
+
+				payloadSize += (size_t)((w + blockDim.x - 1U) / blockDim.x) * ((h + blockDim.y - 1U) / blockDim.y) * d * blockBytes;
+			}
+		}
+		if (fileSize < offset + payloadSize)
+			return false;
+
+		m_payload = file + offset;
+		m_payloadSize = payloadSize;
+		return true;
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "kris_common.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace kris
+{
+	// Image whose texel data is referenced straight in its file, no intermediate ICPUImage is created.
+	// File is memory mapped if the system allows, otherwise it's read into memory owned by the image.
+	// Can be uploaded with ResourceUtils::uploadImageData() taking raw data (getRegions() offsets are relative to getPayload()).
+	class StreamedImage final : public nbl::core::IReferenceCounted
+	{
+	public:
+		// Parses header of .dds file (legacy or DX10), regions are computed from it. Returns invalid image on failure.
+		static refctd<StreamedImage> loadDDS(nbl::system::ISystem* system, const nbl::system::path& path);
+
+		bool isValid() const { return m_payload != nullptr; }
+		bool isMapped() const { return m_data.empty() && isValid(); }
+
+		// Touches every page of mapped payload, so the file is read by calling thread and not by the first copy out of it
+		void prefault() const;
+
+		const nbl::system::path& getPath() const { return m_path; }
+		// usage is transfer dst and sampled
+		const nbl::asset::IImage::SCreationParams& getCreationParameters() const { return m_params; }
+		const nbl::core::vector<nbl::asset::IImage::SBufferCopy>& getRegions() const { return m_regions; }
+		const void* getPayload() const { return m_payload; }
+		size_t getPayloadSize() const { return m_payloadSize; }
+
+	private:
+		StreamedImage(const nbl::system::path& path) : m_path(path) {}
+		~StreamedImage() = default;
+
+		bool parseDDS(const uint8_t* file, size_t fileSize);
+
+		nbl::system::path m_path;
+		refctd<nbl::system::IFile> m_file; // keeps the mapping alive
+		nbl::core::vector<uint8_t> m_data; // whole file, only if it couldn't be mapped
+		const uint8_t* m_payload = nullptr;
+		size_t m_payloadSize = 0ULL;
+
+		nbl::asset::IImage::SCreationParams m_params = {};
+		nbl::core::vector<nbl::asset::IImage::SBufferCopy> m_regions;
+	};
+
+	// Opens, parses and prefaults image files on a background thread. Loaded images are picked up on render thread and uploaded
+	// right from the mapped files, so texel data is copied just once, into staging memory, without waiting for disk.
+	class TextureStreamer
+	{
+	public:
+		TextureStreamer() = default;
+		~TextureStreamer()
+		{
+			if (!m_worker.joinable())
+				return;
+			{
+				std::lock_guard lock(m_mutex);
+				m_quit = true;
+			}
+			m_cv.notify_one();
+			m_worker.join();
+		}
+
+		void init(refctd<nbl::system::ISystem>&& system)
+		{
+			m_system = std::move(system);
+			m_worker = std::thread(&TextureStreamer::workerMain, this);
+		}
+
+		void request(const nbl::system::path& path)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				m_requests.push_back(path);
+				m_pendingCount++;
+			}
+			m_cv.notify_one();
+		}
+
+		// Gives images in order of requests, failed ones too (see StreamedImage::isValid())
+		bool pollLoaded(refctd<StreamedImage>& out)
+		{
+			std::lock_guard lock(m_mutex);
+			if (m_loaded.empty())
+				return false;
+
+			out = std::move(m_loaded.front());
+			m_loaded.pop_front();
+			m_pendingCount--;
+			return true;
+		}
+
+		uint32_t getPendingCount() const
+		{
+			std::lock_guard lock(m_mutex);
+			return m_pendingCount;
+		}
+
+	private:
+		void workerMain()
+		{
+			for (;;)
+			{
+				nbl::system::path path;
+				{
+					std::unique_lock lock(m_mutex);
+					m_cv.wait(lock, [this] { return m_quit || !m_requests.empty(); });
+					if (m_quit)
+						return;
+
+					path = std::move(m_requests.front());
+					m_requests.pop_front();
+				}
+
+				refctd<StreamedImage> img = StreamedImage::loadDDS(m_system.get(), path);
+				if (img->isMapped())
+					img->prefault();
+
+				std::lock_guard lock(m_mutex);
+				m_loaded.push_back(std::move(img));
+			}
+		}
+
+		refctd<nbl::system::ISystem> m_system;
+		std::thread m_worker;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_quit = false;
+		uint32_t m_pendingCount = 0U;
+		nbl::core::deque<nbl::system::path> m_requests;
+		nbl::core::deque<refctd<StreamedImage>> m_loaded;
+	};
+}
@@ -0,0 +1,305 @@
+#include "tlsf_allocator.h"
+
+namespace kris
+{
+	TLSFAddressAllocator::TLSFAddressAllocator(size_type size, size_type minBlockSize)
+	{
+		KRIS_ASSERT_MSG(nbl::core::isPoT(minBlockSize), "TLSF min block size must be power of 2!");
+
+		m_unitLog2 = nbl::hlsl::findMSB(minBlockSize);
+		m_totalSize = (size >> m_unitLog2) << m_unitLog2;
+		m_freeSize = m_totalSize;
+
+		for (auto& fl : m_freeHeads)
+			for (auto& head : fl)
+				head = InvalidBlock;
+
+		if (m_totalSize == 0U)
+			return;
+
+		const uint32_t ix = newBlock();
+		auto& b = m_blocks[ix];
+		b.offset = 0U;
+		b.size = m_totalSize >> m_unitLog2;
+		b.prevPhys = InvalidBlock;
+		b.nextPhys = InvalidBlock;
+		insertFreeBlock(ix);
+	}
+
+	TLSFAddressAllocator::size_type TLSFAddressAllocator::alloc_addr(size_type size, size_type alignment)
+	{
+		if (size == 0U)
+			return invalid_address;
+
+		const size_type unitMask = (1U << m_unitLog2) - 1U;
+		const size_type units = (size + unitMask) >> m_unitLog2;
+		const size_type alignUnits = std::max<size_type>(alignment >> m_unitLog2, 1U);
+		// worst case padding needed to satisfy alignment
+		const size_type searchUnits = units + alignUnits - 1U;
+
+		uint32_t fl, sl;
+		mappingSearch(searchUnits, fl, sl);
+		uint32_t ix = (fl < FLCount) ? findSuitableBlock(fl, sl) : InvalidBlock;
+		// blocks of the classes good-fit search skips may still fit, e.g. an exactly sized pool's only block
+		if (ix == InvalidBlock)
+			ix = findFittingBlock(units, alignUnits);
+		if (ix == InvalidBlock)
+			return invalid_address;
+
+		removeFreeBlock(ix);
+
+		const size_type alignedOffset = nbl::core::alignUp(m_blocks[ix].offset, alignUnits);
+		const size_type padding = alignedOffset - m_blocks[ix].offset;
+		if (padding)
+		{
+			const uint32_t front = ix;
+			ix = split(front, padding);
+			insertFreeBlock(front);
+		}
+		if (m_blocks[ix].size > units)
+		{
+			const uint32_t rest = split(ix, units);
+			insertFreeBlock(rest);
+		}
+
+		m_blocks[ix].free = false;
+		m_allocated.insert({ m_blocks[ix].offset, ix });
+		m_freeSize -= m_blocks[ix].size << m_unitLog2;
+
+		return m_blocks[ix].offset << m_unitLog2;
+	}
+
+	void TLSFAddressAllocator::free_addr(size_type addr, size_type size)
+	{
+		KRIS_UNUSED_PARAM(size);
+
+		auto found = m_allocated.find(addr >> m_unitLog2);
+		KRIS_ASSERT_MSG(found != m_allocated.end(), "Trying to free address which was never allocated!");
+		if (found == m_allocated.end())
+			return;
+
+		uint32_t ix = found->second;
+		m_allocated.erase(found);
+
+		m_blocks[ix].free = true;
+		m_freeSize += m_blocks[ix].size << m_unitLog2;
+
+		const uint32_t prev = m_blocks[ix].prevPhys;
+		if (prev != InvalidBlock && m_blocks[prev].free)
+		{
+			removeFreeBlock(prev);
+			merge(prev, ix);
+			ix = prev;
+		}
+		const uint32_t next = m_blocks[ix].nextPhys;
+		if (next != InvalidBlock && m_blocks[next].free)
+		{
+			removeFreeBlock(next);
+			merge(ix, next);
+		}
+
+		insertFreeBlock(ix);
+	}
+
+	TLSFAddressAllocator::size_type TLSFAddressAllocator::get_largest_free_block_lower_bound() const
+	{
+		if (m_flBitmap == 0U)
+			return 0U;
+
+		const uint32_t fl = nbl::hlsl::findMSB(m_flBitmap);
+		const uint32_t sl = nbl::hlsl::findMSB(m_slBitmap[fl]);
+
+		return classLowerBound(fl, sl) << m_unitLog2;
+	}
+
+	TLSFAddressAllocator::size_type TLSFAddressAllocator::get_largest_free_block() const
+	{
+		if (m_flBitmap == 0U)
+			return 0U;
+
+		const uint32_t fl = nbl::hlsl::findMSB(m_flBitmap);
+		const uint32_t sl = nbl::hlsl::findMSB(m_slBitmap[fl]);
+
+		size_type largest = 0U;
+		for (uint32_t ix = m_freeHeads[fl][sl]; ix != InvalidBlock; ix = m_blocks[ix].nextFree)
+			largest = std::max(largest, m_blocks[ix].size);
+
+		return largest << m_unitLog2;
+	}
+
+	void TLSFAddressAllocator::mapping(size_type units, uint32_t& fl, uint32_t& sl)
+	{
+		if (units < SLCount)
+		{
+			fl = 0U;
+			sl = units;
+			return;
+		}
+
+		const uint32_t msb = nbl::hlsl::findMSB(units);
+		fl = msb - SLCountLog2 + 1U;
+		sl = (units >> (msb - SLCountLog2)) ^ SLCount;
+	}
+
+	void TLSFAddressAllocator::mappingSearch(size_type units, uint32_t& fl, uint32_t& sl)
+	{
+		// round up to the next class boundary, so that any block found in resulting class is big enough
+		if (units >= SLCount)
+		{
+			const uint32_t msb = nbl::hlsl::findMSB(units);
+			const uint64_t rounded = uint64_t(units) + (1ULL << (msb - SLCountLog2)) - 1ULL;
+			if (rounded > ~size_type(0U))
+			{
+				fl = FLCount;
+				sl = 0U;
+				return;
+			}
+			units = (size_type)rounded;
+		}
+		mapping(units, fl, sl);
+	}
+
+	TLSFAddressAllocator::size_type TLSFAddressAllocator::classLowerBound(uint32_t fl, uint32_t sl)
+	{
+		if (fl == 0U)
+			return sl;
+		return (SLCount + sl) << (fl - 1U);
+	}
+
+	uint32_t TLSFAddressAllocator::findSuitableBlock(uint32_t fl, uint32_t sl) const
+	{
+		uint32_t slMap = m_slBitmap[fl] & (~0U << sl);
+		if (slMap == 0U)
+		{
+			const uint32_t flMap = (fl + 1U < FLCount) ? (m_flBitmap & (~0U << (fl + 1U))) : 0U;
+			if (flMap == 0U)
+				return InvalidBlock;
+
+			fl = nbl::hlsl::findLSB(flMap);
+			slMap = m_slBitmap[fl];
+		}
+		sl = nbl::hlsl::findLSB(slMap);
+
+		return m_freeHeads[fl][sl];
+	}
+
+	uint32_t TLSFAddressAllocator::findFittingBlock(size_type units, size_type alignUnits) const
+	{
+		uint32_t fl, sl, lastFl, lastSl;
+		mapping(units, fl, sl);
+		mapping(units + alignUnits - 1U, lastFl, lastSl);
+		while (fl < lastFl || (fl == lastFl && sl <= lastSl))
+		{
+			for (uint32_t ix = m_freeHeads[fl][sl]; ix != InvalidBlock; ix = m_blocks[ix].nextFree)
+			{
+				const Block& b = m_blocks[ix];
+				if (nbl::core::alignUp(b.offset, alignUnits) - b.offset + units <= b.size)
+					return ix;
+			}
+			if (++sl == SLCount)
+			{
+				sl = 0U;
+				fl++;
+			}
+		}
+		return InvalidBlock;
+	}
+
+	void TLSFAddressAllocator::insertFreeBlock(uint32_t ix)
+	{
+		auto& b = m_blocks[ix];
+
+		uint32_t fl, sl;
+		mapping(b.size, fl, sl);
+
+		b.free = true;
+		b.prevFree = InvalidBlock;
+		b.nextFree = m_freeHeads[fl][sl];
+		if (b.nextFree != InvalidBlock)
+			m_blocks[b.nextFree].prevFree = ix;
+		m_freeHeads[fl][sl] = ix;
+
+		m_flBitmap |= (1U << fl);
+		m_slBitmap[fl] |= (1U << sl);
+	}
+
+	void TLSFAddressAllocator::removeFreeBlock(uint32_t ix)
+	{
+		auto& b = m_blocks[ix];
+
+		uint32_t fl, sl;
+		mapping(b.size, fl, sl);
+
+		if (b.prevFree != InvalidBlock)
+			m_blocks[b.prevFree].nextFree = b.nextFree;
+		else
+			m_freeHeads[fl][sl] = b.nextFree;
+		if (b.nextFree != InvalidBlock)
+			m_blocks[b.nextFree].prevFree = b.prevFree;
+
+		if (m_freeHeads[fl][sl] == InvalidBlock)
+		{
+			m_slBitmap[fl] &= ~(1U << sl);
+			if (m_slBitmap[fl] == 0U)
+				m_flBitmap &= ~(1U << fl);
+		}
+
+		b.prevFree = b.nextFree = InvalidBlock;
+		b.free = false;
+	}
+
+	uint32_t TLSFAddressAllocator::newBlock()
+	{
+		if (!m_unusedBlocks.empty())
+		{
+			const uint32_t ix = m_unusedBlocks.back();
+			m_unusedBlocks.pop_back();
+			return ix;
+		}
+		m_blocks.emplace_back();
+		return (uint32_t)m_blocks.size() - 1U;
+	}
+
+	void TLSFAddressAllocator::releaseBlock(uint32_t ix)
+	{
+		m_unusedBlocks.push_back(ix);
+	}
+
+	uint32_t TLSFAddressAllocator::split(uint32_t ix, size_type size)
+	{
+		KRIS_ASSERT(m_blocks[ix].size > size);
+
+		// note: newBlock() may reallocate m_blocks, so no references kept across it
+		const uint32_t rest = newBlock();
+		auto& b = m_blocks[ix];
+		auto& r = m_blocks[rest];
+
+		r.offset = b.offset + size;
+		r.size = b.size - size;
+		r.prevPhys = ix;
+		r.nextPhys = b.nextPhys;
+		r.prevFree = r.nextFree = InvalidBlock;
+		r.free = false;
+		if (r.nextPhys != InvalidBlock)
+			m_blocks[r.nextPhys].prevPhys = rest;
+
+		b.size = size;
+		b.nextPhys = rest;
+
+		return rest;
+	}
+
+	void TLSFAddressAllocator::merge(uint32_t ix, uint32_t next)
+	{
+		auto& b = m_blocks[ix];
+		auto& n = m_blocks[next];
+		KRIS_ASSERT(b.nextPhys == next);
+
+		b.size += n.size;
+		b.nextPhys = n.nextPhys;
+		if (b.nextPhys != InvalidBlock)
+			m_blocks[b.nextPhys].prevPhys = ix;
+
+		releaseBlock(next);
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "kris_common.h"
+
+namespace kris
+{
+	// Two-level segregated fit allocator of offsets within [0, size).
+	// Doesn't touch the memory it hands out, all the bookkeeping lives on the CPU heap,
+	// so it can be used for sub-allocating device memory.
+	// Both alloc_addr and free_addr are O(1): first level indexes power-of-2 size ranges,
+	// second level splits each range linearly into SLCount buckets.
+	// Only when no block of a big enough class is free, alloc_addr walks the free-lists of the classes
+	// the request (plus alignment padding) falls into, blocks there may fit too.
+	// All sizes and offsets are internally kept in units of `minBlockSize`.
+	class TLSFAddressAllocator
+	{
+	public:
+		using size_type = uint32_t;
+
+		enum : uint32_t
+		{
+			SLCountLog2 = 4U,
+			SLCount = 1U << SLCountLog2,
+			FLCount = 32U,
+
+			InvalidBlock = ~0U,
+		};
+		enum : size_type
+		{
+			invalid_address = ~0U,
+		};
+
+		TLSFAddressAllocator() = default;
+		TLSFAddressAllocator(size_type size, size_type minBlockSize);
+
+		TLSFAddressAllocator(TLSFAddressAllocator&&) = default;
+		TLSFAddressAllocator& operator=(TLSFAddressAllocator&&) = default;
+
+		size_type alloc_addr(size_type size, size_type alignment);
+		void free_addr(size_type addr, size_type size);
+
+		size_type get_total_size() const { return m_totalSize; }
+		size_type get_free_size() const { return m_freeSize; }
+
+		// Lower bound (in bytes) of the biggest free block, 0 if there's no free space at all.
+		// Every request not exceeding this value (alignment padding included) is guaranteed to succeed.
+		size_type get_largest_free_block_lower_bound() const;
+		// Exact size (in bytes) of the biggest free block, walks free-list of the biggest non-empty class
+		size_type get_largest_free_block() const;
+
+	private:
+		struct Block
+		{
+			size_type offset; // in units
+			size_type size; // in units
+			uint32_t prevPhys;
+			uint32_t nextPhys;
+			uint32_t prevFree;
+			uint32_t nextFree;
+			bool free;
+		};
+
+		static void mapping(size_type units, uint32_t& fl, uint32_t& sl);
+		static void mappingSearch(size_type units, uint32_t& fl, uint32_t& sl);
+		static size_type classLowerBound(uint32_t fl, uint32_t sl);
+
+		uint32_t findSuitableBlock(uint32_t fl, uint32_t sl) const;
+		// first free block of the classes between `units` and `units + alignUnits - 1` able to fit the aligned request
+		uint32_t findFittingBlock(size_type units, size_type alignUnits) const;
+		void insertFreeBlock(uint32_t ix);
+		void removeFreeBlock(uint32_t ix);
+		uint32_t newBlock();
+		void releaseBlock(uint32_t ix);
+		// splits `size` units off the beginning of block `ix`, returns index of the remainder block
+		uint32_t split(uint32_t ix, size_type size);
+		// merges block `next` into block `ix`, they must be physical neighbours
+		void merge(uint32_t ix, uint32_t next);
+
+		size_type m_totalSize = 0U;
+		size_type m_freeSize = 0U;
+		size_type m_unitLog2 = 0U;
+
+		uint32_t m_flBitmap = 0U;
+		uint32_t m_slBitmap[FLCount] = {};
+		uint32_t m_freeHeads[FLCount][SLCount];
+
+		nbl::core::vector<Block> m_blocks;
+		nbl::core::vector<uint32_t> m_unusedBlocks;
+		// offset (in units) -> block index of allocated blocks
+		nbl::core::unordered_map<size_type, uint32_t> m_allocated;
+	};
+}
@@ -30,6 +30,10 @@ using namespace video;
 #include "kris/mesh.h"
 #include "kris/scene.h"
 #include "kris/resource_utils.h"
+#include "kris/defragmenter.h"
+#include "kris/async_uploader.h"
+#include "kris/texture_streamer.h"
+#include "kris/mip_generator.h"
 
 struct GeometryCreator
 {
@@ -189,6 +193,10 @@ struct GeometryCreator
 // For our Compute Shader
 constexpr uint32_t WorkgroupSize = 256;
 constexpr uint32_t WorkgroupCount = 2048;
+// Scene draws are split into slices of at least this many nodes, recorded in parallel
+constexpr uint32_t MinNodesPerSlice = 256;
+// Average time of recording scene draws and of the frame graph (with its barrier counts) is logged once per this many frames
+constexpr uint32_t RecordTimingFrames = 256;
 
 // this time instead of defining our own `int main()` we derive from `nbl::system::IApplicationFramework` to play "nice" wil all platforms
 class KrisTestApp final : public examples::SimpleWindowedApplication
@@ -283,24 +291,18 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 
 			m_assetMgr = nbl::core::make_smart_refctd_ptr<nbl::asset::IAssetManager>(kris::refctd(m_system));
 
-			// Allocate the memory
-			// allocate image (texture for cube mesh)
-			kris::refctd<kris::ImageResource> imageResource;
-			{
-				constexpr auto cachingFlags = static_cast<IAssetLoader::E_CACHING_FLAGS>(IAssetLoader::ECF_DONT_CACHE_REFERENCES & IAssetLoader::ECF_DONT_CACHE_TOP_LEVEL);
-				IAssetLoader::SAssetLoadParams loadParams(0ull, nullptr, cachingFlags);
-				auto imageBundle = m_assetMgr->getAsset((localInputCWD / "images/tex.dds").string(), loadParams);
-				auto imageContents = imageBundle.getContents();
-				KRIS_ASSERT(!imageContents.empty());
-				auto cpuimgview = nbl::core::smart_refctd_ptr_static_cast<nbl::asset::ICPUImageView>(*imageContents.begin());
-
-				m_cpuimg = cpuimgview->getCreationParameters().image;
+			m_ResourceAlctr.init(m_device.get());
+			m_ResourceAlctr.setOverBudgetCallback([this](uint32_t heapIx, const kris::ResourceAllocator::DeviceHeapStats& stats)
+				{
+					m_logger->log("Memory heap %u over budget: %zu of %zu bytes reserved (soft limit %zu)", ILogger::ELL_WARNING,
+						heapIx, stats.reservedBytes, stats.size, stats.softLimit);
+				});
 
-				nbl::video::IGPUImage::SCreationParams params;
-				static_cast<nbl::asset::IImage::SCreationParams&>(params) = m_cpuimg->getCreationParameters();
+			// texture for cube mesh is loaded in background, image is allocated and uploaded once it's picked up in workLoopBody()
+			m_TexStreamer.init(kris::refctd(m_system));
+			m_TexStreamer.request(localInputCWD / "images/tex.dds");
 
-				imageResource = m_ResourceAlctr.allocImage(m_device.get(), std::move(params), m_physicalDevice->getDeviceLocalMemoryTypeBits());
-			}
+			// Allocate the memory
 			// allocate buffer (output for compute shader)
 			{
 				constexpr size_t BufferSize = sizeof(uint32_t)*WorkgroupSize*WorkgroupCount;
@@ -310,9 +312,9 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 				params.size = BufferSize;
 				// While the usages on `ICPUBuffers` are mere hints to our automated CPU-to-GPU conversion systems which need to be patched up anyway,
 				// the usages on an `IGPUBuffer` are crucial to specify correctly.
-				params.usage = IGPUBuffer::EUF_STORAGE_BUFFER_BIT;
+				params.usage = nbl::core::bitflag(IGPUBuffer::EUF_STORAGE_BUFFER_BIT) | IGPUBuffer::EUF_TRANSFER_SRC_BIT; // results are read back
 
-				m_buffAllocation = m_ResourceAlctr.allocBuffer(m_device.get(), std::move(params), m_physicalDevice->getHostVisibleMemoryTypeBits());
+				m_buffAllocation = m_ResourceAlctr.allocBuffer(m_device.get(), std::move(params), m_physicalDevice->getDeviceLocalMemoryTypeBits());
 				if (!m_buffAllocation)
 					return logFail("Failed to create a GPU Buffer of size %d!\n", params.size);
 
@@ -320,9 +322,16 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 				m_buffAllocation->getBuffer()->setObjectDebugName("My Output Buffer");
 			}
 
+			// this thread is worker 0, it takes part in parallel work while waiting for it
+			m_Jobs.init();
 			m_Renderer.init(kris::refctd<nbl::video::ILogicalDevice>(m_device), m_sc.get(), nbl::asset::EF_D16_UNORM,
-				gQueue->getFamilyIndex(), &m_ResourceAlctr, m_physicalDevice->getHostVisibleMemoryTypeBits());
+				gQueue->getFamilyIndex(), &m_ResourceAlctr, m_physicalDevice->getHostVisibleMemoryTypeBits(), &m_Jobs);
 			m_Scene.init(&m_Renderer);
+			m_Defrag.init(m_device.get(), &m_ResourceAlctr);
+			m_AsyncUploader.init(m_device.get(), &m_ResourceAlctr, getTransferUpQueue(), gQueue->getFamilyIndex(), m_Renderer.getFrameTimeline(), &m_Jobs);
+			// transfer passes of the renderer are on graphics queue, so they can generate mips
+			m_MipGen.init(m_device.get(), m_system.get(), m_logger.get(), &m_ResourceAlctr, m_Renderer.getFrameTimeline());
+			m_Renderer.getResourceUtils()->setMipGenerator(&m_MipGen);
 
 			kris::MaterialBuilder mtlbuilder(m_system.get()); 
 			
@@ -338,7 +347,9 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 					ci.size = vtxbuf_data->getSize();
 					ci.usage = nbl::core::bitflag(nbl::asset::IBuffer::EUF_VERTEX_BUFFER_BIT) |
 						nbl::video::IGPUBuffer::EUF_TRANSFER_DST_BIT;
-					vtxbuf = m_ResourceAlctr.allocBuffer(m_device.get(), std::move(ci), m_physicalDevice->getDeviceLocalMemoryTypeBits());
+					// uploaded every frame, CPU writes it straight into its frame region (staged if there's no such memory)
+					vtxbuf = m_ResourceAlctr.allocBuffer(m_device.get(), std::move(ci), m_physicalDevice->getDeviceLocalMemoryTypeBits(),
+						kris::ResourceAllocator::AllocFlags::DirectWrite);
 				}
 				
 				kris::refctd<kris::BufferResource> idxbuf;
@@ -360,11 +371,11 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 					mesh->m_idxCount = m_cubedata.indexCount;
 					mesh->m_idxtype = m_cubedata.indexType;
 					mesh->m_vtxinput = m_cubedata.inputParams;
-					mesh->m_resources[0] = { .rmapIx = 3, .res = imageResource };
+					// m_resources[0] is the texture, set when it's loaded
 
-					m_scenenode = m_Scene.createMeshSceneNode(m_device.get(), &m_ResourceAlctr, mesh.get());
+					m_scenenode = m_Scene.createMeshSceneNode(mesh.get());
 
-					m_childnode = m_Scene.createMeshSceneNode(m_device.get(), &m_ResourceAlctr, mesh.get());
+					m_childnode = m_Scene.createMeshSceneNode(mesh.get());
 					m_childnode->getLocalTransform().setTranslation(nbl::core::vectorSIMDf(1.2f, 0.f, 0.f, 0.f));
 
 					m_scenenode->addChild(kris::refctd(m_childnode));
@@ -450,7 +461,7 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 					);
 				}
 
-				m_scenenode->updateTransformTree();
+				m_Scene.updateTransforms(m_scenenode.get());
 			}
 
 			m_Renderer.beginFrame(&camera);
@@ -464,6 +475,29 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 
 				kris::Mesh* mesh = m_scenenode->m_mesh.get();
 
+				// texture goes through transfer queue straight from the file mapping, acquired later in this frame
+				if (kris::refctd<kris::StreamedImage> texImage; m_TexStreamer.pollLoaded(texImage))
+				{
+					if (!texImage->isValid())
+					{
+						m_logger->log("Failed to load %s!", ILogger::ELL_ERROR, texImage->getPath().string().c_str());
+						m_shouldClose = true;
+					}
+					else
+					{
+						nbl::video::IGPUImage::SCreationParams params;
+						static_cast<nbl::asset::IImage::SCreationParams&>(params) = texImage->getCreationParameters();
+						kris::refctd<kris::ImageResource> imageResource = m_ResourceAlctr.allocImage(m_device.get(), std::move(params), m_physicalDevice->getDeviceLocalMemoryTypeBits());
+
+						const auto& texRegions = texImage->getRegions();
+						m_AsyncUploader.uploadImageData(m_Renderer.getCurrentFrameVal(), imageResource.get(), texImage->getCreationParameters().format,
+							(uint32_t)texRegions.size(), texRegions.data(), texImage->getPayload(), kris::refctd<nbl::core::IReferenceCounted>(texImage));
+						m_texUploadTicket = m_AsyncUploader.submit();
+
+						mesh->m_resources[0] = { .rmapIx = 3, .res = std::move(imageResource) };
+					}
+				}
+
 				{
 					auto* vtxbuf = mesh->m_vtxBuf.get();
 					auto& vtxbuf_data = m_cubedata.bindings[0].buffer;
@@ -476,70 +510,191 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 					utils->uploadBufferData(idxbuf, 0U, idxbuf->getSize(), idxbuf_data->getPointer());
 				}
 
-				// image upload
+				// async image upload, parts not fitting into staging ring are continued by poll() in following frames
+				m_AsyncUploader.poll(m_Renderer.getCurrentFrameVal());
+				if (m_texUploadTicket.isValid() && m_AsyncUploader.isSubmitted(m_texUploadTicket))
+				{
+					m_Renderer.addFrameWait(m_AsyncUploader.acquire(utils->getResult(), m_texUploadTicket));
+					m_texUploadTicket = {};
+					m_texResident = true;
+				}
+
+				// compact device memory a little bit every frame
+				{
+					const auto stats = m_Defrag.step(utils->getResult(), kris::MemDefragmenter::DefaultFrameBudget);
+					if (stats.bytesReclaimed)
+						m_logger->log("Defragmenter reclaimed %zu bytes", ILogger::ELL_PERFORMANCE, stats.bytesReclaimed);
+				}
+
+				// unchanged vertex/index data is skipped after the first frame, copies are recorded by now
 				{
-					auto* tex = static_cast<kris::ImageResource*>(mesh->m_resources[0].res.get());
-					utils->uploadImageData(tex, m_cpuimg.get());
+					const auto& upstats = utils->getUploadStats();
+					if (upstats.uploadedBytes || upstats.directBytes)
+						m_logger->log("Uploaded %zu bytes in %u copy commands, wrote %zu bytes directly, skipped %zu unchanged bytes", ILogger::ELL_PERFORMANCE,
+							upstats.uploadedBytes, upstats.copyCommands, upstats.directBytes, upstats.skippedBytes);
 				}
 
 				m_Renderer.consumeAsTransfer(std::move(utils->getResult()));
 			}
-			// base pass
+			// frame graph: passes declare what they access, barriers are emitted once per pass
 			{
-				kris::CommandRecorder cmdrec = m_Renderer.createCommandRecorder(kris::BasePass);
+				kris::RenderGraph* graph = m_Renderer.getRenderGraph();
+
+				const auto backbuffer = graph->importImage(m_Renderer.getSwapchainImage(m_currImgAcq), IGPUImage::LAYOUT::PRESENT_SRC);
+				const auto depth = graph->createImage({
+					.format = m_Renderer.getDepthFormat(),
+					.width = m_window->getWidth(),
+					.height = m_window->getHeight(),
+					.usage = IGPUImage::EUF_RENDER_ATTACHMENT_BIT
+				});
+
+				// compute results are only read back, the graph doesn't see any consumer
+				graph->addPass("compute", kris::BasePass, [this](kris::CommandRecorder& cmdrec, const kris::RenderGraph&)
+					{
+						cmdrec.setupMaterial(m_device.get(), m_mtl.get()); // first setup for dispatch (update desc set, memory barriers)
+						cmdrec.dispatch(m_device.get(), kris::BasePass, m_mtl.get(), WorkgroupCount, 1, 1); // do actual dispatch
 
-				cmdrec.setupMaterial(m_device.get(), m_mtl.get()); // first setup for dispatch (update desc set, memory barriers)
-				cmdrec.dispatch(m_device.get(), kris::BasePass, m_mtl.get(), WorkgroupCount, 1, 1); // do actual dispatch
+#define CHECK_COMPUTE_RESULT 0
 
-				asset::SViewport viewport;
-				{
-					viewport.minDepth = 1.f;
-					viewport.maxDepth = 0.f;
-					viewport.x = 0u;
-					viewport.y = 0u;
-					viewport.width = m_window->getWidth();
-					viewport.height = m_window->getHeight();
-				}
-				cmdrec.cmdbuf->setViewport(0u, 1u, &viewport);
+#if CHECK_COMPUTE_RESULT
+						// CS result is checked once GPU is done with this frame, without waiting for it
+						m_Renderer.getResourceUtils()->readbackBufferData(cmdrec, m_buffAllocation.get(), 0U, m_buffAllocation->getSize(),
+							[this](const void* data, size_t size)
+							{
+								auto buffData = reinterpret_cast<const uint32_t*>(data);
+								for (uint32_t i = 0U; i < size / sizeof(uint32_t); i++)
+								{
+									if (buffData[i] != i)
+									{
+										m_logger->log("DWORD at position %u doesn't match!\n", ILogger::ELL_ERROR, i);
+										break;
+									}
+								}
+							});
+#endif
+					}).sideEffects();
 
-				VkRect2D scissor =
-				{
-					.offset = { 0, 0 },
-					.extent = { m_window->getWidth(), m_window->getHeight() },
-				};
-				cmdrec.cmdbuf->setScissor(0u, 1u, &scissor);
+				graph->addPass("base", kris::BasePass, [this, backbuffer, depth](kris::CommandRecorder& cmdrec, const kris::RenderGraph& rg)
+					{
+						// setup draws (update desc sets, memory barriers), the scene is drawn once its texture is in
+						if (m_texResident)
+						{
+							cmdrec.setupDrawSceneNode(m_device.get(), m_scenenode.get());
+						}
 
-				// setup draws (update desc sets, memory barriers)
-				{
-					cmdrec.setupDrawSceneNode(m_device.get(), m_scenenode.get());
-				}
+						kris::ImageResource* const color = rg.getImage(backbuffer);
+						const kris::Framebuffer& fb = m_Renderer.getFramebuffer(kris::BasePass, &color, 1U, rg.getImage(depth));
 
-				// do draws within renderpass 
+						// record draws into secondaries, slices of the flattened scene in parallel
+						{
+							m_drawNodes.clear();
+							if (m_texResident)
+								m_scenenode->flatten(m_drawNodes);
+
+							const uint32_t nodeCount = static_cast<uint32_t>(m_drawNodes.size());
+							const uint32_t sliceCount = std::clamp((nodeCount + MinNodesPerSlice - 1U) / MinNodesPerSlice, 1U, kris::Renderer::MaxRecordingThreads);
+							const uint32_t nodesPerSlice = (nodeCount + sliceCount - 1U) / sliceCount;
+
+							const auto recordStart = clock_t::now();
+							m_Renderer.recordSecondaries(cmdrec, fb, sliceCount, [this, nodeCount, nodesPerSlice](kris::CommandRecorder& slice, uint32_t sliceIx)
+								{
+									asset::SViewport viewport;
+									{
+										viewport.minDepth = 1.f;
+										viewport.maxDepth = 0.f;
+										viewport.x = 0u;
+										viewport.y = 0u;
+										viewport.width = m_window->getWidth();
+										viewport.height = m_window->getHeight();
+									}
+									slice.cmdbuf->setViewport(0u, 1u, &viewport);
+
+									VkRect2D scissor =
+									{
+										.offset = { 0, 0 },
+										.extent = { m_window->getWidth(), m_window->getHeight() },
+									};
+									slice.cmdbuf->setScissor(0u, 1u, &scissor);
+
+									const uint32_t first = std::min(sliceIx * nodesPerSlice, nodeCount);
+									const uint32_t last = std::min(first + nodesPerSlice, nodeCount);
+									slice.drawSceneNodes(m_device.get(), kris::BasePass, m_drawNodes.data() + first, last - first);
+								});
+
+							m_recordTime += clock_t::now() - recordStart;
+							if (++m_recordTimeFrames == RecordTimingFrames)
+							{
+								m_logger->log("Recorded %u draws in %u slices on %u workers in %.3f ms on average", ILogger::ELL_PERFORMANCE,
+									nodeCount, sliceCount, m_Jobs.getWorkerCount(),
+									std::chrono::duration<double, std::milli>(m_recordTime).count() / RecordTimingFrames);
+								m_recordTime = {};
+								m_recordTimeFrames = 0U;
+							}
+						}
+
+						// begin renderpass
+						{
+							const VkRect2D currentRenderArea =
+							{
+								.offset = {0,0},
+								.extent = {m_window->getWidth(),m_window->getHeight()}
+							};
+
+							const IGPUCommandBuffer::SClearColorValue clearValue = { .float32 = {1.f,0.f,0.f,1.f} };
+							const IGPUCommandBuffer::SClearDepthStencilValue depthValue = { .depth = 0.f };
+
+							cmdrec.beginRenderPass(
+								currentRenderArea,
+								clearValue,
+								depthValue,
+								fb,
+								IGPUCommandBuffer::SUBPASS_CONTENTS::SECONDARY_COMMAND_BUFFERS);
+						}
+
+						cmdrec.executeSecondaries();
+
+						// the graph transitions backbuffer for presentation
+						cmdrec.endRenderPass(fb, false);
+					})
+					.writes(backbuffer, nbl::asset::ACCESS_FLAGS::COLOR_ATTACHMENT_WRITE_BIT, nbl::asset::PIPELINE_STAGE_FLAGS::COLOR_ATTACHMENT_OUTPUT_BIT,
+						IGPUImage::LAYOUT::ATTACHMENT_OPTIMAL)
+					.writes(depth, nbl::core::bitflag(nbl::asset::ACCESS_FLAGS::DEPTH_STENCIL_ATTACHMENT_WRITE_BIT) | nbl::asset::ACCESS_FLAGS::DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+						nbl::core::bitflag(nbl::asset::PIPELINE_STAGE_FLAGS::EARLY_FRAGMENT_TESTS_BIT) | nbl::asset::PIPELINE_STAGE_FLAGS::LATE_FRAGMENT_TESTS_BIT,
+						IGPUImage::LAYOUT::ATTACHMENT_OPTIMAL);
+
+				const auto graphStart = clock_t::now();
+				if (graph->compile())
 				{
-					// begin renderpass
+					graph->execute(&m_Renderer);
+
+					// barriers emitted per pass, compared with what recording each draw's barriers right away would add
+					m_graphTime += clock_t::now() - graphStart;
+					if (++m_graphTimeFrames == RecordTimingFrames)
 					{
-						const VkRect2D currentRenderArea =
+						const auto& stats = graph->getStats();
+						m_logger->log("Frame graph of %u passes (%u culled) recorded in %.3f ms on average, %u barriers in %u commands, per-draw barriers would add %u barriers and %u commands",
+							ILogger::ELL_PERFORMANCE, stats.passCount, stats.culledPassCount,
+							std::chrono::duration<double, std::milli>(m_graphTime).count() / RecordTimingFrames,
+							stats.barrierEntryCount, stats.barrierCommandCount, stats.coveredBarrierCount, stats.gatheredCommandCount);
+						for (uint32_t i = 0U; i < graph->getPassCount(); ++i)
 						{
-							.offset = {0,0},
-							.extent = {m_window->getWidth(),m_window->getHeight()}
-						};
-
-						const IGPUCommandBuffer::SClearColorValue clearValue = { .float32 = {1.f,0.f,0.f,1.f} };
-						const IGPUCommandBuffer::SClearDepthStencilValue depthValue = { .depth = 0.f };
-
-						cmdrec.beginRenderPass(
-							currentRenderArea,
-							clearValue,
-							depthValue,
-							m_Renderer.getFramebuffer(kris::BasePass, m_currImgAcq));
+							const auto& passStats = graph->getPassBarrierStats(i);
+							m_logger->log("Pass %s: %u barriers in %u commands", ILogger::ELL_PERFORMANCE, graph->getPassName(i), passStats.entries, passStats.commands);
+						}
+						m_graphTime = {};
+						m_graphTimeFrames = 0U;
 					}
-
-					cmdrec.drawSceneNode(m_device.get(), kris::BasePass, m_scenenode.get());
-
-					cmdrec.endRenderPass(m_Renderer.getFramebuffer(kris::BasePass, m_currImgAcq), true);
 				}
+				else
+				{
+					m_logger->log("Failed to compile frame graph!", ILogger::ELL_ERROR);
 
-				m_Renderer.consumeAsPass(kris::BasePass, std::move(cmdrec));
+					// nothing got recorded, backbuffer still has to be presentable
+					kris::CommandRecorder cmdrec = m_Renderer.createCommandRecorder();
+					cmdrec.transitionLayout(m_Renderer.getSwapchainImage(m_currImgAcq), IGPUImage::LAYOUT::PRESENT_SRC);
+					cmdrec.flushBarriers();
+					m_Renderer.consumeAsPass(std::move(cmdrec));
+				}
 			}
 
 			//m_api->startCapture();
@@ -547,35 +702,8 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 				nbl::core::bitflag<nbl::asset::PIPELINE_STAGE_FLAGS>(nbl::asset::PIPELINE_STAGE_FLAGS::COMPUTE_SHADER_BIT) | nbl::asset::PIPELINE_STAGE_FLAGS::ALL_GRAPHICS_BITS);
 			//m_api->endCapture();
 
-#define CHECK_COMPUTE_RESULT 0
-
-#if CHECK_COMPUTE_RESULT
-			m_Renderer.blockForCurrentFrame(); // wait to read CS result on CPU
-#endif 
-
 			m_Renderer.endFrame();
 
-#if CHECK_COMPUTE_RESULT
-			if (!m_buffAllocation->map(IDeviceMemoryAllocation::EMCAF_READ))
-			{
-				logFail("Failed to map the Device Memory!\n");
-				return;
-			}
-			m_buffAllocation->invalidate(m_device.get());
-			auto buffData = reinterpret_cast<const uint32_t*>(m_buffAllocation->getMappedPtr());
-
-			for (auto i = 0; i < WorkgroupSize * WorkgroupCount; i++)
-			{
-				if (buffData[i] != i)
-				{
-					logFail("DWORD at position %d doesn't match!\n", i);
-					break;
-				}
-			}
-
-			m_buffAllocation->unmap();
-#endif
-
 			//m_sc->present(m_currentImageAcquire.imageIndex, { &rendered, 1U });
 			// present
 			{
@@ -622,15 +750,26 @@ class KrisTestApp final : public examples::SimpleWindowedApplication
 
 		kris::refctd<nbl::asset::IAssetManager> m_assetMgr;
 
-		kris::refctd<nbl::asset::ICPUImage> m_cpuimg;
+		kris::TextureStreamer m_TexStreamer;
+		bool m_texResident = false;
 		GeometryCreator::return_type m_cubedata;
 
+		kris::JobSystem m_Jobs; // outlives everything submitting to it
 		kris::ResourceAllocator m_ResourceAlctr;
+		kris::MemDefragmenter m_Defrag;
+		kris::AsyncUploader m_AsyncUploader;
+		kris::AsyncUploader::Ticket m_texUploadTicket;
+		kris::MipGenerator m_MipGen;
 		kris::Renderer m_Renderer;
 
 		kris::Scene m_Scene;
 		kris::refctd<kris::SceneNode> m_scenenode;
 		kris::refctd<kris::SceneNode> m_childnode;
+		core::vector<kris::SceneNode*> m_drawNodes; // flattened scene, rebuilt every frame
+		clock_t::duration m_recordTime = {};
+		uint32_t m_recordTimeFrames = 0U;
+		clock_t::duration m_graphTime = {};
+		uint32_t m_graphTimeFrames = 0U;
 
 		kris::refctd<kris::BufferResource> m_buffAllocation;
 		kris::refctd<kris::ComputeMaterial> m_mtl;